@@ -0,0 +1,29 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- The cost of the call-stack of a Lua state created and closed, with `PT_POOL` and
+-- without, with `pt-lua` after `make tests`:
+--     ./pt-lua bench/pool.lua [states] [capacity]
+-- The state itself is left out. With glibc, compare MALLOC_MMAP_THRESHOLD_=131072,
+-- which turns off the threshold glibc raises after freeing large buffers.
+
+local module = require "spec.tracebacks.pool.module"
+
+local states   = tonumber(arg and arg[1]) or 20000
+local capacity = tonumber(arg and arg[2]) or 100000
+
+-- Microseconds per state.
+local function run(storage)
+    local start = os.clock()
+    module.churn_fn(states, 1, capacity, storage)
+    return (os.clock() - start) / states * 1e6
+end
+
+local none = run("none")
+local heap = run("heap") - none
+local pool = run("pool") - none
+local _, _, high_water = module.stats_fn(capacity)
+print(string.format("heap %7.2f us/state  %d call-stacks allocated", heap, states))
+print(string.format("pool %7.2f us/state  %g call-stacks allocated", pool, high_water))
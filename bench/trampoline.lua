@@ -0,0 +1,29 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- The cost of a trampoline (`pallene_tracer_wrap`) against the raw call, with `pt-lua`:
+--     ./pt-lua bench/trampoline.lua [calls]
+
+local calls = tonumber(arg and arg[1]) or 10000000
+
+local raw = { byte = string.byte, max = math.max }
+local wrapped = pallene_tracer_wrap({ byte = string.byte, max = math.max }, "bench")
+
+-- Nanoseconds per call, the loop itself left out.
+local function run(f, ...)
+    local start = os.clock()
+    for _ = 1, calls do
+        f(...)
+    end
+    return (os.clock() - start) / calls * 1e9
+end
+
+local empty = run(function() end)
+for _, case in ipairs({ { "byte", "a" }, { "max", 1, 2, 3 } }) do
+    local name = case[1]
+    local r = run(raw[name], table.unpack(case, 2)) - empty
+    local w = run(wrapped[name], table.unpack(case, 2)) - empty
+    print(string.format("%-6s raw %6.1f ns  wrapped %6.1f ns  (+%.1f ns)", name, r, w, w - r))
+end
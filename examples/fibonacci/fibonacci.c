@@ -35,7 +35,7 @@
     PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
 
 #define FIB_C_FRAMEEXIT()                               \
-    PALLENE_TRACER_FRAMEEXIT(fnstack)
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
 
 /* ---------------- PALLENE TRACER C INTERFACE END ---------------- */
 
@@ -49,6 +49,11 @@
 #endif                  /* } */
 
 
+/* `dladdr` is a GNU extension in glibc. We use it to name native frames. */
+#if defined(__linux__) && !defined(_GNU_SOURCE)
+#define _GNU_SOURCE
+#endif
+
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -60,9 +65,57 @@
 #include "lauxlib.h"
 #include "lualib.h"
 
+/* Modules built with `-finstrument-functions` call our hooks. */
+/* We own the extra space of our threads, so modules built with
+   `PT_EXTRASPACE` find the call-stack there in every thread. */
+/* Our symbols are exported, so we hold the sinks of the process. We also
+   expose the call counters of the modules to Lua, and on Linux, the
+   performance counters of the functions. We record the call graph, the
+   latency of Lua interface functions, and their CPU time by context too. */
 #define PT_IMPLEMENTATION
+#define PT_INSTRUMENT
+#define PT_EXTRASPACE
+#define PT_SINKS
+#define PT_COUNTERS
+#if defined(__linux__)
+#define PT_PERF
+#endif
+#define PT_CALLGRAPH
+#define PT_LATENCY
+#define PT_ACCOUNTING
 #include "ptracer.h"
 
+#if defined(__unix__) || defined(__APPLE__)
+#include <dlfcn.h>
+#define PT_LUA_USE_DLADDR
+#endif
+
+#if defined(__GLIBC__)
+#include <link.h>
+#endif
+
+/* Stack dumps on SIGQUIT/SIGUSR1 write from the signal handler. */
+#if defined(__unix__) || defined(__APPLE__)
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <unistd.h>
+#define PT_LUA_USE_DUMP
+#endif
+
+/* The watchdog reads the Pallene call-stack from its own thread. */
+#if defined(PT_LUA_USE_DUMP)
+#include <errno.h>
+#include <pthread.h>
+#include <time.h>
+#define PT_LUA_USE_WATCHDOG
+#endif
+
+/* Used to find C interface frames of modules built with `PT_UNWIND`. */
+#if defined(PT_LUA_USE_DLADDR) && (defined(__GLIBC__) || defined(__APPLE__))
+#include <execinfo.h>
+#define PT_LUA_USE_BACKTRACE
+#endif
+
 
 /* Traceback ellipsis top threshold. How many frames should we print
    first to trigger ellipsis? */
@@ -70,13 +123,17 @@
 #define PT_LUA_TRACEBACK_TOP_THRESHOLD           10
 #endif // PT_LUA_TRACEBACK_TOP_THRESHOLD
 
-/* This should always be 2 fewer than top threshold, for symmetry.
-   Becuase we will always have 2 tail frames lingering around at
-   at the end which is not captured by '_countlevels'. Lua also
-   do it like this. */
+/* Traceback ellipsis bottom threshold. How many frames should we print
+   last after the ellipsis? */
 #ifndef PT_LUA_TRACEBACK_BOTTOM_THRESHOLD
-#define PT_LUA_TRACEBACK_BOTTOM_THRESHOLD        8
-#endif // PT_RUN_TRACEBACK_BOTTOM_THRESHOLD
+#define PT_LUA_TRACEBACK_BOTTOM_THRESHOLD        10
+#endif // PT_LUA_TRACEBACK_BOTTOM_THRESHOLD
+
+
+/* How deep into the C stack do we look for frames of modules built with `PT_UNWIND`? */
+#ifndef PT_LUA_BACKTRACE_DEPTH
+#define PT_LUA_BACKTRACE_DEPTH                   1024
+#endif // PT_LUA_BACKTRACE_DEPTH
 
 
 #if !defined(LUA_PROGNAME)
@@ -92,6 +149,8 @@
 
 static lua_State *globalL = NULL;
 
+static pt_fnstack_t *globalstack = NULL;  /* Pallene call-stack of 'globalL' */
+
 static const char *progname = LUA_PROGNAME;
 
 
@@ -184,96 +243,322 @@ static bool pushglobalfuncname(lua_State *L) {
 }
 
 
-/* Returns the maximum number of levels in Lua stack. */
-static int countlevels(lua_State *L) {
-  lua_Debug ar;
-  int li = 1, le = 1;
+/* Traceback lines are collected before rendering them. This way runs of identical lines
+   can be collapsed into one and the ellipsis knows exactly how many lines are there. */
+typedef struct tblines {
+  int table;  /* Absolute index of the table holding the lines and their repeat counts. */
+  int n;      /* Number of collected (collapsed) lines. */
+} tblines_t;
 
-  /* Find an upper bound */
-  while (lua_getstack(L, le, &ar)) {
-    li = le, le *= 2;
-  }
 
-  /* Do a binary search */
-  while (li < le) {
-    int m = (li + le) / 2;
+/* Pops a traceback line, standing for `times` frames, from the Lua stack and collects it.
+   If the line is identical to the previous one, we just bump the repeat count of the
+   previous line. */
+static void addline(lua_State *L, tblines_t *lines, lua_Integer times) {
+  if(lines->n > 0) {
+    lua_rawgeti(L, lines->table, 2 * lines->n - 1);
+    bool same = lua_rawequal(L, -1, -2);
+    lua_pop(L, 1);
 
-    if (lua_getstack(L, m, &ar)) li = m + 1;
-    else le = m;
+    if(same) {
+      lua_pop(L, 1);  /* the line */
+      lua_rawgeti(L, lines->table, 2 * lines->n);
+      times += lua_tointeger(L, -1);
+      lua_pop(L, 1);
+      lua_pushinteger(L, times);
+      lua_rawseti(L, lines->table, 2 * lines->n);
+      return;
+    }
   }
 
-  return le - 1;
+  lines->n++;
+  lua_rawseti(L, lines->table, 2 * lines->n - 1);
+  lua_pushinteger(L, times);
+  lua_rawseti(L, lines->table, 2 * lines->n);
 }
 
 
-/* Counts the number of white and black frames in the Pallene call stack. */
-static void countframes(pt_fnstack_t *fnstack, int *mwhite, int *mblack) {
-  *mwhite = *mblack = 0;
+/* How many frames does the collected line at `i` stand for? */
+static lua_Integer linetimes(lua_State *L, tblines_t *lines, int i) {
+  lua_rawgeti(L, lines->table, 2 * i);
+  lua_Integer times = lua_tointeger(L, -1);
+  lua_pop(L, 1);
+
+  return times;
+}
 
-  for(int i = 0; i < fnstack->count; i++) {
-    *mwhite += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_C);
-    *mblack += (fnstack->stack[i].type == PALLENE_TRACER_FRAME_TYPE_LUA);
+
+/* Pushes a number with thousands separators, e.g. "49,998". */
+static void pushgrouped(lua_State *L, lua_Integer n) {
+  char digits[32], grouped[48];
+  int len = snprintf(digits, sizeof(digits), LUA_INTEGER_FMT, n);
+  int j = 0;
+
+  for(int i = 0; i < len; i++) {
+    if(i > 0 && (len - i) % 3 == 0)
+      grouped[j++] = ',';
+    grouped[j++] = digits[i];
   }
+
+  lua_pushlstring(L, grouped, j);
 }
 
 
-/* This function is called by `debugtraceback` function decides whether to print the stack frame info string
-   pushed onto the Lua stack. The function is also responsible for printing ellipsis (skipped frames). If we
-   are skipping frames, the current frame pushed in stack is not printed. */
-/* Pops the frame string from the Lua stack. */
-/* pframes = Amount of printed frames; current count, nframes = Number of total frames to be printed. */
-static void render(lua_State *L, luaL_Buffer *buf, int pframes, int nframes) {
-  /* Should we print? Are we at any point in top or bottom printing threshold? */
-  bool should_print = (pframes <= PT_LUA_TRACEBACK_TOP_THRESHOLD)
-    || ((nframes - pframes) <= PT_LUA_TRACEBACK_BOTTOM_THRESHOLD);
+/* Adds the collected lines to the buffer. Lines standing for more than one frame get
+   a repeat count. If there are too many lines, the ones in the middle are skipped
+   and replaced by an ellipsis. */
+static void render(lua_State *L, luaL_Buffer *buf, tblines_t *lines) {
+  /* Lines in between the thresholds are skipped. */
+  int first_skip = PT_LUA_TRACEBACK_TOP_THRESHOLD + 1;
+  int last_skip  = lines->n - PT_LUA_TRACEBACK_BOTTOM_THRESHOLD;
+
+  for(int i = 1; i <= lines->n; i++) {
+    if(i >= first_skip && i <= last_skip) {
+      /* Have we escaped the threshold to skip frames? */
+      if(i == first_skip) {
+        lua_Integer skipped = 0;
+        for(int j = first_skip; j <= last_skip; j++)
+          skipped += linetimes(L, lines, j);
+
+        lua_pushfstring(L, "\n\n    ... (Skipped %I frames) ...\n", skipped);
+        luaL_addvalue(buf);
+      }
+
+      continue;
+    }
 
-  if(should_print)
+    lua_rawgeti(L, lines->table, 2 * i - 1);
     luaL_addvalue(buf);
-  else {
-    /* The frame string pushed onto the stack. We are not printing it, so just pop it out. */
-    lua_pop(L, 1);
 
-    /* Have we escaped the threshold to skip frames? */
-    if(pframes == PT_LUA_TRACEBACK_TOP_THRESHOLD + 1) {
-      lua_pushfstring(L, "\n\n    ... (Skipped %d frames) ...\n",
-        nframes - (PT_LUA_TRACEBACK_TOP_THRESHOLD
-        + PT_LUA_TRACEBACK_BOTTOM_THRESHOLD));
+    lua_Integer times = linetimes(L, lines, i);
+    if(times > 1) {
+      luaL_addstring(buf, " (x ");
+      pushgrouped(L, times);
       luaL_addvalue(buf);
+      luaL_addchar(buf, ')');
     }
   }
 }
 
 
-/* Pallene Tracer explicit traceback function to show Pallene call-stack
-   tracebacks. */
-int debugtraceback(lua_State *L, const char* msg) {
+/* Registry key of the table caching traceback lines of native frames by address. */
+#define PT_LUA_SYMBOLS_ENTRY    "__PT_LUA_SYMBOLS"
+
+
+/* Pushes the traceback line of the native function containing `fn_addr`, e.g.
+   "module.so: in function 'fn'". Functions missing from the dynamic symbol table get
+   their offset in the object instead. Resolving is slow, so the lines are cached by
+   address. */
+static void pushnative(lua_State *L, void *fn_addr) {
+  if(lua_getfield(L, LUA_REGISTRYINDEX, PT_LUA_SYMBOLS_ENTRY) != LUA_TTABLE) {
+    lua_pop(L, 1);
+    lua_newtable(L);
+    lua_pushvalue(L, -1);
+    lua_setfield(L, LUA_REGISTRYINDEX, PT_LUA_SYMBOLS_ENTRY);
+  }
+
+  if(lua_rawgetp(L, -1, fn_addr) == LUA_TSTRING) {
+    lua_remove(L, -2);  /* the cache */
+    return;
+  }
+  lua_pop(L, 1);
+
+#ifdef PT_LUA_USE_DLADDR
+  Dl_info info;
+#ifdef __GLIBC__
+  const ElfW(Sym) *sym = NULL;
+  int found = dladdr1(fn_addr, &info, (void **) &sym, RTLD_DL_SYMENT);
+#else
+  int found = dladdr(fn_addr, &info);
+#endif
+
+  if(found != 0 && info.dli_fname != NULL) {
+    /* `dladdr` gives the closest exported symbol, which is wrong for the functions it
+       does not know about. Is the address really inside the symbol? */
+    bool named = info.dli_sname != NULL && (info.dli_saddr == fn_addr
+#ifdef __GLIBC__
+      || (sym != NULL && (char *) fn_addr < (char *) info.dli_saddr + sym->st_size)
+#endif
+      );
+
+    if(named)
+      lua_pushfstring(L, "\n    %s: in function '%s'", info.dli_fname, info.dli_sname);
+    else
+      lua_pushfstring(L, "\n    %s+%p: in function '<?>'", info.dli_fname,
+        (void *) ((char *) fn_addr - (char *) info.dli_fbase));
+  } else
+#endif
+    lua_pushfstring(L, "\n    C: in function '<%p>'", fn_addr);
+
+  lua_pushvalue(L, -1);
+  lua_rawsetp(L, -3, fn_addr);
+  lua_remove(L, -2);  /* the cache */
+}
+
+
+#ifdef PT_LUA_USE_BACKTRACE
+/* Is the code at `addr` part of the shared object loaded at `base`? */
+static bool inobject(void *addr, void *base) {
+  Dl_info info;
+  return dladdr(addr, &info) != 0 && info.dli_fbase == base;
+}
+
+
+/* Collects the C interface frames of a Lua interface function with nothing recorded
+   above it (`PT_UNWIND`). They are the next run of frames in the C stack belonging to
+   the shared object of the function, the function itself being the outermost one. */
+/* `natives` holds return addresses, `cursor` is where the previous run ended. */
+static void addunwound(lua_State *L, tblines_t *lines, void **natives, int n,
+    int *cursor, lua_CFunction fn) {
+  Dl_info info;
+  if(dladdr((void *) (uintptr_t) fn, &info) == 0)
+    return;
+
+  int i = *cursor;
+
+  /* Skip Lua itself and everything else in between. */
+  while(i < n && !inobject(natives[i], info.dli_fbase))
+    i++;
+
+  /* A return address may be just past the end of the function, hence the -1. */
+  for(; i < n && inobject(natives[i], info.dli_fbase); i++) {
+    pushnative(L, (char *) natives[i] - 1);
+    addline(L, lines, 1);
+  }
+
+  *cursor = i;
+}
+#endif
+
+
+#if defined(PT_LUA_USE_DUMP)
+/* Set while a stack dump builds the traceback of the running thread. */
+static bool dumping = false;
+static const pt_fn_details_t *dumpdescriptor (const pt_fn_details_t *details);
+#endif
+
+
+/* Pushes the traceback line of a function in the Pallene stack. */
+static void pushdetails(lua_State *L, const pt_fn_details_t *details, int line,
+    bool inlined) {
+  const char *suffix = inlined ? " (inlined)" : "";
+
+#if defined(PT_LUA_USE_DUMP)
+  if(dumping)
+    details = dumpdescriptor(details);
+#endif
+
+  if(line > 0)
+    lua_pushfstring(L, "\n    %s:%d: in function '%s'%s", details->filename, line,
+      details->fn_name, suffix);
+  else  /* lines not tracked (`PT_LEVEL`) */
+    lua_pushfstring(L, "\n    %s: in function '%s'%s", details->filename,
+      details->fn_name, suffix);
+}
+
+
+/* Pushes the traceback line of a frame in the Pallene stack. */
+static void pushframe(lua_State *L, pt_frame_t *frame) {
+  if(frame->type == PALLENE_TRACER_FRAME_TYPE_NATIVE)
+    pushnative(L, frame->shared.native.fn_addr);
+  else
+    pushdetails(L, frame->shared.details, frame->line, false);
+}
+
+
+/* Adds the traceback lines of a frame in the Pallene stack, at `line`, standing for
+   `times` frames. An inlined frame stands for the calls inlined into its function as
+   well, innermost first. */
+static void addframeat(lua_State *L, tblines_t *lines, pt_frame_t *frame, int line,
+    lua_Integer times) {
+  if(frame->type == PALLENE_TRACER_FRAME_TYPE_INLINED) {
+    const pt_inlined_t *chain = frame->shared.c.chain;
+
+    for(int i = chain->length - 1; i >= 0; i--) {
+      if(i >= PALLENE_TRACER_MAX_INLINED)
+        continue;
+      pushdetails(L, chain->details[i], line, true);
+      addline(L, lines, times);
+      line = chain->lines[i];
+    }
+
+    pushdetails(L, frame->shared.details, line, false);
+  } else if(frame->type == PALLENE_TRACER_FRAME_TYPE_NATIVE)
+    pushnative(L, frame->shared.native.fn_addr);
+  else
+    pushdetails(L, frame->shared.details, line, false);
+
+  addline(L, lines, times);
+}
+
+
+/* Adds the traceback lines of a frame in the Pallene stack. Run-length encoded frames
+   (`PT_RLE`) stand for several frames, the outer ones at the line they called the
+   next one from. */
+static void addframe(lua_State *L, tblines_t *lines, pt_frame_t *frame) {
+  int repeat = pallene_tracer_repeat(frame);
+
+  addframeat(L, lines, frame, frame->line, 1);
+  if(repeat > 0)
+    addframeat(L, lines, frame, frame->shared.c.repeat_line, repeat);
+}
+
+
+/* The C function at `idx`, or the one it calls if it is a trampoline
+   (`pallene_tracer_wrap`), which is its last upvalue. */
+static lua_CFunction tracedfunction(lua_State *L, int idx) {
+  lua_CFunction fn = lua_tocfunction(L, idx);
+  if(fn != _pallene_tracer_trampoline)
+    return fn;
+
+  idx = lua_absindex(L, idx);
+  int up = 1;
+  while(lua_getupvalue(L, idx, up + 1) != NULL) {
+    lua_pop(L, 1);
+    up++;
+  }
+  lua_getupvalue(L, idx, up);
+  fn = ((const pt_trampoline_t *) lua_touserdata(L, -1))->fn;
+  lua_pop(L, 1);
+
+  return fn;
+}
+
+
+/* Builds the traceback starting at stack `level`, merging the Pallene call-stack in. */
+static int tracebackfrom(lua_State *L, const char *msg, int level) {
   lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
-  pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, -1);
+  pt_fnstack_t *fnstack = *(pt_fnstack_t **) lua_touserdata(L, -1);
   pt_frame_t *stack = fnstack->stack;
-  /* The point where we are in the Pallene stack. */
-  int index = fnstack->count - 1;
+  /* The point where we are in the Pallene stack. Frames past the capacity
+     were never recorded. */
+  int index = (fnstack->count < fnstack->capacity ? fnstack->count : fnstack->capacity) - 1;
+  int unrecorded = fnstack->count - (index + 1);
   lua_pop(L, 1);
 
-  /* Max number of white and black frames. */
-  int mwhite, mblack;
-  countframes(fnstack, &mwhite, &mblack);
-  /* Max levels of Lua stack. */
-  int mlevel = countlevels(L);
+#ifdef PT_USDT
+  /* The innermost frame is where the error came from. */
+  if(index >= 0)
+    _PALLENE_TRACER_PROBE_FRAME(traceback, &stack[index], fnstack->count);
+  else
+    PALLENE_TRACER_PROBE(traceback, NULL, NULL, 0, fnstack->count);
+#endif
 
-  /* Total frames we are going to print. */
-  /* Black frames are used for switching and we will start from
-     Lua stack level 1. */
-  int nframes = mlevel + mwhite - mblack - 1;
-  /* Amount of frames printed. */
-  int pframes = 0;
+  _PALLENE_TRACER_EMIT(PALLENE_TRACER_EVENT_TRACEBACK, fnstack,
+    index >= 0 ? &stack[index] : NULL);
 
-  luaL_Buffer buf;
-  luaL_buffinit(L, &buf);
-  lua_pushfstring(L, "%s\nstack traceback:", msg);
-  luaL_addvalue(&buf);
+#ifdef PT_LUA_USE_BACKTRACE
+  /* The C stack is still there, we are called before the error unwinds it. */
+  void *natives[PT_LUA_BACKTRACE_DEPTH];
+  int nnatives = backtrace(natives, PT_LUA_BACKTRACE_DEPTH);
+  int cursor = 0;
+#endif
+
+  tblines_t lines = { 0, 0 };
+  lua_newtable(L);
+  lines.table = lua_gettop(L);
 
   lua_Debug ar;
-  int level = 1;
   const char *tname;
 
   while(lua_getstack(L, level++, &ar)) {
@@ -283,29 +568,78 @@ int debugtraceback(lua_State *L, const char* msg) {
     /* If the frame is a C frame. */
     if(lua_iscfunction(L, -1)) {
       if(index >= 0) {
-        /* Check whether this frame is tracked (C interface frames). */
-        int check = index;
-        while(stack[check].type != PALLENE_TRACER_FRAME_TYPE_LUA)
-          check--;
+        /* A trampoline has the frames of the function it calls. */
+        lua_CFunction fn = tracedfunction(L, -1);
+        bool trampoline = lua_tocfunction(L, -1) == _pallene_tracer_trampoline;
+
+        /* Check whether this frame is tracked. It is either a Lua interface frame or,
+           if the function is instrumented, the native frame of the function itself.
+           Below a trampoline, the frames of other trampolines are those of calls a Lua
+           error left behind, as the calls above were matched already: they are skipped,
+           with everything above them. */
+        int check = index, stale = index + 1;
+        for(;;) {
+          while(check >= 0 && stack[check].type != PALLENE_TRACER_FRAME_TYPE_LUA
+              && !(stack[check].type == PALLENE_TRACER_FRAME_TYPE_NATIVE
+                   && (uintptr_t) stack[check].shared.native.fn_addr == (uintptr_t) fn))
+            check--;
+          if(!trampoline || check < 0 || check + 1 > index
+              || stack[check].type != PALLENE_TRACER_FRAME_TYPE_LUA
+              || fn == stack[check].shared.c_fnptr
+              || stack[check + 1].type != PALLENE_TRACER_FRAME_TYPE_C
+              || stack[check + 1].shared.trampoline.sp == 0)
+            break;
+          stale = check--;
+        }
 
         /* If the frame matches, we switch to printing Pallene frames. */
-        if(lua_tocfunction(L, -1) == stack[check].shared.c_fnptr) {
+        if(check >= 0 && (stack[check].type == PALLENE_TRACER_FRAME_TYPE_NATIVE
+            || fn == stack[check].shared.c_fnptr)) {
           lua_pop(L, 1);  /* the function */
 
-          /* Now print all the frames in Pallene stack. */
-          for(; index > check; index--) {
-            lua_pushfstring(L, "\n    %s:%d: in function '%s'",
-              stack[index].shared.details->filename,
-              stack[index].line, stack[index].shared.details->fn_name);
-            pframes++;  /* We are printing the frame regardless of frame visibility. */
-            render(L, &buf, pframes, nframes);
+          /* Frames we could not record are the innermost ones. */
+          if(unrecorded > 0) {
+            lua_pushliteral(L, "\n    ... (");
+            pushgrouped(L, unrecorded);
+            lua_pushliteral(L, " frames not recorded) ...");
+            lua_concat(L, 3);
+            addline(L, &lines, 1);
+            unrecorded = 0;
+          }
+
+#ifdef PT_LUA_USE_BACKTRACE
+          /* Nothing recorded? The module keeps Lua interface frames only. */
+          bool unwind = stack[check].type == PALLENE_TRACER_FRAME_TYPE_LUA && stale - 1 == check;
+#endif
+
+          /* Now print all the frames in Pallene stack. Hooked frames
+             (`pallene_tracer_hook_lua`) are Lua frames, printed as such. */
+          for(index = stale - 1; index > check; index--) {
+            if(stack[index].type == PALLENE_TRACER_FRAME_TYPE_HOOKED)
+              continue;
+            addframe(L, &lines, &stack[index]);
           }
 
-          /* 'check' idx is guaranteed to be a Lua interface frame.
-             Which is basically our 'stack' index at this point. So,
-             we simply ignore the Lua interface frame. */
+#ifdef PT_LUA_USE_BACKTRACE
+          if(unwind)
+            addunwound(L, &lines, natives, nnatives, &cursor, fn);
+#endif
+
+          /* The native frame of the function stands for the function itself. */
+          if(stack[check].type == PALLENE_TRACER_FRAME_TYPE_NATIVE) {
+            pushframe(L, &stack[check]);
+            addline(L, &lines, 1);
+          }
+
+          /* 'check' idx is either the Lua interface frame, which we simply ignore, or
+             the native frame we just printed. */
           index--;
 
+          /* An instrumented Lua interface function has a native frame right below. */
+          if(index >= 0 && stack[index].type == PALLENE_TRACER_FRAME_TYPE_NATIVE
+              && (uintptr_t) stack[index].shared.native.fn_addr == (uintptr_t) fn)
+            index--;
+
           /* We are done. */
           continue;
         }
@@ -319,8 +653,7 @@ int debugtraceback(lua_State *L, const char* msg) {
 
       lua_pop(L, 1);  /* the function */
       lua_pushfstring(L, "\n    C: in function '%s'", tname);
-      pframes++;
-      render(L, &buf, pframes, nframes);
+      addline(L, &lines, 1);
     } else {
       /* It's a Lua frame. */
 
@@ -343,15 +676,29 @@ int debugtraceback(lua_State *L, const char* msg) {
       lua_pop(L, 1);  /* the function */
       lua_pushfstring(L, "\n    %s:%d: in %s", ar.short_src,
         ar.currentline, tname);
-      pframes++;
-      render(L, &buf, pframes, nframes);
+      addline(L, &lines, 1);
     }
   }
 
+  luaL_Buffer buf;
+  luaL_buffinit(L, &buf);
+  lua_pushfstring(L, "%s\nstack traceback:", msg);
+  luaL_addvalue(&buf);
+  render(L, &buf, &lines);
   luaL_pushresult(&buf);
+
+  /* Remove the collected lines, keeping the result. */
+  lua_remove(L, lines.table);
   return 1;
 }
 
+
+/* Pallene Tracer explicit traceback function to show Pallene call-stack
+   tracebacks. */
+int debugtraceback(lua_State *L, const char* msg) {
+  return tracebackfrom(L, msg, 1);
+}
+
 /* ---------------- PALLENE TRACER CODE END ---------------- */
 
 
@@ -378,6 +725,524 @@ static void laction (int i) {
 }
 
 
+/* -------- PALLENE TRACER CODE -------- */
+
+#if defined(PT_LUA_USE_DUMP)  /* { */
+
+/*
+** Stack dumps. On SIGQUIT or SIGUSR1, the handler writes the Pallene
+** call-stack right away, which works even if a C function never returns
+** to Lua. Then it sets a hook, like 'laction', which dumps the Lua stacks
+** of every coroutine it finds. The process keeps running. The dump goes
+** to stderr, or to the file named by PT_LUA_DUMP.
+*/
+
+static int dumpfd = 2;
+
+/*
+** Where the C stack of the interpreter starts, and how far down it may
+** grow (0 if unknown). Descriptors in it are local variables of their
+** functions, which may have returned while their frames are still in the
+** call-stack: their finalizer, or a signal, is on the way. Dumps do not
+** read them.
+*/
+static uintptr_t dumpstacktop = 0;
+static uintptr_t dumpstacksize = 0;
+
+static const pt_fn_details_t dumpdynamic = PALLENE_TRACER_FN_DETAILS("<?>", "<dynamic>");
+
+
+/* The descriptor to write for 'details'. */
+static const pt_fn_details_t *dumpdescriptor (const pt_fn_details_t *details) {
+  uintptr_t p = (uintptr_t)details;
+  if (dumpstacksize == 0 || (p < dumpstacktop && dumpstacktop - p <= dumpstacksize))
+    return &dumpdynamic;
+  return details;
+}
+
+static lua_Hook dumpprev_hook = NULL;  /* the hook we replace, restored later */
+static int dumpprev_mask = 0;
+static int dumpprev_count = 0;
+
+
+/* Async-signal-safe writes. */
+static void dumpstr (const char *s) {
+  size_t len = strlen(s);
+  while (len > 0) {
+    ssize_t n = write(dumpfd, s, len);
+    if (n <= 0) return;
+    s += n;
+    len -= (size_t)n;
+  }
+}
+
+static void dumpint (unsigned long long n, int base) {
+  char buf[32];
+  int i = sizeof(buf) - 1;
+  buf[i] = '\0';
+  do {
+    buf[--i] = "0123456789abcdef"[n % base];
+    n /= base;
+  } while (n > 0 && i > 0);
+  if (base == 16) dumpstr("0x");
+  dumpstr(buf + i);
+}
+
+
+/* Writes the Pallene call-stack, innermost frame first. Names of native
+   frames are not resolved, 'dladdr' is not async-signal-safe. If 'ages'
+   is not NULL, it has the age of each frame in milliseconds. */
+static void dumpdetails (const pt_fn_details_t *details, int line) {
+  details = dumpdescriptor(details);
+  dumpstr("\n    ");
+  dumpstr(details->filename);
+  if (line > 0) {
+    dumpstr(":");
+    dumpint((unsigned)line, 10);
+  }
+  dumpstr(": in function '");
+  dumpstr(details->fn_name);
+  dumpstr("'");
+}
+
+
+/* Writes a frame with a descriptor at 'line', with the calls inlined into it. */
+static void dumpframeat (pt_frame_t *frame, int line) {
+  if (frame->type == PALLENE_TRACER_FRAME_TYPE_INLINED) {
+    const pt_inlined_t *chain = frame->shared.c.chain;
+    for (int j = chain->length - 1; j >= 0; j--) {
+      if (j >= PALLENE_TRACER_MAX_INLINED) continue;
+      dumpdetails(chain->details[j], line);
+      dumpstr(" (inlined)");
+      line = chain->lines[j];
+    }
+  }
+  dumpdetails(frame->shared.details, line);
+}
+
+
+/*
+** 'count' is the depth the caller read: the watchdog has ages for as
+** many frames, while the call-stack goes on changing.
+*/
+static void dumppallene (pt_fnstack_t *fnstack, int count,
+                         const unsigned long long *ages) {
+  int recorded = count < fnstack->capacity ? count : fnstack->capacity;
+  dumpstr("Pallene stack (");
+  dumpint((unsigned)count, 10);
+  dumpstr(" frames):");
+  if (count > recorded) {
+    dumpstr("\n    ... (");
+    dumpint((unsigned)(count - recorded), 10);
+    dumpstr(" frames not recorded) ...");
+  }
+  for (int i = recorded - 1; i >= 0; i--) {
+    pt_frame_t *frame = &fnstack->stack[i];
+    switch (frame->type) {
+      case PALLENE_TRACER_FRAME_TYPE_C:
+      case PALLENE_TRACER_FRAME_TYPE_HOOKED:
+      case PALLENE_TRACER_FRAME_TYPE_INLINED:
+        dumpframeat(frame, frame->line);
+        if (pallene_tracer_repeat(frame) > 0) {  /* the outer repetitions */
+          dumpframeat(frame, frame->shared.c.repeat_line);
+          dumpstr(" (x ");
+          dumpint((unsigned)pallene_tracer_repeat(frame), 10);
+          dumpstr(")");
+        }
+        break;
+      case PALLENE_TRACER_FRAME_TYPE_NATIVE:
+        dumpstr("\n    C: in function <");
+        dumpint((uintptr_t)frame->shared.native.fn_addr, 16);
+        dumpstr(">");
+        break;
+      default:
+        dumpstr("\n    (called from Lua)");
+        break;
+    }
+    if (ages != NULL) {
+      dumpstr(" [");
+      dumpint(ages[i], 10);
+      dumpstr(" ms]");
+    }
+  }
+  dumpstr("\n");
+}
+
+
+/* Objects which may lead to coroutines. */
+#define leadstothreads(t)  ((t) == LUA_TTABLE || (t) == LUA_TFUNCTION || \
+                            (t) == LUA_TTHREAD || (t) == LUA_TUSERDATA)
+
+
+/* Pops the value on top, queueing it if it may lead to coroutines. */
+static void queuevalue (lua_State *L, int queue, int *tail) {
+  if (leadstothreads(lua_type(L, -1)))
+    lua_rawseti(L, queue, (*tail)++);
+  else lua_pop(L, 1);
+}
+
+
+/*
+** Queues what the stack of 'co' holds: the function of every frame and
+** its locals, temporaries included. Values go through the stack of 'co',
+** which is left as it was.
+*/
+static void queuestack (lua_State *L, lua_State *co, int queue, int *tail) {
+  lua_Debug ar;
+  if (co != L && !lua_checkstack(co, 1)) return;
+  for (int level = 0; lua_getstack(co, level, &ar); level++) {
+    lua_getinfo(co, "f", &ar);
+    if (co != L) lua_xmove(co, L, 1);
+    queuevalue(L, queue, tail);
+    for (int n = 1; lua_getlocal(co, &ar, n) != NULL; n++) {
+      if (co != L) lua_xmove(co, L, 1);
+      queuevalue(L, queue, tail);
+    }
+  }
+}
+
+
+/*
+** Adds the coroutines reachable from the registry to the table on top:
+** through tables, upvalues, metatables, user values, and the stacks of
+** the threads found on the way, the running one included.
+*/
+static void findthreads (lua_State *L) {
+  int threads = lua_gettop(L);
+  int head = 1, tail = 1;
+  lua_newtable(L);  /* visited objects */
+  lua_newtable(L);  /* queue of objects to visit */
+  int visited = threads + 1, queue = threads + 2;
+  for (int i = threads; i <= queue; i++) {  /* on the stack of L, not to be walked */
+    lua_pushboolean(L, 1);
+    lua_rawsetp(L, visited, lua_topointer(L, i));
+  }
+  lua_pushvalue(L, LUA_REGISTRYINDEX);
+  lua_rawseti(L, queue, tail++);
+  lua_pushthread(L);
+  lua_rawseti(L, queue, tail++);
+  while (head < tail) {
+    lua_rawgeti(L, queue, head);
+    lua_pushnil(L);
+    lua_rawseti(L, queue, head++);
+    if (lua_rawgetp(L, visited, lua_topointer(L, -1)) != LUA_TNIL) {
+      lua_pop(L, 2);
+      continue;
+    }
+    lua_pop(L, 1);
+    lua_pushboolean(L, 1);
+    lua_rawsetp(L, visited, lua_topointer(L, -2));
+    switch (lua_type(L, -1)) {
+      case LUA_TTABLE:
+        if (lua_getmetatable(L, -1))
+          lua_rawseti(L, queue, tail++);
+        lua_pushnil(L);
+        while (lua_next(L, -2)) {
+          for (int i = -2; i <= -1; i++) {
+            lua_pushvalue(L, i);
+            queuevalue(L, queue, &tail);
+          }
+          lua_pop(L, 1);
+        }
+        break;
+      case LUA_TFUNCTION:
+        for (int i = 1; lua_getupvalue(L, -1, i) != NULL; i++)
+          queuevalue(L, queue, &tail);
+        break;
+      case LUA_TUSERDATA:
+        if (lua_getmetatable(L, -1))
+          lua_rawseti(L, queue, tail++);
+        for (int n = 1; lua_getiuservalue(L, -1, n) != LUA_TNONE; n++)
+          queuevalue(L, queue, &tail);
+        lua_pop(L, 1);  /* the LUA_TNONE */
+        break;
+      case LUA_TTHREAD: {
+        lua_State *co = lua_tothread(L, -1);
+        if (co != L) {
+          lua_pushvalue(L, -1);
+          lua_rawseti(L, threads, (lua_Integer)lua_rawlen(L, threads) + 1);
+        }
+        queuestack(L, co, queue, &tail);
+        break;
+      }
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+}
+
+
+/* The status of a coroutine, as in 'coroutine.status'. */
+static const char *threadstatus (lua_State *co) {
+  lua_Debug ar;
+  if (lua_status(co) == LUA_YIELD) return "suspended";
+  if (lua_status(co) != LUA_OK) return "dead";
+  if (lua_getstack(co, 0, &ar)) return "normal";
+  return lua_gettop(co) == 0 ? "dead" : "suspended";
+}
+
+
+/* Hook set by 'ldumpaction'. Dumps the Lua stacks, the running one merged
+   with the Pallene call-stack. */
+static void ldump (lua_State *L, lua_Debug *ar) {
+  (void)ar;
+  lua_sethook(L, dumpprev_hook, dumpprev_mask, dumpprev_count);
+  dumping = true;
+  tracebackfrom(L, "Lua stacks:\nthread (running)", 0);
+  dumping = false;
+  dumpstr(lua_tostring(L, -1));
+  lua_pop(L, 1);
+  lua_newtable(L);
+  findthreads(L);
+  for (lua_Integer i = 1; lua_rawgeti(L, -1, i) == LUA_TTHREAD; i++) {
+    lua_State *co = lua_tothread(L, -1);
+    const char *status = threadstatus(co);
+    if (strcmp(status, "dead") != 0) {
+      lua_pushfstring(L, "thread %p (%s)", (void *)co, status);
+      luaL_traceback(L, co, lua_tostring(L, -1), 0);
+      dumpstr("\n");
+      dumpstr(lua_tostring(L, -1));
+      lua_pop(L, 2);
+    }
+    lua_pop(L, 1);
+  }
+  lua_pop(L, 2);
+  dumpstr("\n\n");
+}
+
+
+static void ldumpaction (int i) {
+  lua_State *L = globalL;
+  dumpstr("\n");
+  dumpstr(progname);
+  dumpstr(": signal ");
+  dumpint((unsigned)i, 10);
+  dumpstr(", dumping stacks\n");
+  if (globalstack != NULL)
+    dumppallene(globalstack, globalstack->count, NULL);
+  if (L != NULL && lua_gethook(L) != ldump) {
+    dumpprev_hook = lua_gethook(L);
+    dumpprev_mask = lua_gethookmask(L);
+    dumpprev_count = lua_gethookcount(L);
+    lua_sethook(L, ldump, LUA_MASKCALL | LUA_MASKRET | LUA_MASKLINE | LUA_MASKCOUNT, 1);
+  }
+}
+
+
+static void setdumpsignals (void) {
+  char here;
+  struct rlimit limit;
+  dumpstacktop = (uintptr_t)&here;  /* Lua runs below 'main' */
+  if (getrlimit(RLIMIT_STACK, &limit) == 0 && limit.rlim_cur != RLIM_INFINITY)
+    dumpstacksize = (uintptr_t)limit.rlim_cur;
+  const char *path = getenv("PT_LUA_DUMP");
+  if (path != NULL) {
+    int fd = open(path, O_WRONLY | O_CREAT | O_APPEND, 0644);
+    if (fd >= 0) dumpfd = fd;
+  }
+#if defined(SIGQUIT)
+  setsignal(SIGQUIT, ldumpaction);
+#endif
+#if defined(SIGUSR1)
+  setsignal(SIGUSR1, ldumpaction);
+#endif
+}
+
+#else  /* }{ */
+
+#define setdumpsignals()  ((void)0)
+
+#endif  /* } */
+
+
+#if defined(PT_LUA_USE_WATCHDOG)  /* { */
+
+/*
+** Watchdog. When PT_LUA_WATCHDOG is set to a number of milliseconds, a
+** thread polls the Pallene call-stack four times per period, without
+** locks. It only compares what it reads: frames are written by the thread
+** running them. Frames are aged from the first poll that saw them, so ages
+** are lower bounds. A Lua interface frame is told apart from a later call
+** of the same function by its serial number. When the innermost Lua
+** interface call is older than the threshold, the watchdog signals the
+** interpreter, whose handler writes the frames still there the same way
+** as a stack dump, once per call. The stack is only read while the
+** program runs; 'stopwatchdog' joins the thread before 'lua_close'.
+*/
+
+#define WATCHSIGNAL  SIGUSR2
+
+static pthread_t watchthread;
+static pthread_t watchmain;  /* the interpreter */
+static pthread_mutex_t watchmutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watchcond = PTHREAD_COND_INITIALIZER;
+static int watchrunning = 0;
+static int watchstop = 0;
+static unsigned long long watchthreshold = 0;  /* in milliseconds */
+
+/* The report for the handler. The watchdog leaves it alone while pending. */
+static pt_fnstack_t *watchstack = NULL;
+static int watchpending = 0;
+static int watchcount = 0;  /* depth of the call-stack */
+static uintptr_t *watchkeys = NULL;  /* of each frame */
+static unsigned long long *watchages = NULL;  /* of each frame */
+
+
+static unsigned long long watchnow (void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (unsigned long long)ts.tv_sec * 1000 + (unsigned long long)ts.tv_nsec / 1000000;
+}
+
+
+/* What identifies a frame between two polls. */
+static uintptr_t watchkey (const volatile pt_frame_t *frame) {
+  switch (frame->type) {
+    case PALLENE_TRACER_FRAME_TYPE_C:
+    case PALLENE_TRACER_FRAME_TYPE_HOOKED:
+    case PALLENE_TRACER_FRAME_TYPE_INLINED:
+      return (uintptr_t)frame->shared.details;
+    case PALLENE_TRACER_FRAME_TYPE_NATIVE:
+      return frame->shared.native.sp;
+    default:
+      return (uintptr_t)frame->shared.lua.serial;
+  }
+}
+
+
+/* Writes the report, with the frames the watchdog saw which are still
+   there, those above them being newer. */
+static void watchaction (int i) {
+  (void)i;
+  if (!__atomic_load_n(&watchpending, __ATOMIC_ACQUIRE)) return;
+  pt_fnstack_t *fnstack = watchstack;
+  int count = watchcount < fnstack->count ? watchcount : fnstack->count;
+  int recorded = count < fnstack->capacity ? count : fnstack->capacity;
+  int same = 0;
+  while (same < recorded && watchkey(&fnstack->stack[same]) == watchkeys[same])
+    same++;
+  int top = fnstack->top_lua;
+  if (top >= 0 && top < same) {  /* else the call is over */
+    dumpstr("\n");
+    dumpstr(progname);
+    dumpstr(": watchdog: Lua interface call running for ");
+    dumpint(watchages[top], 10);
+    dumpstr(" ms\n");
+    dumppallene(fnstack, same < recorded ? same : count, watchages);
+  }
+  __atomic_store_n(&watchpending, 0, __ATOMIC_RELEASE);
+}
+
+
+static void *watchdog (void *ud) {
+  pt_fnstack_t *fnstack = (pt_fnstack_t *)ud;
+  const volatile pt_fnstack_t *vstack = fnstack;
+  int capacity = 0;  /* of the arrays below */
+  unsigned long long *since = NULL;
+  unsigned long long period = watchthreshold / 4 > 0 ? watchthreshold / 4 : 1;
+  uintptr_t reported = 0;  /* serial number of the last call reported */
+  int seen = 0;  /* number of frames in 'watchkeys' */
+  pthread_mutex_lock(&watchmutex);
+  while (!watchstop) {
+    struct timespec deadline;
+    clock_gettime(CLOCK_REALTIME, &deadline);
+    deadline.tv_sec += (time_t)(period / 1000);
+    deadline.tv_nsec += (long)(period % 1000) * 1000000;
+    if (deadline.tv_nsec >= 1000000000) {
+      deadline.tv_sec++;
+      deadline.tv_nsec -= 1000000000;
+    }
+    if (pthread_cond_timedwait(&watchcond, &watchmutex, &deadline) != ETIMEDOUT)
+      continue;  /* woken up, or spurious wakeup */
+    if (__atomic_load_n(&watchpending, __ATOMIC_ACQUIRE))
+      continue;  /* the handler reads the arrays */
+    if (capacity != vstack->capacity) {  /* created, or grown while empty by 'pallene_tracer_init_ex' */
+      free(watchkeys); free(since); free(watchages);
+      capacity = vstack->capacity;
+      watchkeys = (uintptr_t *)malloc(capacity * sizeof(uintptr_t));
+      since = (unsigned long long *)malloc(capacity * sizeof(unsigned long long));
+      watchages = (unsigned long long *)malloc(capacity * sizeof(unsigned long long));
+      seen = 0;
+      if (watchkeys == NULL || since == NULL || watchages == NULL)
+        break;
+    }
+    unsigned long long now = watchnow();
+    int count = vstack->count;
+    int recorded = count < capacity ? count : capacity;
+    int changed = 0;  /* once a frame changed, the frames above it are new */
+    for (int i = 0; i < recorded; i++) {
+      uintptr_t key = watchkey(&vstack->stack[i]);
+      if (changed || i >= seen || watchkeys[i] != key) {
+        changed = 1;
+        watchkeys[i] = key;
+        since[i] = now;
+      }
+    }
+    seen = recorded;
+    int top = vstack->top_lua;
+    if (top >= 0 && top < recorded && watchkeys[top] != reported
+        && now - since[top] >= watchthreshold) {
+      reported = watchkeys[top];
+      for (int i = 0; i < recorded; i++)
+        watchages[i] = now - since[i];
+      watchcount = count;
+      __atomic_store_n(&watchpending, 1, __ATOMIC_RELEASE);
+      pthread_kill(watchmain, WATCHSIGNAL);
+    }
+  }
+  pthread_mutex_unlock(&watchmutex);
+  free(since);
+  return NULL;
+}
+
+
+static void setwatchdog (pt_fnstack_t *fnstack) {
+  const char *threshold = getenv("PT_LUA_WATCHDOG");
+  if (threshold == NULL || fnstack == NULL) return;
+  watchthreshold = strtoull(threshold, NULL, 10);
+  if (watchthreshold == 0) return;
+  struct sigaction sa;
+  sa.sa_handler = watchaction;
+  sa.sa_flags = SA_RESTART;  /* the calls go on */
+  sigemptyset(&sa.sa_mask);
+  sigaction(WATCHSIGNAL, &sa, NULL);
+  watchmain = pthread_self();
+  watchstack = fnstack;
+  /* The watchdog takes no signals, those of the process go to the interpreter. */
+  sigset_t all, old;
+  sigfillset(&all);
+  pthread_sigmask(SIG_SETMASK, &all, &old);
+  watchrunning = pthread_create(&watchthread, NULL, watchdog, fnstack) == 0;
+  pthread_sigmask(SIG_SETMASK, &old, NULL);
+}
+
+
+/* A report still pending is dropped. */
+static void stopwatchdog (void) {
+  if (!watchrunning) return;
+  sigset_t set;
+  sigemptyset(&set);
+  sigaddset(&set, WATCHSIGNAL);
+  pthread_sigmask(SIG_BLOCK, &set, NULL);
+  pthread_mutex_lock(&watchmutex);
+  watchstop = 1;
+  pthread_cond_signal(&watchcond);
+  pthread_mutex_unlock(&watchmutex);
+  pthread_join(watchthread, NULL);
+  free(watchkeys); free(watchages);
+  watchrunning = 0;
+}
+
+#else  /* }{ */
+
+#define setwatchdog(fnstack)  ((void)(fnstack))
+#define stopwatchdog()  ((void)0)
+
+#endif  /* } */
+
+/* -------- PALLENE TRACER CODE END -------- */
+
+
 static void print_usage (const char *badoption) {
   lua_writestringerror("%s: ", progname);
   if (badoption[1] == 'e' || badoption[1] == 'l')
@@ -468,6 +1333,189 @@ static int docall (lua_State *L, int narg, int nres) {
 }
 
 
+/* -------- PALLENE TRACER CODE -------- */
+
+/*
+** pallene_tracer_budget(steps, seconds, f, ...): calls 'f' in protected
+** mode, like 'xpcall' with the traceback message handler, within a budget
+** of steps and seconds ('nil' or 0 for no limit). Returns what 'pcall'
+** would. Budgets do not nest.
+*/
+static int lbudget (lua_State *L) {
+  lua_Integer steps = luaL_optinteger(L, 1, 0);
+  lua_Number seconds = luaL_optnumber(L, 2, 0);
+  luaL_argcheck(L, steps >= 0, 1, "steps must not be negative");
+  luaL_argcheck(L, seconds >= 0, 2, "seconds must not be negative");
+  luaL_checktype(L, 3, LUA_TFUNCTION);
+  if (globalstack == NULL)
+    return luaL_error(L, "Pallene Tracer is not in debug mode");
+  if (globalstack->budget.ticks != 0)
+    return luaL_error(L, "a budget is already running");
+  lua_pushcfunction(L, msghandler);
+  lua_replace(L, 2);  /* message handler */
+  lua_pushboolean(L, 1);
+  lua_replace(L, 1);  /* 'true', for a successful call */
+  pallene_tracer_budget(L, globalstack, (unsigned long long)steps, (double)seconds);
+  int status = lua_pcall(L, lua_gettop(L) - 3, LUA_MULTRET, 2);
+  pallene_tracer_budget(L, globalstack, 0, 0);
+  if (status != LUA_OK) {
+    lua_pushboolean(L, 0);
+    lua_insert(L, -2);
+    return 2;  /* false, error message */
+  }
+  lua_remove(L, 2);
+  return lua_gettop(L);  /* true, results */
+}
+
+
+/*
+** Writes the calls of every function ('pallene_tracer_stats') to the file
+** named by PT_LUA_STATS when the program ends, a profile for
+** tools/pt-pgo.lua.
+*/
+static void writestats (lua_State *L) {
+  const char *path = getenv("PT_LUA_STATS");
+  FILE *f;
+  if (path == NULL || (f = fopen(path, "w")) == NULL) return;
+  fprintf(f, "# pallene-tracer calls\n");
+  lua_pushcfunction(L, pallene_tracer_stats);
+  if (lua_pcall(L, 0, 1, 0) == LUA_OK) {
+    lua_pushnil(L);
+    while (lua_next(L, -2) != 0) {
+      fprintf(f, "%s " LUA_INTEGER_FMT "\n", lua_tostring(L, -2),
+              lua_tointeger(L, -1));
+      lua_pop(L, 1);
+    }
+  }
+  lua_pop(L, 1);  /* stats or error */
+  fclose(f);
+}
+
+
+/*
+** Call graph of the modules built with PT_SINKS. If PT_LUA_CALLGRAPH
+** names a file, the whole run is recorded and written there when the
+** program ends, as DOT if the name ends in ".dot", for Callgrind
+** otherwise.
+*/
+static const char *callgraph_path (void) {
+  return getenv("PT_LUA_CALLGRAPH");
+}
+
+static void startcallgraph (void) {
+  if (callgraph_path() != NULL && !pallene_tracer_callgraph_start())
+    fprintf(stderr, "pt-lua: no room for the call graph sink\n");
+}
+
+static void writecallgraph (void) {
+  const char *path = callgraph_path();
+  size_t l;
+  FILE *f;
+  if (path == NULL) return;
+  pallene_tracer_callgraph_stop();
+  if ((f = fopen(path, "w")) == NULL) {
+    fprintf(stderr, "pt-lua: cannot write %s\n", path);
+    return;
+  }
+  l = strlen(path);
+  if (!pallene_tracer_callgraph_write(f, (l >= 4 && strcmp(path + l - 4, ".dot") == 0)
+                                         ? PALLENE_TRACER_GRAPH_DOT
+                                         : PALLENE_TRACER_GRAPH_CALLGRIND))
+    fprintf(stderr, "pt-lua: cannot write %s\n", path);
+  fclose(f);
+}
+
+
+/*
+** pallene_tracer_callgraph(true) forgets the edges and starts recording,
+** pallene_tracer_callgraph(false) stops.
+*/
+static int lcallgraph (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TBOOLEAN);
+  if (lua_toboolean(L, 1)) {
+    if (!pallene_tracer_callgraph_start())
+      return luaL_error(L, "no room for the call graph sink");
+  }
+  else
+    pallene_tracer_callgraph_stop();
+  return 0;
+}
+
+
+/*
+** Latency histograms of the Lua interface functions. If PT_LUA_LATENCY
+** names a file, the whole run is recorded and written there when the
+** program ends, for Prometheus.
+*/
+static void startlatency (void) {
+  if (getenv("PT_LUA_LATENCY") != NULL && !pallene_tracer_latency_start())
+    fprintf(stderr, "pt-lua: no room for the latency sink\n");
+}
+
+static void writelatency (lua_State *L) {
+  const char *path = getenv("PT_LUA_LATENCY");
+  FILE *f;
+  if (path == NULL) return;
+  pallene_tracer_latency_stop();
+  if ((f = fopen(path, "w")) == NULL
+      || !pallene_tracer_latency_write(L, f))
+    fprintf(stderr, "pt-lua: cannot write %s\n", path);
+  if (f != NULL) fclose(f);
+}
+
+
+/*
+** pallene_tracer_latency(true) forgets the histograms and starts
+** recording, pallene_tracer_latency(false) stops.
+*/
+static int llatency (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TBOOLEAN);
+  if (lua_toboolean(L, 1)) {
+    if (!pallene_tracer_latency_start())
+      return luaL_error(L, "no room for the latency sink");
+  }
+  else
+    pallene_tracer_latency_stop();
+  return 0;
+}
+
+
+/*
+** pallene_tracer_context([id]): sets what the calls that follow are made
+** for, e.g. a request or a tenant, 0 for nothing. Schedulers set it when
+** they resume the coroutine of another one. Returns what the calls were
+** made for.
+*/
+static int lcontext (lua_State *L) {
+  if (globalstack == NULL)
+    return luaL_error(L, "Pallene Tracer is not in debug mode");
+  if (lua_isnoneornil(L, 1))
+    lua_pushinteger(L, (lua_Integer)globalstack->context);
+  else
+    lua_pushinteger(L, (lua_Integer)pallene_tracer_setcontext(globalstack,
+                                        (int64_t)luaL_checkinteger(L, 1)));
+  return 1;
+}
+
+
+/*
+** pallene_tracer_accounting(true) forgets the times accounted to the
+** contexts and starts accounting, pallene_tracer_accounting(false) stops.
+*/
+static int laccounting (lua_State *L) {
+  luaL_checktype(L, 1, LUA_TBOOLEAN);
+  if (lua_toboolean(L, 1)) {
+    if (!pallene_tracer_accounting_start())
+      return luaL_error(L, "no room for the accounting sink");
+  }
+  else
+    pallene_tracer_accounting_stop();
+  return 0;
+}
+
+/* -------- PALLENE TRACER CODE END -------- */
+
+
 static void print_version (void) {
   lua_writestring(LUA_COPYRIGHT, strlen(LUA_COPYRIGHT));
   lua_writeline();
@@ -981,13 +2029,69 @@ int main (int argc, char **argv) {
   lua_gc(L, LUA_GCSTOP);  /* stop GC while building state */
 
   /* -------- PALLENE TRACER CODE -------- */
-  (void) pallene_tracer_init(L);  /* initialize pallene tracer */
+  PALLENE_TRACER_EXTRASPACE_CLEAR(L);  /* before any thread exists */
+  globalstack = pallene_tracer_init(L);  /* initialize pallene tracer */
   lua_pop(L, 1);  /* We do not need the finalizer object here */
 
+  /* dump the stacks on SIGQUIT/SIGUSR1, without stopping. */
+  globalL = L;
+  setdumpsignals();
+
+  /* report Lua interface calls running longer than PT_LUA_WATCHDOG ms. */
+  setwatchdog(globalstack);
+
+  /* record Lua functions in the Pallene stack too, for one profile. */
+  if (globalstack != NULL && getenv("PT_LUA_HOOKLUA") != NULL)
+    pallene_tracer_hook_lua(L, globalstack, true);
+
   /* supply the message handler function with custom tracebacks. */
   /* it is safe to set globals at this point, because no code has been run yet. */
   lua_pushcfunction(L, msghandler);
   lua_setglobal(L, "pallene_tracer_errhandler");
+
+  /* run a call within a budget of steps and time. */
+  lua_pushcfunction(L, lbudget);
+  lua_setglobal(L, "pallene_tracer_budget");
+
+  /* calls of every function of the modules built with PT_COUNTERS. */
+  lua_pushcfunction(L, pallene_tracer_stats);
+  lua_setglobal(L, "pallene_tracer_stats");
+
+#if defined(PT_PERF)
+  /* performance counters of selected functions. */
+  lua_pushcfunction(L, pallene_tracer_perf);
+  lua_setglobal(L, "pallene_tracer_perf");
+  lua_pushcfunction(L, pallene_tracer_perf_stats);
+  lua_setglobal(L, "pallene_tracer_perf_stats");
+#endif
+
+  /* calls between the functions of the modules. */
+  lua_pushcfunction(L, lcallgraph);
+  lua_setglobal(L, "pallene_tracer_callgraph");
+  lua_pushcfunction(L, pallene_tracer_callgraph_edges);
+  lua_setglobal(L, "pallene_tracer_callgraph_edges");
+  startcallgraph();
+
+  /* latency of the Lua interface functions. */
+  lua_pushcfunction(L, llatency);
+  lua_setglobal(L, "pallene_tracer_latency");
+  lua_pushcfunction(L, pallene_tracer_latency_snapshot);
+  lua_setglobal(L, "pallene_tracer_latency_snapshot");
+  lua_pushcfunction(L, pallene_tracer_latency_merge);
+  lua_setglobal(L, "pallene_tracer_latency_merge");
+  startlatency();
+
+  /* CPU time of the Lua interface functions by context. */
+  lua_pushcfunction(L, lcontext);
+  lua_setglobal(L, "pallene_tracer_context");
+  lua_pushcfunction(L, laccounting);
+  lua_setglobal(L, "pallene_tracer_accounting");
+  lua_pushcfunction(L, pallene_tracer_accounting_stats);
+  lua_setglobal(L, "pallene_tracer_accounting_stats");
+
+  /* trace C functions left as they are. */
+  lua_pushcfunction(L, pallene_tracer_wrap);
+  lua_setglobal(L, "pallene_tracer_wrap");
   /* -------- PALLENE TRACER CODE END -------- */
 
   lua_pushcfunction(L, &pmain);  /* to call 'pmain' in protected mode */
@@ -996,6 +2100,12 @@ int main (int argc, char **argv) {
   status = lua_pcall(L, 2, 1, 0);  /* do the call */
   result = lua_toboolean(L, -1);  /* get result */
   report(L, status);
+  /* -------- PALLENE TRACER CODE -------- */
+  stopwatchdog();  /* the watchdog reads the call-stack, which 'lua_close' frees */
+  writestats(L);
+  writecallgraph();
+  writelatency(L);
+  /* -------- PALLENE TRACER CODE END -------- */
   lua_close(L);
   return (result && status == LUA_OK) ? EXIT_SUCCESS : EXIT_FAILURE;
 }
@@ -0,0 +1,659 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* `pt-spy` samples the call-stacks a process publishes in shared memory (`PT_SHM`).
+   The segments are mapped read-only: the sampled process does not take part at all. */
+
+#define _GNU_SOURCE
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdbool.h>
+#include <stdint.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "ptracer.h"
+
+#define PT_SPY_MAX_SEGMENTS      16
+#define PT_SPY_SHM_DIR           "/dev/shm"
+#define PT_SPY_SHM_PREFIX        "pallene-tracer."
+#define PT_SPY_MAX_REPEAT        100000     /* Copies of a frame in a folded stack. */
+
+static const char *progname = "pt-spy";
+
+static volatile sig_atomic_t stop = 0;
+
+
+/* ---------------- HASH TABLES ---------------- */
+
+/* Open addressing hash table with string keys, counting samples. */
+typedef struct counter {
+    char *key;
+    long self;      /* Samples where the function was on top. */
+    long total;     /* Samples where the function was anywhere. */
+    long stamp;     /* Last sample `total` was bumped for. */
+} counter_t;
+
+typedef struct counters {
+    counter_t *entries;
+    size_t size;    /* Power of two. */
+    size_t used;
+} counters_t;
+
+static uint64_t hashstr(const char *str) {
+    uint64_t h = 1469598103934665603ULL;
+    for(; *str; str++)
+        h = (h ^ (unsigned char) *str) * 1099511628211ULL;
+
+    return h;
+}
+
+static uint64_t hashint(uint64_t key) {
+    key ^= key >> 33;
+    key *= 0xff51afd7ed558ccdULL;
+    key ^= key >> 33;
+
+    return key;
+}
+
+static counter_t *counters_get(counters_t *t, const char *key) {
+    if(t->used * 2 >= t->size) {
+        counters_t bigger = { NULL, t->size ? t->size * 2 : 1024, 0 };
+        bigger.entries = calloc(bigger.size, sizeof(counter_t));
+
+        for(size_t i = 0; i < t->size; i++) {
+            if(t->entries[i].key == NULL)
+                continue;
+
+            size_t j = hashstr(t->entries[i].key) & (bigger.size - 1);
+            while(bigger.entries[j].key != NULL)
+                j = (j + 1) & (bigger.size - 1);
+            bigger.entries[j] = t->entries[i];
+            bigger.used++;
+        }
+
+        free(t->entries);
+        *t = bigger;
+    }
+
+    size_t i = hashstr(key) & (t->size - 1);
+    while(t->entries[i].key != NULL) {
+        if(strcmp(t->entries[i].key, key) == 0)
+            return &t->entries[i];
+        i = (i + 1) & (t->size - 1);
+    }
+
+    t->entries[i].key = strdup(key);
+    t->entries[i].stamp = -1;
+    t->used++;
+
+    return &t->entries[i];
+}
+
+/* Open addressing hash table mapping addresses to labels. */
+typedef struct label {
+    uint64_t addr;
+    const char *label;
+} label_t;
+
+typedef struct labels {
+    label_t *entries;
+    size_t size;    /* Power of two. */
+    size_t used;
+} labels_t;
+
+static const char *labels_find(labels_t *t, uint64_t addr) {
+    if(t->size == 0)
+        return NULL;
+
+    size_t i = hashint(addr) & (t->size - 1);
+    while(t->entries[i].label != NULL) {
+        if(t->entries[i].addr == addr)
+            return t->entries[i].label;
+        i = (i + 1) & (t->size - 1);
+    }
+
+    return NULL;
+}
+
+static void labels_add(labels_t *t, uint64_t addr, const char *label) {
+    if(t->used * 2 >= t->size) {
+        labels_t bigger = { NULL, t->size ? t->size * 2 : 1024, 0 };
+        bigger.entries = calloc(bigger.size, sizeof(label_t));
+
+        for(size_t i = 0; i < t->size; i++)
+            if(t->entries[i].label != NULL)
+                labels_add(&bigger, t->entries[i].addr, t->entries[i].label);
+
+        free(t->entries);
+        *t = bigger;
+    }
+
+    size_t i = hashint(addr) & (t->size - 1);
+    while(t->entries[i].label != NULL) {
+        if(t->entries[i].addr == addr)
+            return;
+        i = (i + 1) & (t->size - 1);
+    }
+
+    t->entries[i].addr = addr;
+    t->entries[i].label = label;
+    t->used++;
+}
+
+/* ---------------- HASH TABLES END ---------------- */
+
+
+/* ---------------- SEGMENTS ---------------- */
+
+typedef struct segment {
+    const pt_shm_header_t *shm;
+    size_t size;
+    uint32_t descriptors;   /* How many descriptors are in `labels`. */
+    labels_t labels;        /* Descriptor address -> "fn_name (filename)". */
+    uint32_t chains;        /* How many chains are in `inlined`. */
+    labels_t inlined;       /* Chain address -> its entry in the table of chains. */
+} segment_t;
+
+/* Maps a segment read-only and checks it is one we understand. */
+static bool segment_open(segment_t *seg, const char *path) {
+    int fd = open(path, O_RDONLY);
+    if(fd < 0) {
+        fprintf(stderr, "%s: cannot open %s: %s\n", progname, path, strerror(errno));
+        return false;
+    }
+
+    struct stat st;
+    void *base = MAP_FAILED;
+    if(fstat(fd, &st) == 0 && (size_t) st.st_size >= sizeof(pt_shm_header_t))
+        base = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(base == MAP_FAILED) {
+        fprintf(stderr, "%s: cannot map %s\n", progname, path);
+        return false;
+    }
+
+    const pt_shm_header_t *shm = (const pt_shm_header_t *) base;
+    if(memcmp(shm->magic, PALLENE_TRACER_SHM_MAGIC, sizeof(PALLENE_TRACER_SHM_MAGIC)) != 0
+        || shm->version != PALLENE_TRACER_SHM_VERSION
+        || shm->frame_size != sizeof(pt_frame_t)
+        || shm->size > (size_t) st.st_size) {
+        fprintf(stderr, "%s: %s: not a Pallene Tracer call-stack of this version\n",
+            progname, path);
+        munmap(base, st.st_size);
+        return false;
+    }
+
+    memset(seg, 0, sizeof(*seg));
+    seg->shm = shm;
+    seg->size = st.st_size;
+
+    return true;
+}
+
+/* Picks up descriptors published since the last time. */
+static void segment_refresh(segment_t *seg) {
+    const pt_shm_header_t *shm = seg->shm;
+    uint32_t count = __atomic_load_n(&shm->descriptor_count, __ATOMIC_ACQUIRE);
+    const pt_shm_descriptor_t *table =
+        (const pt_shm_descriptor_t *) ((const char *) shm + shm->descriptors);
+    const char *strings = (const char *) shm + shm->strings;
+
+    for(; seg->descriptors < count && seg->descriptors < shm->max_descriptors;
+        seg->descriptors++) {
+        const pt_shm_descriptor_t *desc = &table[seg->descriptors];
+        char *label = NULL;
+
+        if(desc->fn_name < shm->strings_size && desc->filename < shm->strings_size
+            && asprintf(&label, "%.200s (%.200s)", strings + desc->fn_name,
+                strings + desc->filename) >= 0)
+            labels_add(&seg->labels, desc->details, label);
+    }
+
+    uint32_t chains = __atomic_load_n(&shm->chain_count, __ATOMIC_ACQUIRE);
+    const pt_shm_chain_t *chain_table =
+        (const pt_shm_chain_t *) ((const char *) shm + shm->chains);
+
+    for(; seg->chains < chains && seg->chains < shm->max_chains; seg->chains++)
+        labels_add(&seg->inlined, chain_table[seg->chains].chain,
+            (const char *) &chain_table[seg->chains]);
+}
+
+/* Finds every segment of a process. */
+static int segments_of(pid_t pid, segment_t *segs) {
+    char prefix[64];
+    snprintf(prefix, sizeof(prefix), PT_SPY_SHM_PREFIX "%d.", (int) pid);
+
+    DIR *dir = opendir(PT_SPY_SHM_DIR);
+    if(dir == NULL)
+        return 0;
+
+    int n = 0;
+    struct dirent *ent;
+    while(n < PT_SPY_MAX_SEGMENTS && (ent = readdir(dir)) != NULL) {
+        if(strncmp(ent->d_name, prefix, strlen(prefix)) != 0)
+            continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), PT_SPY_SHM_DIR "/%s", ent->d_name);
+        n += segment_open(&segs[n], path);
+    }
+
+    closedir(dir);
+    return n;
+}
+
+/* ---------------- SEGMENTS END ---------------- */
+
+
+/* ---------------- NATIVE FRAMES ---------------- */
+
+/* Native frames (`PT_INSTRUMENT`) only hold an address. We name it after the mapped
+   object it belongs to, e.g. "module.so+0x1139", reading `/proc/<pid>/maps`. */
+static labels_t natives = { NULL, 0, 0 };
+
+static const char *native_label(pid_t pid, uint64_t addr) {
+    const char *label = labels_find(&natives, addr);
+    if(label != NULL)
+        return label;
+
+    char path[64], line[1024];
+    snprintf(path, sizeof(path), "/proc/%d/maps", (int) pid);
+
+    FILE *maps = fopen(path, "r");
+    char *found = NULL;
+
+    while(maps != NULL && found == NULL && fgets(line, sizeof(line), maps) != NULL) {
+        unsigned long long start, end, offset;
+        char object[768] = "";
+
+        if(sscanf(line, "%llx-%llx %*s %llx %*s %*s %767[^\n]", &start, &end, &offset,
+            object) < 3 || addr < start || addr >= end)
+            continue;
+
+        const char *name = strrchr(object, '/');
+        name = name != NULL ? name + 1 : (*object ? object : "?");
+        if(asprintf(&found, "%s+0x%llx", name, addr - start + offset) < 0)
+            found = NULL;
+    }
+
+    if(maps != NULL)
+        fclose(maps);
+
+    if(found == NULL && asprintf(&found, "0x%llx", (unsigned long long) addr) < 0)
+        return "<?>";
+
+    labels_add(&natives, addr, found);
+    return found;
+}
+
+/* ---------------- NATIVE FRAMES END ---------------- */
+
+
+/* ---------------- SAMPLING ---------------- */
+
+typedef struct spy {
+    pid_t pid;
+    segment_t segs[PT_SPY_MAX_SEGMENTS];
+    int nsegs;
+
+    long samples;
+    counters_t functions;    /* For the live view. */
+    counters_t stacks;       /* Folded stacks. */
+    bool folded;
+
+    pt_frame_t *frames;      /* Snapshot of a call-stack. */
+    int capacity;
+    const char **names;
+    size_t names_capacity;
+    char context[32];        /* Label of the context of the snapshot. */
+} spy_t;
+
+/* Labels a frame. Returns NULL for frames that are not shown. */
+static const char *frame_label(spy_t *spy, segment_t *seg, const pt_frame_t *frame) {
+    switch(frame->type) {
+        /* Hooked frames are Lua functions, with descriptors of their own. Inlined
+           frames are labeled by their function here, see `inlined_labels`. */
+        case PALLENE_TRACER_FRAME_TYPE_C:
+        case PALLENE_TRACER_FRAME_TYPE_HOOKED:
+        case PALLENE_TRACER_FRAME_TYPE_INLINED: {
+            const char *label = labels_find(&seg->labels,
+                (uint64_t) (uintptr_t) frame->shared.details);
+            return label != NULL ? label : "<?>";
+        }
+
+        case PALLENE_TRACER_FRAME_TYPE_NATIVE:
+            return native_label(spy->pid, (uint64_t) (uintptr_t) frame->shared.native.fn_addr);
+
+        /* Lua interface frames are named by the C interface frame which follows them,
+           as in tracebacks. */
+        default:
+            return NULL;
+    }
+}
+
+/* Labels the calls inlined into the function of an inlined frame, outermost first.
+   Returns how many there are. */
+static int inlined_labels(segment_t *seg, const pt_frame_t *frame, const char **names) {
+    const pt_shm_chain_t *chain = (const pt_shm_chain_t *) labels_find(&seg->inlined,
+        (uint64_t) (uintptr_t) frame->shared.c.chain);
+    if(chain == NULL)
+        return 0;
+
+    int length = chain->length < PALLENE_TRACER_MAX_INLINED ? (int) chain->length
+        : PALLENE_TRACER_MAX_INLINED;
+    for(int i = 0; i < length; i++) {
+        const char *label = labels_find(&seg->labels, chain->details[i]);
+        names[i] = label != NULL ? label : "<?>";
+    }
+
+    return length;
+}
+
+/* Frames `frame` stands for: run-length encoded repetitions (`PT_RLE`) are spelled out
+   in folded stacks, where the depth shows. */
+static int frame_copies(spy_t *spy, const pt_frame_t *frame) {
+    int repeat = spy->folded ? pallene_tracer_repeat(frame) : 0;
+    if(repeat < 0)
+        repeat = 0;
+    if(repeat > PT_SPY_MAX_REPEAT)
+        repeat = PT_SPY_MAX_REPEAT;
+
+    return repeat + 1;
+}
+
+/* Takes one sample of one call-stack. */
+static void sample(spy_t *spy, segment_t *seg) {
+    const pt_shm_header_t *shm = seg->shm;
+    size_t frames = shm->frames;
+    int capacity = shm->fnstack.capacity;
+    int count = __atomic_load_n(&shm->fnstack.count, __ATOMIC_RELAXED);
+
+    /* The header is written by the process: whatever it says, read within the segment. */
+    if(frames > seg->size)
+        return;
+    if(capacity < 0 || (size_t) capacity > (seg->size - frames) / sizeof(pt_frame_t))
+        capacity = (int) ((seg->size - frames) / sizeof(pt_frame_t));
+    if(count > capacity)
+        count = capacity;
+    if(count <= 0)
+        return;
+
+    if(capacity > spy->capacity) {
+        pt_frame_t *bigger = realloc(spy->frames, capacity * sizeof(pt_frame_t));
+        if(bigger == NULL)
+            return;
+        spy->frames = bigger;
+        spy->capacity = capacity;
+    }
+
+    /* The process keeps running. The snapshot may be torn, which only costs accuracy. */
+    int64_t context = __atomic_load_n(&shm->fnstack.context, __ATOMIC_RELAXED);
+    memcpy(spy->frames, (const char *) shm + frames, count * sizeof(pt_frame_t));
+    segment_refresh(seg);
+
+    /* Inlined frames stand for several functions, and the context comes first. */
+    size_t needed = 1;
+    for(int i = 0; i < count; i++)
+        needed += (size_t) frame_copies(spy, &spy->frames[i])
+            * (spy->frames[i].type == PALLENE_TRACER_FRAME_TYPE_INLINED
+                ? PALLENE_TRACER_MAX_INLINED + 1 : 1);
+
+    if(needed > spy->names_capacity) {
+        const char **bigger = realloc(spy->names, needed * sizeof(char *));
+        if(bigger == NULL)
+            return;
+        spy->names = bigger;
+        spy->names_capacity = needed;
+    }
+
+    /* Samples of a context go under a root of their own, e.g. to bill tenants. */
+    int n = 0, root = 0;
+    if(context != 0) {
+        snprintf(spy->context, sizeof(spy->context), "context %lld", (long long) context);
+        spy->names[n++] = spy->context;
+        root = 1;
+    }
+
+    for(int i = 0; i < count; i++) {
+        const char *label = frame_label(spy, seg, &spy->frames[i]);
+        for(int copies = frame_copies(spy, &spy->frames[i]); copies > 0; copies--) {
+            if(label != NULL)
+                spy->names[n++] = label;
+            if(spy->frames[i].type == PALLENE_TRACER_FRAME_TYPE_INLINED)
+                n += inlined_labels(seg, &spy->frames[i], &spy->names[n]);
+        }
+    }
+
+    if(n == root)
+        return;
+
+    if(spy->folded) {
+        size_t len = 0;
+        for(int i = 0; i < n; i++)
+            len += strlen(spy->names[i]) + 1;
+
+        char *stack = malloc(len);
+        if(stack == NULL)
+            return;
+
+        char *p = stack;
+        for(int i = 0; i < n; i++) {
+            size_t l = strlen(spy->names[i]);
+            memcpy(p, spy->names[i], l);
+            p[l] = i + 1 < n ? ';' : '\0';
+            p += l + 1;
+        }
+
+        counters_get(&spy->stacks, stack)->total++;
+        free(stack);
+        return;
+    }
+
+    counters_get(&spy->functions, spy->names[n - 1])->self++;
+    for(int i = 0; i < n; i++) {
+        counter_t *c = counters_get(&spy->functions, spy->names[i]);
+
+        /* Recursive functions count once per sample. */
+        if(c->stamp != spy->samples) {
+            c->stamp = spy->samples;
+            c->total++;
+        }
+    }
+}
+
+static int by_self(const void *a, const void *b) {
+    const counter_t *x = *(const counter_t *const *) a, *y = *(const counter_t *const *) b;
+    return (y->self > x->self) - (y->self < x->self);
+}
+
+/* Prints the live view, hottest functions first. */
+static void show(spy_t *spy, int top, double rate) {
+    counter_t **sorted = malloc((spy->functions.used + 1) * sizeof(counter_t *));
+    size_t n = 0;
+    for(size_t i = 0; i < spy->functions.size; i++)
+        if(spy->functions.entries[i].key != NULL)
+            sorted[n++] = &spy->functions.entries[i];
+    qsort(sorted, n, sizeof(counter_t *), by_self);
+
+    printf("\033[H\033[2J");
+    printf("pt-spy: pid %d, %ld samples at %.0f/s\n\n", (int) spy->pid, spy->samples, rate);
+    printf("%7s %7s  %s\n", "SELF%", "TOTAL%", "FUNCTION");
+
+    long samples = spy->samples > 0 ? spy->samples : 1;
+    for(size_t i = 0; i < n && i < (size_t) top; i++)
+        printf("%6.2f%% %6.2f%%  %s\n", 100.0 * sorted[i]->self / samples,
+            100.0 * sorted[i]->total / samples, sorted[i]->key);
+
+    fflush(stdout);
+    free(sorted);
+}
+
+/* Writes the folded stacks, one per line: "a;b;c <samples>". */
+static void fold(spy_t *spy) {
+    for(size_t i = 0; i < spy->stacks.size; i++)
+        if(spy->stacks.entries[i].key != NULL)
+            printf("%s %ld\n", spy->stacks.entries[i].key, spy->stacks.entries[i].total);
+}
+
+/* ---------------- SAMPLING END ---------------- */
+
+
+static void usage(void) {
+    fprintf(stderr,
+        "usage: %s [options] pid | segment\n"
+        "       %s -c\n"
+        "Available options are:\n"
+        "  -r rate     take 'rate' samples per second (default 100)\n"
+        "  -d seconds  stop after 'seconds' (default: when the process exits or on ^C)\n"
+        "  -n count    show the 'count' hottest functions (default 20)\n"
+        "  -f          print folded stacks when done, instead of the live view\n"
+        "  -c          only remove the segments of processes which are gone\n",
+        progname, progname);
+}
+
+static void on_interrupt(int sig) {
+    (void) sig;
+    stop = 1;
+}
+
+/* Is the process still there? */
+static bool alive(pid_t pid) {
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d", (int) pid);
+
+    return access(path, F_OK) == 0;
+}
+
+/* Removes the segments of processes which are gone: they crashed, were killed, or left
+   without closing their Lua states before `exit` could remove them. Segments of other
+   users stay where they are. */
+static int reap(bool verbose) {
+    DIR *dir = opendir(PT_SPY_SHM_DIR);
+    if(dir == NULL)
+        return 0;
+
+    int n = 0;
+    struct dirent *ent;
+    while((ent = readdir(dir)) != NULL) {
+        int pid;
+        if(sscanf(ent->d_name, PT_SPY_SHM_PREFIX "%d.", &pid) != 1 || pid <= 0 || alive(pid))
+            continue;
+
+        char path[512];
+        snprintf(path, sizeof(path), PT_SPY_SHM_DIR "/%s", ent->d_name);
+        if(unlink(path) == 0) {
+            n++;
+            if(verbose)
+                fprintf(stderr, "%s: removed %s, process %d is gone\n", progname, path, pid);
+        }
+    }
+
+    closedir(dir);
+    return n;
+}
+
+static double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+int main(int argc, char **argv) {
+    spy_t spy;
+    memset(&spy, 0, sizeof(spy));
+
+    double rate = 100, duration = 0;
+    int top = 20, opt;
+    bool clean = false;
+
+    while((opt = getopt(argc, argv, "r:d:n:fc")) != -1) {
+        switch(opt) {
+            case 'r': rate = atof(optarg); break;
+            case 'd': duration = atof(optarg); break;
+            case 'n': top = atoi(optarg); break;
+            case 'f': spy.folded = true; break;
+            case 'c': clean = true; break;
+            default: usage(); return EXIT_FAILURE;
+        }
+    }
+
+    if(clean) {
+        if(optind != argc) {
+            usage();
+            return EXIT_FAILURE;
+        }
+        reap(true);
+        return EXIT_SUCCESS;
+    }
+
+    if(optind + 1 != argc || rate <= 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    reap(false);
+
+    /* A pid, or the path of a segment. */
+    char *end;
+    long pid = strtol(argv[optind], &end, 10);
+    if(*end == '\0' && pid > 0) {
+        spy.pid = (pid_t) pid;
+        spy.nsegs = segments_of(spy.pid, spy.segs);
+    } else if(segment_open(&spy.segs[0], argv[optind])) {
+        spy.nsegs = 1;
+        spy.pid = spy.segs[0].shm->pid;
+    }
+
+    if(spy.nsegs == 0) {
+        fprintf(stderr, "%s: no Pallene Tracer call-stack found for '%s'\n"
+            "(is the process built with PT_SHM?)\n", progname, argv[optind]);
+        return EXIT_FAILURE;
+    }
+
+    signal(SIGINT, on_interrupt);
+    signal(SIGTERM, on_interrupt);
+
+    struct timespec interval;
+    interval.tv_sec = (time_t) (1 / rate);
+    interval.tv_nsec = (long) ((1 / rate - interval.tv_sec) * 1e9);
+
+    double start = now(), shown = start;
+    while(!stop && alive(spy.pid)) {
+        for(int i = 0; i < spy.nsegs; i++)
+            sample(&spy, &spy.segs[i]);
+        spy.samples++;
+
+        double t = now();
+        if(duration > 0 && t - start >= duration)
+            break;
+
+        if(!spy.folded && t - shown >= 1) {
+            show(&spy, top, rate);
+            shown = t;
+        }
+
+        nanosleep(&interval, NULL);
+    }
+
+    if(spy.folded)
+        fold(&spy);
+    else
+        show(&spy, top, rate);
+
+    return EXIT_SUCCESS;
+}
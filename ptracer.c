@@ -0,0 +1,27 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* `libptracer`: the implementation of `ptracer.h`, once for the whole process. Modules
+   linking to it leave `PT_IMPLEMENTATION` out, and share its sinks and its pool of
+   call-stack buffers. `pallene_tracer_stats` is here for hosts to
+   expose as well, the call graph, the latency histograms, the accounting of
+   contexts, and on Linux `pallene_tracer_perf`. */
+
+#define _GNU_SOURCE
+
+#define PT_LIB
+#define PT_IMPLEMENTATION
+#define PT_SINKS
+#define PT_COUNTERS
+#define PT_POOL
+#ifdef __linux__
+#define PT_PERF
+#endif
+#define PT_CALLGRAPH
+#define PT_LATENCY
+#define PT_ACCOUNTING
+#include "ptracer.h"
@@ -14,6 +14,7 @@
 #include <stdlib.h>
 #include <stdbool.h>
 #include <string.h>
+#include <stdint.h>
 
 #if LUA_VERSION_RELEASE_NUM < 50400
 #error "Pallene Tracer needs atleast Lua 5.4 to work properly"
@@ -31,6 +32,21 @@
 #define PT_API    extern
 #endif // PT_BUILD_AS_DLL
 
+/* `restrict` is not a C++ keyword. */
+#ifdef __cplusplus
+#define PT_RESTRICT    __restrict
+#else
+#define PT_RESTRICT    restrict
+#endif // __cplusplus
+
+/* Pallene Tracer functions must never be instrumented by `-finstrument-functions`,
+   they are what the instrumentation hooks call. */
+#if defined(__GNUC__) || defined(__clang__)
+#define PT_NOINSTRUMENT    __attribute__((no_instrument_function))
+#else
+#define PT_NOINSTRUMENT
+#endif
+
 /* Pallene stack reference entry for the registry. */
 /* DO NOT CHANGE EVEN BY MISTAKE. */
 #define PALLENE_TRACER_CONTAINER_ENTRY  "__PALLENE_TRACER_CONTAINER"
@@ -39,40 +55,334 @@
 /* DO NOT CHANGE EVEN BY MISTAKE. */
 #define PALLENE_TRACER_FINALIZER_ENTRY  "__PALLENE_TRACER_FINALIZER"
 
-/* The size of the Pallene call-stack. */
+/* Finalizer metatable key for Lua interface frames entered after the call-stack is full. */
+/* DO NOT CHANGE EVEN BY MISTAKE. */
+#define PALLENE_TRACER_OVERFLOW_ENTRY   "__PALLENE_TRACER_OVERFLOW"
+
+/* Descriptors of the Lua functions recorded by `pallene_tracer_hook_lua`. */
+/* DO NOT CHANGE EVEN BY MISTAKE. */
+#define PALLENE_TRACER_HOOKED_ENTRY     "__PALLENE_TRACER_HOOKED"
+
+/* Call counters of the modules loaded in the Lua state (`PT_COUNTERS`). */
+/* DO NOT CHANGE EVEN BY MISTAKE. */
+#define PALLENE_TRACER_COUNTERS_ENTRY   "__PALLENE_TRACER_COUNTERS"
+
+/* The trampolines made in the Lua state, see `pallene_tracer_wrap`. */
 /* DO NOT CHANGE EVEN BY MISTAKE. */
+#define PALLENE_TRACER_TRAMPOLINES_ENTRY "__PALLENE_TRACER_TRAMPOLINES"
+
+/* The default size of the Pallene call-stack, see `pallene_tracer_init_ex` for others.
+   The call-stack remembers its own capacity, so modules compiled with different sizes
+   can share it. The module creating the call-stack decides. */
+#ifndef PALLENE_TRACER_MAX_CALLSTACK
 #define PALLENE_TRACER_MAX_CALLSTACK         100000
+#endif // PALLENE_TRACER_MAX_CALLSTACK
+
+/* What happens when the call-stack is full. By default, frames past the capacity are
+   counted but not recorded. Define `PT_OVERFLOW_ERROR` to raise a Lua error instead. */
+#ifdef PT_OVERFLOW_ERROR
+#define PALLENE_TRACER_OVERFLOW_POLICY       PALLENE_TRACER_OVERFLOW_ERROR
+#else
+#define PALLENE_TRACER_OVERFLOW_POLICY       PALLENE_TRACER_OVERFLOW_TRUNCATE
+#endif // PT_OVERFLOW_ERROR
+
+/* Define `PT_RLE` to store frames run-length encoded: entering the same C interface
+   function as the topmost frame bumps its repeat count instead of pushing a new entry.
+   Deep self-recursion then takes a single entry. Modules compiled with and without it
+   can share the call-stack. */
+
+/* Define `PT_BUDGET` to check the budget set by `pallene_tracer_budget` in
+   `pallene_tracer_setline`, so that long C loops can be cancelled as well. Steps are
+   charged `PALLENE_TRACER_BUDGET_INTERVAL` at a time, by the count hook and by every
+   that many traced lines. */
+#ifndef PALLENE_TRACER_BUDGET_INTERVAL
+#define PALLENE_TRACER_BUDGET_INTERVAL       1000
+#endif // PALLENE_TRACER_BUDGET_INTERVAL
+
+/* Define `PT_EXTRASPACE` to store the call-stack in the extra space of every thread
+   (`lua_getextraspace`) when `pallene_tracer_init` is called. Then functions find it
+   with `PALLENE_TRACER_EXTRASPACE_FNSTACK(L)`, a load and a test, and Lua interface frames
+   find the finalizer object with `PALLENE_TRACER_REGISTRY_FINALIZER` as `location`. No
+   upvalues are needed. The host must not use the extra space for anything else, and
+   clears it with `PALLENE_TRACER_EXTRASPACE_CLEAR` before any thread is created:
+   threads created before `pallene_tracer_init` then find NULL, and the call-stack in
+   the registry instead. */
+#define PALLENE_TRACER_EXTRASPACE_FNSTACK(L)   _pallene_tracer_extraspace_get(L)
+#define PALLENE_TRACER_EXTRASPACE_CLEAR(L)     ((void) (*_PALLENE_TRACER_EXTRASPACE_SLOT(L) = NULL))
+
+/* Not part of the API. */
+#define _PALLENE_TRACER_EXTRASPACE_SLOT(L)     ((pt_fnstack_t **) lua_getextraspace(L))
+
+/* The `location` of the finalizer object when it is not passed to the function. It is
+   looked up in the registry, at an integer key the call-stack remembers. */
+#define PALLENE_TRACER_REGISTRY_FINALIZER    0
+
+/* Define `PT_INSTRUMENT` in the translation unit with `PT_IMPLEMENTATION` to define the
+   `__cyg_profile_func_enter/exit` hooks of `-finstrument-functions`. They push native
+   frames to the first call-stack created by that translation unit on the running thread,
+   until it is closed. `pt-lua` does so. */
+#define PALLENE_TRACER_INSTRUMENTED_STACKS   64
+
+/* Define `PT_SHM` to publish the call-stack in shared memory, under
+   `/dev/shm/pallene-tracer.<pid>.<n>`, for `pt-spy` to sample. The translation unit
+   creating the call-stack decides whether it is published. Every module compiled with it
+   publishes the names of its functions there. Needs POSIX (e.g. `-D_GNU_SOURCE`).
+   Segments are removed when their Lua state is closed, or else when the process exits;
+   `pt-spy` removes those of processes which are gone. */
+#define PALLENE_TRACER_SHM_MAGIC             "PTSTACK"
+#define PALLENE_TRACER_SHM_VERSION           7
+#define PALLENE_TRACER_SHM_DESCRIPTORS       8192
+#define PALLENE_TRACER_SHM_CHAINS            1024
+#define PALLENE_TRACER_SHM_STRINGS           (512 * 1024)
+#define PALLENE_TRACER_SHM_SEGMENTS          256    /* Removed at exit, per process. */
+
+/* Define `PT_POOL` in the translation unit with `PT_IMPLEMENTATION` to recycle the
+   buffers of call-stacks created with `PALLENE_TRACER_STORAGE_POOL`, for hosts which
+   create and close Lua states all the time. Closed states return their buffers to a
+   cache of the thread, which passes them on to a process-wide list when it is full or
+   the thread exits. Buffers the list has no room for are freed. Needs POSIX threads. */
+#ifndef PALLENE_TRACER_POOL_CACHE
+#define PALLENE_TRACER_POOL_CACHE            4
+#endif // PALLENE_TRACER_POOL_CACHE
+
+#ifndef PALLENE_TRACER_POOL_LIST
+#define PALLENE_TRACER_POOL_LIST             16
+#endif // PALLENE_TRACER_POOL_LIST
+
+/* Define `PT_SINKS` to report frames entered, exited and unwound, and tracebacks, to
+   the sinks registered with `pallene_tracer_sink_add`: profilers, loggers, exporters.
+   Sinks are process-wide, so the implementation should be built once, in the host or
+   in `libptracer` (`ptracer.c`), and modules link to it instead of defining
+   `PT_IMPLEMENTATION`. While no sink is registered, frames cost one check. */
+#ifndef PALLENE_TRACER_MAX_SINKS
+#define PALLENE_TRACER_MAX_SINKS             8
+#endif // PALLENE_TRACER_MAX_SINKS
+
+/* The profilers below are sinks: each implies `PT_SINKS`. Their `_start` and `_stop`
+   functions add and remove their sinks, so call them while no traced code runs, like
+   `pallene_tracer_sink_add`. */
+
+/* Define `PT_PERF` in the translation unit with `PT_IMPLEMENTATION` to measure selected
+   C interface functions with the performance counters of Linux (`perf_event_open`):
+   cycles, instructions, cache and branch misses, or software counters where the
+   hardware ones are not available, e.g. in containers. A sink reads the counters of
+   the thread when the frames are entered and exited, with `rdpmc` where the kernel
+   allows it. */
+#ifndef PALLENE_TRACER_PERF_MAX_FNS
+#define PALLENE_TRACER_PERF_MAX_FNS          16
+#endif // PALLENE_TRACER_PERF_MAX_FNS
+
+/* How many measured frames a thread can be in at once. Deeper ones are not measured. */
+#ifndef PALLENE_TRACER_PERF_DEPTH
+#define PALLENE_TRACER_PERF_DEPTH            64
+#endif // PALLENE_TRACER_PERF_DEPTH
+
+/* Define `PT_CALLGRAPH` in the translation unit with `PT_IMPLEMENTATION` to record the
+   calls between functions while `pallene_tracer_callgraph_start` is in effect: how many
+   times each caller called each callee, and how long these calls took. Edges go to a
+   table of fixed capacity, the calls of edges past it are dropped. A C function called
+   by a Lua interface function is called by Lua, or by the Lua function of the hooked
+   frame below it (`pallene_tracer_hook_lua`). */
+#ifndef PALLENE_TRACER_CALLGRAPH_EDGES
+#define PALLENE_TRACER_CALLGRAPH_EDGES       4096
+#endif // PALLENE_TRACER_CALLGRAPH_EDGES
+
+/* How many calls a thread times at once. Deeper ones are counted only. */
+#ifndef PALLENE_TRACER_CALLGRAPH_DEPTH
+#define PALLENE_TRACER_CALLGRAPH_DEPTH       256
+#endif // PALLENE_TRACER_CALLGRAPH_DEPTH
+
+/* Define `PT_LATENCY` in the translation unit with `PT_IMPLEMENTATION` to record the
+   latency of Lua interface functions, from the moment their frames are entered until
+   their finalizers run, in log-bucketed histograms: 8 buckets per power of two of
+   nanoseconds, up to 2^40, so values are within 12.5%. Histograms go to a table of
+   fixed capacity, shared by all threads, and recording allocates nothing. Functions
+   past the capacity are dropped. */
+#ifndef PALLENE_TRACER_LATENCY_FNS
+#define PALLENE_TRACER_LATENCY_FNS           128
+#endif // PALLENE_TRACER_LATENCY_FNS
+
+/* How many calls a thread times at once. Deeper ones are not recorded. */
+#ifndef PALLENE_TRACER_LATENCY_DEPTH
+#define PALLENE_TRACER_LATENCY_DEPTH         64
+#endif // PALLENE_TRACER_LATENCY_DEPTH
+
+/* Define `PT_ACCOUNTING` in the translation unit with `PT_IMPLEMENTATION` to account the
+   CPU time of the threads in Lua interface calls to the contexts of their call-stacks
+   (`pallene_tracer_setcontext`), e.g. for billing tenants. Each call gets the time it
+   spends itself, and Lua interface calls nested in it get theirs. Contexts go to a
+   table of fixed capacity, the calls of contexts past it are dropped. */
+#ifndef PALLENE_TRACER_ACCOUNTING_CONTEXTS
+#define PALLENE_TRACER_ACCOUNTING_CONTEXTS   256
+#endif // PALLENE_TRACER_ACCOUNTING_CONTEXTS
+
+/* How many nested Lua interface calls a thread accounts for at once. */
+#ifndef PALLENE_TRACER_ACCOUNTING_DEPTH
+#define PALLENE_TRACER_ACCOUNTING_DEPTH      64
+#endif // PALLENE_TRACER_ACCOUNTING_DEPTH
+
+#if (defined(PT_PERF) || defined(PT_CALLGRAPH) || defined(PT_LATENCY) || defined(PT_ACCOUNTING)) \
+    && !defined(PT_SINKS)
+#define PT_SINKS
+#endif // PT_PERF || PT_CALLGRAPH || PT_LATENCY || PT_ACCOUNTING
+
+/* Define `PT_STATIC_DETAILS` to make the descriptors declared by
+   `PALLENE_TRACER_C_FRAMEENTER` static, so their names can be read after the frame is
+   gone, e.g. by a watchdog. Run-length encoding compares frames by their descriptor,
+   counters and shared memory find it by its address, and static probes and sinks read it
+   when frames are unwound: with any of them, descriptors are static. */
+#if (defined(PT_RLE) || defined(PT_COUNTERS) || defined(PT_SHM) || defined(PT_USDT) \
+     || defined(PT_SINKS)) && !defined(PT_STATIC_DETAILS)
+#define PT_STATIC_DETAILS
+#endif // PT_RLE || PT_COUNTERS || PT_SHM || PT_USDT || PT_SINKS
+
+/* The most calls a chain of inlined calls (`pt_inlined_t`) can stand for. */
+/* DO NOT CHANGE EVEN BY MISTAKE. */
+#define PALLENE_TRACER_MAX_INLINED           8
+
+#ifdef PT_SHM
+#define PALLENE_TRACER_STORAGE_DEFAULT       PALLENE_TRACER_STORAGE_SHM
+#else
+#define PALLENE_TRACER_STORAGE_DEFAULT       PALLENE_TRACER_STORAGE_HEAP
+#endif // PT_SHM
+
+/* Under `PT_SHM`, descriptors are gathered in a section, so modules can find and publish
+   all of theirs when they are loaded. Nothing is done when frames are entered. They are
+   aligned to their size, so the section is an array. */
+#ifdef PT_SHM
+#define PT_DETAILS_SECTION    __attribute__((section("pt_details"), used, aligned(2 * sizeof(void *))))
+#else
+#define PT_DETAILS_SECTION
+#endif // PT_SHM
+
+/* Chains of inlined calls go to a section of their own, published with the descriptors.
+   They must be `const`. */
+#ifdef PT_SHM
+#define PT_INLINED_SECTION    __attribute__((section("pt_inlined"), used, aligned(sizeof(void *))))
+#else
+#define PT_INLINED_SECTION
+#endif // PT_SHM
+
+/* Define `PT_COUNTERS` to count the calls of every C interface function, in a counter
+   next to its descriptor. Entering a frame bumps it, without atomics: threads running
+   the same function at once may lose counts. The counters are gathered in a section,
+   which modules register in the Lua state when they call `pallene_tracer_init`, for
+   `pallene_tracer_stats` to read. */
+#ifdef PT_COUNTERS
+#define PT_COUNTER_SECTION    __attribute__((section("pt_counters"), used, aligned(2 * sizeof(void *))))
+#define _PALLENE_TRACER_COUNT(var_name, details)                                        \
+static PT_COUNTER_SECTION pt_counter_t var_name = { &(details), 0 };                   \
+var_name.calls++
+#else
+#define _PALLENE_TRACER_COUNT(var_name, details)
+#endif // PT_COUNTERS
+
+/* Define `PT_USDT` for static probes (`sys/sdt.h`, provider `pallene_tracer`) when
+   frames are entered, exited and unwound by the finalizer. Their arguments are the
+   function name, the filename, the line and the depth. They are a `nop` unless a tracer
+   (bpftrace, perf, SystemTap) is attached. */
+#ifdef PT_USDT
+#include <sys/sdt.h>
+#define PALLENE_TRACER_PROBE(name, fn_name, filename, line, depth)                    \
+    DTRACE_PROBE4(pallene_tracer, name, fn_name, filename, line, depth)
+#else
+#define PALLENE_TRACER_PROBE(name, fn_name, filename, line, depth)
+#endif // PT_USDT
+
+/* Define `PT_UNWIND` to keep only the Lua interface frames. C interface frames then
+   cost nothing; `pt-lua` finds them by unwinding the C stack when it prints a traceback. */
+
+/* Tracing levels, each one adding to the one before. Define `PT_LEVEL` to one of them
+   to compile the higher ones out of a module. The macros below follow it. */
+#define PALLENE_TRACER_LEVEL_LUA             1    /* Lua interface frames. */
+#define PALLENE_TRACER_LEVEL_C               2    /* C interface frames. */
+#define PALLENE_TRACER_LEVEL_LINE            3    /* Their current lines. */
+
+#ifndef PT_LEVEL
+#define PT_LEVEL                             PALLENE_TRACER_LEVEL_LINE
+#endif // PT_LEVEL
 
 /* API wrapper macros. Using these wrappers instead is raw functions
  * are highly recommended. */
-#ifdef PT_DEBUG
+/* Without C interface frames, only Lua interface frames are entered, which the finalizer
+   pops: `PALLENE_TRACER_FRAMEEXIT` has nothing to pop. */
+#if defined(PT_DEBUG) && (defined(PT_UNWIND) || PT_LEVEL < PALLENE_TRACER_LEVEL_C)
+#define PALLENE_TRACER_FRAMEENTER(fnstack, frame)                                     \
+do {                                                                                  \
+    if((frame)->type == PALLENE_TRACER_FRAME_TYPE_LUA)                                \
+        pallene_tracer_frameenter(fnstack, frame);                                    \
+} while(0)
+#define PALLENE_TRACER_FRAMEEXIT(fnstack)
+
+#elif defined(PT_DEBUG)
 #define PALLENE_TRACER_FRAMEENTER(fnstack, frame)       pallene_tracer_frameenter(fnstack, frame)
-#define PALLENE_TRACER_SETLINE(fnstack, line)           pallene_tracer_setline(fnstack, line)
 #define PALLENE_TRACER_FRAMEEXIT(fnstack)               pallene_tracer_frameexit(fnstack)
 
 #else
 #define PALLENE_TRACER_FRAMEENTER(fnstack, frame)
-#define PALLENE_TRACER_SETLINE(fnstack, line)
 #define PALLENE_TRACER_FRAMEEXIT(fnstack)
 #endif // PT_DEBUG
 
+/* Lines and inlined calls go to the topmost frame, which is a Lua interface frame if
+   C interface frames are compiled out. */
+#if defined(PT_DEBUG) && (defined(PT_UNWIND) || PT_LEVEL < PALLENE_TRACER_LEVEL_C)
+#define PALLENE_TRACER_SETLINE(fnstack, line)
+#define PALLENE_TRACER_SETINLINED(fnstack, chain)
+
+#elif defined(PT_DEBUG) && PT_LEVEL < PALLENE_TRACER_LEVEL_LINE
+#define PALLENE_TRACER_SETLINE(fnstack, line)
+#define PALLENE_TRACER_SETINLINED(fnstack, chain)       pallene_tracer_setinlined(fnstack, chain)
+
+#elif defined(PT_DEBUG)
+#define PALLENE_TRACER_SETLINE(fnstack, line)           pallene_tracer_setline(fnstack, line)
+#define PALLENE_TRACER_SETINLINED(fnstack, chain)       pallene_tracer_setinlined(fnstack, chain)
+
+#else
+#define PALLENE_TRACER_SETLINE(fnstack, line)
+#define PALLENE_TRACER_SETINLINED(fnstack, chain)
+#endif // PT_DEBUG
+
 /* Not part of the API. */
 #ifdef PT_DEBUG
+/* A static descriptor needs constant names. */
+#ifdef PT_STATIC_DETAILS
+#define _PALLENE_TRACER_PREPARE_C_FRAME(fn_name, filename, var_name)                  \
+static PT_DETAILS_SECTION pt_fn_details_t var_name##_details =                        \
+    PALLENE_TRACER_FN_DETAILS(fn_name, filename);                                     \
+_PALLENE_TRACER_COUNT(var_name##_counter, var_name##_details);                        \
+pt_frame_t var_name = PALLENE_TRACER_C_FRAME(var_name##_details)
+#else
 #define _PALLENE_TRACER_PREPARE_C_FRAME(fn_name, filename, var_name)                  \
 pt_fn_details_t var_name##_details =                                                  \
     PALLENE_TRACER_FN_DETAILS(fn_name, filename);                                     \
 pt_frame_t var_name = PALLENE_TRACER_C_FRAME(var_name##_details)
+#endif // PT_STATIC_DETAILS
 
 #define _PALLENE_TRACER_PREPARE_LUA_FRAME(fnptr, var_name)                            \
 pt_frame_t var_name = PALLENE_TRACER_LUA_FRAME(fnptr)
 
-#define _PALLENE_TRACER_FINALIZER(L, location)       lua_pushvalue(L, (location));    \
+/* `PALLENE_TRACER_REGISTRY_FINALIZER` is a constant, the test is folded away. */
+#define _PALLENE_TRACER_FINALIZER(L, fnstack, location)                               \
+    if((location) == PALLENE_TRACER_REGISTRY_FINALIZER)                               \
+        lua_rawgeti(L, LUA_REGISTRYINDEX, (fnstack)->finalizer);                      \
+    else lua_pushvalue(L, (location));                                                \
     lua_toclose(L, -1)
 
+/* Lua interface frames always get recorded, so the finalizer can find them. If there
+   is no room left, we either raise an error or count the frame with a separate
+   finalizer which remembers the depth. They remember the thread running them. */
+#define _PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, frame, location)                   \
+if(luai_likely((fnstack)->count < (fnstack)->capacity)) {                             \
+    PALLENE_TRACER_FRAMEENTER(fnstack, frame);                                        \
+    (fnstack)->stack[(fnstack)->top_lua].shared.lua.L = (L);                          \
+    _PALLENE_TRACER_FINALIZER(L, fnstack, location);                                  \
+} else pallene_tracer_overflow(L, fnstack)
+
 #else
 #define _PALLENE_TRACER_PREPARE_LUA_FRAME(fnptr, var_name)
 #define _PALLENE_TRACER_PREPARE_C_FRAME(fn_name, filename, var_name)
-#define _PALLENE_TRACER_FINALIZER(L, location)
+#define _PALLENE_TRACER_FINALIZER(L, fnstack, location)
+#define _PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, frame, location)
 #endif // PT_DEBUG
 
 /* ---- DATA-STRUCTURE HELPER MACROS ---- */
@@ -84,19 +394,28 @@ pt_frame_t var_name = PALLENE_TRACER_LUA_FRAME(fnptr)
 #define PALLENE_TRACER_FN_DETAILS(name, fname)    \
 { .fn_name = name, .filename = fname }
 
+/* Use this macro to fill in the options of `pallene_tracer_init_ex` with defaults. */
+/* E.U.: `pt_options_t options = PALLENE_TRACER_DEFAULT_OPTIONS;` */
+/* Not designated, C++ has them only since C++20. */
+#define PALLENE_TRACER_DEFAULT_OPTIONS            \
+{ PALLENE_TRACER_MAX_CALLSTACK,                   \
+  PALLENE_TRACER_OVERFLOW_POLICY,                 \
+  PALLENE_TRACER_STORAGE_DEFAULT,                 \
+  NULL, NULL }
+
 /* Use this macro to fill in the frame structure as a
    Lua interface frame. */
 /* E.U.: `pt_frame_t frame = PALLENE_TRACER_LUA_FRAME(lua_fn);` */
-#define PALLENE_TRACER_LUA_FRAME(fnptr)           \
+#define PALLENE_TRACER_LUA_FRAME(fn)              \
 { .type = PALLENE_TRACER_FRAME_TYPE_LUA,          \
-  .shared = { .c_fnptr = fnptr } }
+  .shared = { .lua = { .fnptr = fn } } }
 
 /* Use this macro to fill in the frame structure as a
    C interface frame. */
 /* E.U.: `pt_frame_t frame = PALLENE_TRACER_C_FRAME(_details);` */
 #define PALLENE_TRACER_C_FRAME(detl)              \
 { .type = PALLENE_TRACER_FRAME_TYPE_C,            \
-  .shared = { .details = &detl } }
+  .shared = { .c = { .details = &detl } } }
 
 /* ---- DATA-STRUCTURE HELPER MACROS END ---- */
 
@@ -111,14 +430,22 @@ pt_frame_t var_name = PALLENE_TRACER_LUA_FRAME(fnptr)
 /* The `var_name` indicates the name of the `pt_frame_t` structure variable. */
 #define PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr, location, var_name)    \
 _PALLENE_TRACER_PREPARE_LUA_FRAME(fnptr, var_name);                             \
-PALLENE_TRACER_FRAMEENTER(fnstack, &var_name);                                  \
-_PALLENE_TRACER_FINALIZER(L, location)
+_PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, &var_name, location)
 
 /* Use this macro the bypass some frameenter boilerplates for C interface frames. */
 /* The `var_name` indicates the name of the `pt_frame_t` structure variable. */
+/* Pop the frame with `PALLENE_TRACER_C_FRAMEEXIT`: both are compiled out together. */
+#if defined(PT_DEBUG) && (defined(PT_UNWIND) || PT_LEVEL < PALLENE_TRACER_LEVEL_C)
+#define PALLENE_TRACER_C_FRAMEENTER(fnstack, fn_name, filename, var_name)       \
+(void) (fnstack);
+#define PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+#else
 #define PALLENE_TRACER_C_FRAMEENTER(fnstack, fn_name, filename, var_name)       \
 _PALLENE_TRACER_PREPARE_C_FRAME(fn_name, filename, var_name);                   \
 PALLENE_TRACER_FRAMEENTER(fnstack, &var_name);
+#define PALLENE_TRACER_C_FRAMEEXIT(fnstack)                                     \
+PALLENE_TRACER_FRAMEEXIT(fnstack)
+#endif // PT_UNWIND || PT_LEVEL
 
 /* -- GENERIC MACROS -- */
 
@@ -129,6 +456,27 @@ PALLENE_TRACER_FRAMEENTER(fnstack, &var_name);
 #define PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)                               \
     PALLENE_TRACER_SETLINE(fnstack, __LINE__ + 1)
 
+/* -- PROFILE-GUIDED HINTS -- */
+
+/* `tools/pt-pgo.lua` turns profiles into a header defining `PT_PGO_<fn>` as `hot` or
+   `cold`, included before the module (`-include`). Put this macro before the definition
+   of a function: it expands to the attribute of the function, or to nothing. */
+/* E.U.: `PALLENE_TRACER_PGO(leaf) int leaf(lua_State *L, int n) { ... }` */
+#if defined(__GNUC__) || defined(__clang__)
+#define PALLENE_TRACER_PGO(fn)                   _PALLENE_TRACER_PGO_1(PT_PGO_##fn)
+#else
+#define PALLENE_TRACER_PGO(fn)
+#endif
+
+/* Not part of the API. The hint is expanded, then pasted: a defined one becomes a comma
+   and the attribute, which moves it to the second argument of the last macro. */
+#define _PALLENE_TRACER_PGO_1(hint)              _PALLENE_TRACER_PGO_2(hint)
+#define _PALLENE_TRACER_PGO_2(hint)              _PALLENE_TRACER_PGO_3(_PALLENE_TRACER_PGO_##hint)
+#define _PALLENE_TRACER_PGO_3(arg)               _PALLENE_TRACER_PGO_ATTR(arg, , )
+#define _PALLENE_TRACER_PGO_ATTR(ignored, attr, ...)    attr
+#define _PALLENE_TRACER_PGO_hot                  , __attribute__((hot))
+#define _PALLENE_TRACER_PGO_cold                 , __attribute__((cold))
+
 /* ---- API HELPER MACROS END ---- */
 
 /* ---------------- MACRO DEFINITIONS END ---------------- */
@@ -139,34 +487,261 @@ PALLENE_TRACER_FRAMEENTER(fnstack, &var_name);
    C function or Lua C Function? */
 typedef enum frame_type {
     PALLENE_TRACER_FRAME_TYPE_C,
-    PALLENE_TRACER_FRAME_TYPE_LUA
+    PALLENE_TRACER_FRAME_TYPE_LUA,
+
+    /* Pushed by the `-finstrument-functions` hooks (`PT_INSTRUMENT`). */
+    PALLENE_TRACER_FRAME_TYPE_NATIVE,
+
+    /* Lua functions, pushed by the call hook of `pallene_tracer_hook_lua`. */
+    PALLENE_TRACER_FRAME_TYPE_HOOKED,
+
+    /* C interface frames running calls inlined into them, see `pallene_tracer_setinlined`. */
+    PALLENE_TRACER_FRAME_TYPE_INLINED
 } frame_type_t;
 
+/* What to do when a frame does not fit in the call-stack. */
+typedef enum pt_overflow {
+    PALLENE_TRACER_OVERFLOW_TRUNCATE,    /* Count the frame but do not record it. */
+    PALLENE_TRACER_OVERFLOW_ERROR        /* Raise a Lua error on next Lua interface frame. */
+} pt_overflow_t;
+
+/* Where the call-stack is allocated. */
+typedef enum pt_storage {
+    PALLENE_TRACER_STORAGE_HEAP,         /* `malloc` */
+    PALLENE_TRACER_STORAGE_ALLOCATOR,    /* A `lua_Alloc`, the one of the Lua state by default. */
+    PALLENE_TRACER_STORAGE_SHM,          /* Shared memory, if the implementation has `PT_SHM`. */
+    PALLENE_TRACER_STORAGE_POOL,         /* Recycled buffers, if the implementation has `PT_POOL`. */
+    PALLENE_TRACER_STORAGE_MMAP          /* Anonymous pages, if `MAP_ANONYMOUS` is declared. */
+} pt_storage_t;
+
+/* Memory held by the pool of `PT_POOL`, in bytes. */
+typedef struct pt_pool_stats {
+    size_t in_use;                       /* Held by call-stacks. */
+    size_t idle;                         /* Waiting to be reused. */
+    size_t high_water;                   /* Highest `in_use + idle` so far. */
+} pt_pool_stats_t;
+
+/* Options of `pallene_tracer_init_ex`. Start from `PALLENE_TRACER_DEFAULT_OPTIONS`. */
+typedef struct pt_options {
+    int capacity;                        /* Number of frames the call-stack can hold. */
+    pt_overflow_t overflow;
+    pt_storage_t storage;
+
+    /* `PALLENE_TRACER_STORAGE_ALLOCATOR`: the allocator, e.g. an arena, or NULL. */
+    lua_Alloc alloc;
+    void *alloc_ud;
+} pt_options_t;
+
 /* Details of the callee function (name, where it is from etc.) */
-/* Optimization Tip: Try declaring the struct 'static'. */
+/* The helper macros declare the struct 'static', so every function has a single
+   descriptor. Its address identifies the function. */
 typedef struct pt_fn_details {
     const char *const fn_name;
     const char *const filename;
 } pt_fn_details_t;
 
+/* A chain of calls inlined into a function, outermost first: `details[i]` was inlined
+   at line `lines[i]` of the function before it, the first one into the function of
+   the frame itself. The line of the innermost call is the line of the frame. */
+/* E.U., `b` inlined at line 40 and `c` inlined into it at line 12:
+       static PT_INLINED_SECTION const pt_inlined_t chain =
+           { { &b_details, &c_details }, { 40, 12 }, 2 };
+ */
+typedef struct pt_inlined {
+    const pt_fn_details_t *details[PALLENE_TRACER_MAX_INLINED];
+    int lines[PALLENE_TRACER_MAX_INLINED];
+    int length;
+} pt_inlined_t;
+
+/* The call counter of a function (`PT_COUNTERS`). Pointer-sized fields, so the
+   section of counters is an array. */
+typedef struct pt_counter {
+    const pt_fn_details_t *details;
+    size_t calls;
+} pt_counter_t;
+
 /* A single frame representation. */
 typedef struct pt_frame {
     frame_type_t type;
+
+    /* The current line of C interface frames, 0 in Lua interface frames. */
     int line;
 
+    /* What else a frame holds depends on its type. The arms of Lua interface and C
+       interface frames are the largest, and the same size. */
     union {
-        pt_fn_details_t *details;
+        const pt_fn_details_t *details;
         lua_CFunction c_fnptr;
+
+        /* Lua interface frames: the function, the thread running it, on which the
+           C interface frames above raise their errors, the index of the previous
+           Lua interface frame, and the serial number of the call (`lua_calls` when it
+           was entered). */
+        struct {
+            lua_CFunction fnptr;
+            lua_State *L;
+            int prev;
+            unsigned int serial;
+        } lua;
+
+        /* C interface and inlined frames: the function, the chain of calls inlined
+           into it if any, how many more times the frame repeats on top of itself
+           (`PT_RLE`), and the line the repetitions below the topmost one are at. */
+        struct {
+            const pt_fn_details_t *details;
+            const pt_inlined_t *chain;
+            int repeat;
+            int repeat_line;
+        } c;
+
+        /* The C interface frames of trampolines: the function, and where the trampoline
+           found the C stack, to spot frames left behind by Lua errors. */
+        struct {
+            const pt_fn_details_t *details;
+            uintptr_t sp;
+        } trampoline;
+
+        /* Native frames: the function address, resolved to a name only when needed,
+           and where the hook found the C stack, to spot frames skipped by Lua errors. */
+        struct {
+            void *fn_addr;
+            uintptr_t sp;
+        } native;
+
+        /* Hooked frames: a descriptor made for the Lua function, so they read as C
+           interface frames, and the call they stand for: the thread running it, and
+           how many calls were on its stack, the call included. */
+        struct {
+            const pt_fn_details_t *details;
+            lua_State *L;
+            int depth;
+        } hooked;
     } shared;
 } pt_frame_t;
 
+/* A budget of steps and time for the running calls, see `pallene_tracer_budget`. */
+typedef struct pt_budget {
+    /* Traced lines left until the budget is charged again (`PT_BUDGET`), 0 if there
+       is no budget. */
+    unsigned int ticks;
+
+    /* Steps left, 0 if unlimited. */
+    unsigned long long steps;
+
+    /* When the time runs out, in seconds of a monotonic clock, 0 if never. */
+    double deadline;
+} pt_budget_t;
+
 /* Our stack is fully heap-allocated stack. We need some structure to hold
    the stack information. This structure will be an Userdatum. */
 typedef struct pt_fnstack {
     pt_frame_t *stack;
     int count;
+
+    /* Number of frames `stack` can hold. Frames past it are counted only. */
+    int capacity;
+    pt_overflow_t overflow;
+
+    /* Index of the topmost Lua interface frame, -1 if none. Together with `prev`
+       of each Lua interface frame, it lets the finalizer unwind in constant time. */
+    int top_lua;
+
+    /* Number of Lua interface frames entered so far. A heartbeat for watchdogs. */
+    unsigned int lua_calls;
+
+    /* What the calls are made for, e.g. a request or a tenant, 0 if nothing. Set with
+       `pallene_tracer_setcontext`, read by sinks and by `pt-spy`. */
+    int64_t context;
+
+    pt_budget_t budget;
+
+    /* Whether Lua functions are recorded too, see `pallene_tracer_hook_lua`. */
+    bool hook_lua;
+
+    /* Reference to the finalizer object in the registry. */
+    int finalizer;
+
+    /* The allocator of the stack and of this structure, NULL in shared memory. */
+    lua_Alloc alloc;
+    void *alloc_ud;
+
+    /* The shared memory segment holding this structure (`PT_SHM`), or NULL. */
+    struct pt_shm_header *shm;
 } pt_fnstack_t;
 
+/* What sinks are told about (`PT_SINKS`). */
+typedef enum pt_event {
+    PALLENE_TRACER_EVENT_ENTER,          /* A frame was entered. */
+    PALLENE_TRACER_EVENT_EXIT,           /* The topmost frame is about to be removed. */
+
+    /* The frames down to the topmost Lua interface frame are about to be removed, by
+       the finalizer of that frame, when its function returns or raises an error. */
+    PALLENE_TRACER_EVENT_UNWIND,
+
+    PALLENE_TRACER_EVENT_TRACEBACK       /* A traceback is built for an error. */
+} pt_event_t;
+
+/* A sink, called with the `ud` it was registered with. `frame` is the topmost frame,
+   NULL if it was not recorded. */
+typedef void (*pt_sink_t)(void *ud, pt_event_t event, pt_fnstack_t *fnstack, const pt_frame_t *frame);
+
+/* An edge of the call graph (`PT_CALLGRAPH`). The callee is NULL while the entry is
+   free. */
+typedef struct pt_edge {
+    const pt_fn_details_t *caller;    /* NULL for Lua. */
+    const pt_fn_details_t *callee;
+    uint64_t calls;
+    uint64_t time;                    /* Nanoseconds in the callee, the calls it made included. */
+} pt_edge_t;
+
+/* Formats of `pallene_tracer_callgraph_write`. */
+typedef enum pt_graph_format {
+    PALLENE_TRACER_GRAPH_DOT,         /* Graphviz. */
+    PALLENE_TRACER_GRAPH_CALLGRIND    /* For KCachegrind. */
+} pt_graph_format_t;
+
+/* Layout of a call-stack published in shared memory (`PT_SHM`). Offsets are from the
+   start of the segment. The frames follow the header, then the descriptor table, the
+   table of chains and the string table. Readers must check `magic`, `version` and `frame_size`. */
+typedef struct pt_shm_header {
+    char magic[8];                    /* PALLENE_TRACER_SHM_MAGIC */
+    uint32_t version;                 /* PALLENE_TRACER_SHM_VERSION */
+    uint32_t frame_size;              /* sizeof(pt_frame_t) */
+    uint32_t size;                    /* Size of the segment. */
+    int32_t pid;
+
+    uint32_t frames;                  /* Offset of the frames. */
+    uint32_t descriptors;             /* Offset of the descriptor table. */
+    uint32_t max_descriptors;
+    uint32_t descriptor_count;        /* Bumped after the entry is written. */
+    uint32_t chains;                  /* Offset of the table of chains. */
+    uint32_t max_chains;
+    uint32_t chain_count;             /* Bumped after the entry is written. */
+    uint32_t strings;                 /* Offset of the string table. */
+    uint32_t strings_size;
+    uint32_t strings_used;
+    char name[64];                    /* Path of the segment. */
+
+    pt_fnstack_t fnstack;             /* The call-stack itself. */
+} pt_shm_header_t;
+
+/* An entry of the descriptor table, mapping the address of a descriptor in the process
+   to its strings. */
+typedef struct pt_shm_descriptor {
+    uint64_t details;
+    uint32_t fn_name;                 /* Offsets in the string table. */
+    uint32_t filename;
+} pt_shm_descriptor_t;
+
+/* An entry of the table of chains, mapping the address of a chain of inlined calls in
+   the process to the addresses of its descriptors. */
+typedef struct pt_shm_chain {
+    uint64_t chain;
+    uint32_t length;
+    uint32_t reserved;
+    uint64_t details[PALLENE_TRACER_MAX_INLINED];
+} pt_shm_chain_t;
+
 /* ---------------- DATA STRUCTURES END ---------------- */
 
 /* ---------------- DECLARATIONS ---------------- */
@@ -180,28 +755,485 @@ extern "C" {
 /* This function must only be called from Lua module entry point. */
 /* NOTE: Pushes the finalizer object to the stack. The object has to be closed
    everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
-PT_API pt_fnstack_t *pallene_tracer_init(lua_State *L);
+PT_API PT_NOINSTRUMENT pt_fnstack_t *pallene_tracer_init(lua_State *L);
+
+/* Same as `pallene_tracer_init`, with options for the call-stack if it is created. If
+   it exists already, the options are reconciled with it: the strictest overflow policy
+   wins, and the call-stack grows to the largest capacity asked for while it is empty
+   and not in shared memory. Its storage never changes. */
+PT_API PT_NOINSTRUMENT pt_fnstack_t *pallene_tracer_init_ex(lua_State *L, const pt_options_t *options);
+
+/* Handles a Lua interface frame which does not fit in the call-stack. Either raises
+   an error or counts the frame, according to the overflow policy. */
+/* Not to be called directly. Used by `PALLENE_TRACER_LUA_FRAMEENTER`. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_overflow(lua_State *L, pt_fnstack_t *fnstack);
+
+/* Sets a budget for the calls that follow on `L`: at most `steps` steps (Lua
+   instructions, and traced lines under `PT_BUDGET`) and `seconds` of wall-clock time.
+   Zero means no limit; both zero removes the budget. When it runs out, the budget is
+   removed and a Lua error is raised, by a count hook on `L`, or by
+   `pallene_tracer_setline` in modules compiled with `PT_BUDGET`. The hook replaces any
+   other hook of `L`, except the one of `pallene_tracer_hook_lua`, which it shares. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_budget(lua_State *L, pt_fnstack_t *fnstack,
+    unsigned long long steps, double seconds);
+
+/* Charges `steps` to the budget, raising the error if it ran out. */
+/* Not to be called directly. Used by `pallene_tracer_setline` under `PT_BUDGET`. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_budget_charge(lua_State *L, pt_fnstack_t *fnstack,
+    unsigned long long steps);
+
+/* Records the Lua functions called on `L`, and on the threads it creates afterwards, as
+   hooked frames, for one profile of Lua and C. Lua interface functions are C functions,
+   so they are recorded once, by their own frames. Errors caught in Lua may leave frames
+   behind until the function which caught them returns. The call hook replaces any other
+   hook of `L`, except the one of `pallene_tracer_budget`, which it shares. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_hook_lua(lua_State *L, pt_fnstack_t *fnstack, bool enable);
+
+/* Registers the functions of `l` in the table below the `nup` upvalues on top of the
+   stack, as `luaL_setfuncs` does, each behind a trampoline. The trampoline records a
+   Lua interface frame and a C interface frame named `libname.name` (`name` if
+   `libname` is NULL), with the finalizer which removes them, then calls the function
+   with its arguments. C modules left as they are get traced this way, see
+   `PT_WRAP_SETFUNCS`. Without a call-stack (`PT_DEBUG`), functions are registered as
+   they are. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_setfuncs(lua_State *L, const char *libname, const luaL_Reg *l, int nup);
+
+/* A `lua_CFunction` putting the C functions of the table passed behind trampolines,
+   in place. The optional second argument is the
+   `libname`. Returns the table. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_wrap(lua_State *L);
+
+#ifdef PT_POOL
+/* Reports the memory held by the pool. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_pool_stats(pt_pool_stats_t *stats);
+
+/* Frees the idle buffers of the process-wide list. Those cached by threads stay. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_pool_trim(void);
+#endif // PT_POOL
+
+#ifdef PT_COUNTERS
+/* A `lua_CFunction` returning a table of the calls of every function of the modules
+   loaded in the Lua state, by function name, and resetting them. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_stats(lua_State *L);
+#endif // PT_COUNTERS
+
+#ifdef PT_PERF
+/* A `lua_CFunction` measuring the C interface functions named by its arguments, and
+   no others, in every thread entering them. Returns the counters used: "hardware",
+   "software", or "none" if there are none and only calls are counted. Without
+   arguments, stops, which traced code may be running during. Select while no traced
+   code runs: the sinks read the names of the last selection without a lock. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_perf(lua_State *L);
+
+/* A `lua_CFunction` returning what was measured since the last time, by function name,
+   and resetting it. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_perf_stats(lua_State *L);
+#endif // PT_PERF
+
+#ifdef PT_CALLGRAPH
+/* Forgets the edges recorded and starts recording, in every thread. Returns false if
+   there is no room for its sink. */
+PT_API PT_NOINSTRUMENT bool pallene_tracer_callgraph_start(void);
+
+/* Stops recording. The edges stay until the next start. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_callgraph_stop(void);
+
+/* Writes the edges recorded, in DOT or in the format of Callgrind, with the time of
+   the functions themselves for the latter. Returns false on write errors, or if out of
+   memory. */
+PT_API PT_NOINSTRUMENT bool pallene_tracer_callgraph_write(FILE *file, pt_graph_format_t format);
+
+/* A `lua_CFunction` returning the edges recorded, as a sequence of tables with the
+   `caller` and `callee` names (`caller` is nil for Lua), their `caller_file` and
+   `callee_file`, the `calls` and their `time` in seconds. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_callgraph_edges(lua_State *L);
+#endif // PT_CALLGRAPH
+
+#ifdef PT_LATENCY
+/* Forgets the histograms and starts recording, in every thread. Returns false if there
+   is no room for its sink. */
+PT_API PT_NOINSTRUMENT bool pallene_tracer_latency_start(void);
+
+/* Stops recording. The histograms stay until the next start. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_latency_stop(void);
+
+/* A `lua_CFunction` returning a snapshot of the histograms, by function name: the
+   `count` of calls, their `sum` and `max` in seconds, the `p50`, `p90`, `p99` and
+   `p999` percentiles, and the `buckets`, counts by upper bound in nanoseconds. Empty
+   buckets are left out. Functions are named as in `package.loaded`. If the argument is
+   true, the histograms are reset as well. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_latency_snapshot(lua_State *L);
+
+/* A `lua_CFunction` merging the snapshots passed, e.g. of several Lua states or runs,
+   into a new one. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_latency_merge(lua_State *L);
+
+/* Writes the histograms in the text format of Prometheus, naming the functions with
+   `L`, or by address if it is NULL. Returns false on write errors. */
+PT_API PT_NOINSTRUMENT bool pallene_tracer_latency_write(lua_State *L, FILE *file);
+#endif // PT_LATENCY
+
+#ifdef PT_ACCOUNTING
+/* Forgets the times accounted and starts accounting, in every thread. Returns false if
+   there is no room for its sink. */
+PT_API PT_NOINSTRUMENT bool pallene_tracer_accounting_start(void);
+
+/* Stops accounting. The times stay until the next start. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_accounting_stop(void);
+
+/* A `lua_CFunction` returning what was accounted since the last time, by context: the
+   `calls` and their `cpu` time in seconds. Resets it if the argument is true. */
+PT_API PT_NOINSTRUMENT int pallene_tracer_accounting_stats(lua_State *L);
+#endif // PT_ACCOUNTING
+
+#ifdef PT_SINKS
+/* Number of sinks registered. Frames check it inline. */
+PT_API int pallene_tracer_sinks;
+
+/* Registers a sink for all the call-stacks of the process. Returns false if there are
+   `PALLENE_TRACER_MAX_SINKS` already. Sinks are called on the thread of the event and
+   must not enter frames themselves. Not thread-safe: add and remove sinks while no
+   traced code runs. */
+PT_API PT_NOINSTRUMENT bool pallene_tracer_sink_add(pt_sink_t sink, void *ud);
+
+/* Removes a sink registered with the same `ud`. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_sink_remove(pt_sink_t sink, void *ud);
+
+/* Calls the sinks. */
+/* Not to be called directly. Used by the frame functions, the finalizer and `pt-lua`. */
+PT_API PT_NOINSTRUMENT void pallene_tracer_emit(pt_event_t event, pt_fnstack_t *fnstack, const pt_frame_t *frame);
+
+#define _PALLENE_TRACER_EMIT(event, fnstack, frame)                                     \
+do {                                                                                     \
+    if(luai_unlikely(pallene_tracer_sinks != 0))                                         \
+        pallene_tracer_emit(event, fnstack, frame);                                      \
+} while(0)
+#else
+#define _PALLENE_TRACER_EMIT(event, fnstack, frame)
+#endif // PT_SINKS
+
+/* The topmost frame, NULL if it was not recorded. */
+static inline PT_NOINSTRUMENT pt_frame_t *_pallene_tracer_top(pt_fnstack_t *fnstack) {
+    return fnstack->count != 0 && fnstack->count <= fnstack->capacity
+        ? &fnstack->stack[fnstack->count - 1] : NULL;
+}
+
+/* How many more times a frame repeats on top of itself (`PT_RLE`). */
+static inline PT_NOINSTRUMENT int pallene_tracer_repeat(const pt_frame_t *frame) {
+    return frame->type == PALLENE_TRACER_FRAME_TYPE_C || frame->type == PALLENE_TRACER_FRAME_TYPE_INLINED
+        ? frame->shared.c.repeat : 0;
+}
+
+#ifdef PT_USDT
+/* Probe arguments. Only C interface, hooked and inlined frames have names, inlined
+   frames the one of the function they are in. */
+#define _PALLENE_TRACER_PROBE_NAMED(frame)                                              \
+    ((frame)->type == PALLENE_TRACER_FRAME_TYPE_C || (frame)->type == PALLENE_TRACER_FRAME_TYPE_HOOKED \
+     || (frame)->type == PALLENE_TRACER_FRAME_TYPE_INLINED)
+#define _PALLENE_TRACER_PROBE_FRAME(name, frame, depth)                                \
+    PALLENE_TRACER_PROBE(name,                                                          \
+        _PALLENE_TRACER_PROBE_NAMED(frame) ? (frame)->shared.details->fn_name : NULL,  \
+        _PALLENE_TRACER_PROBE_NAMED(frame) ? (frame)->shared.details->filename : NULL, \
+        (frame)->line, depth)
+
+/* Fires a probe for the topmost frame. */
+static inline PT_NOINSTRUMENT void _pallene_tracer_probe_exit(pt_fnstack_t *fnstack) {
+    pt_frame_t *top = _pallene_tracer_top(fnstack);
+
+    if(top != NULL)
+        _PALLENE_TRACER_PROBE_FRAME(frameexit, top, fnstack->count);
+    else
+        PALLENE_TRACER_PROBE(frameexit, NULL, NULL, 0, fnstack->count);
+}
+#else
+#define _PALLENE_TRACER_PROBE_FRAME(name, frame, depth)
+#endif // PT_USDT
 
 /* Pushes a frame to the stack. The frame structure is self-managed for every function. */
-static inline void pallene_tracer_frameenter(pt_fnstack_t *fnstack, pt_frame_t *restrict frame) {
+static inline PT_NOINSTRUMENT void pallene_tracer_frameenter(pt_fnstack_t *fnstack, pt_frame_t *PT_RESTRICT frame) {
+    _PALLENE_TRACER_PROBE_FRAME(frameenter, frame, fnstack->count + 1);
+
+#ifdef PT_RLE
+    /* Are we entering the same C interface function as the topmost frame? */
+    if(frame->type == PALLENE_TRACER_FRAME_TYPE_C && fnstack->count != 0
+        && fnstack->count <= fnstack->capacity) {
+        pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+
+        if(top->type == PALLENE_TRACER_FRAME_TYPE_C
+            && top->shared.details == frame->shared.details) {
+            top->shared.c.repeat++;
+            top->shared.c.repeat_line = top->line;
+            _PALLENE_TRACER_EMIT(PALLENE_TRACER_EVENT_ENTER, fnstack, top);
+            return;
+        }
+    }
+#endif // PT_RLE
+
     /* Have we ran out of stack entries? If we do, stop pushing frames. */
-    if(luai_likely(fnstack->count < PALLENE_TRACER_MAX_CALLSTACK))
+    if(luai_likely(fnstack->count < fnstack->capacity)) {
         fnstack->stack[fnstack->count] = *frame;
 
+        /* Chain Lua interface frames, so the finalizer can find them right away. */
+        if(frame->type == PALLENE_TRACER_FRAME_TYPE_LUA) {
+            fnstack->stack[fnstack->count].shared.lua.prev = fnstack->top_lua;
+            fnstack->stack[fnstack->count].shared.lua.serial = ++fnstack->lua_calls;
+            fnstack->top_lua = fnstack->count;
+        }
+    }
+
     fnstack->count++;
+    _PALLENE_TRACER_EMIT(PALLENE_TRACER_EVENT_ENTER, fnstack, _pallene_tracer_top(fnstack));
 }
 
 /* Sets line number to the topmost frame in the stack. */
-static inline void pallene_tracer_setline(pt_fnstack_t *fnstack, int line) {
-    if(luai_likely(fnstack->count != 0))
+static inline PT_NOINSTRUMENT void pallene_tracer_setline(pt_fnstack_t *fnstack, int line) {
+    /* The topmost frame may not have been recorded if we ran out of entries. */
+    if(luai_likely(fnstack->count != 0 && fnstack->count <= fnstack->capacity))
         fnstack->stack[fnstack->count - 1].line = line;
+
+#ifdef PT_BUDGET
+    /* Errors are raised on the thread of the topmost Lua interface frame. */
+    if(luai_unlikely(fnstack->budget.ticks != 0) && --fnstack->budget.ticks == 0
+        && fnstack->top_lua >= 0)
+        pallene_tracer_budget_charge(fnstack->stack[fnstack->top_lua].shared.lua.L,
+            fnstack, PALLENE_TRACER_BUDGET_INTERVAL);
+#endif // PT_BUDGET
+}
+
+/* Enters the chain of calls inlined into the function of the topmost frame, which must
+   be a C interface frame: one frame then stands for all of them, and lines set from
+   now on are those of the innermost call. NULL leaves the chain. Under `PT_RLE` the
+   chain is the one of every repetition of the frame. */
+static inline PT_NOINSTRUMENT void pallene_tracer_setinlined(pt_fnstack_t *fnstack, const pt_inlined_t *chain) {
+    pt_frame_t *top = _pallene_tracer_top(fnstack);
+
+    if(top != NULL && (top->type == PALLENE_TRACER_FRAME_TYPE_C
+        || top->type == PALLENE_TRACER_FRAME_TYPE_INLINED)) {
+        top->type = chain != NULL ? PALLENE_TRACER_FRAME_TYPE_INLINED : PALLENE_TRACER_FRAME_TYPE_C;
+        top->shared.c.chain = chain;
+    }
+}
+
+/* Sets what the calls that follow on the call-stack are made for, returning what they
+   were made for. Hosts running the requests of several tenants on one Lua state set it
+   whenever they resume the coroutine of another one. */
+static inline PT_NOINSTRUMENT int64_t pallene_tracer_setcontext(pt_fnstack_t *fnstack, int64_t context) {
+    int64_t previous = fnstack->context;
+    fnstack->context = context;
+
+    return previous;
 }
 
 /* Removes the last frame from the stack. */
-static inline void pallene_tracer_frameexit(pt_fnstack_t *fnstack) {
+static inline PT_NOINSTRUMENT void pallene_tracer_frameexit(pt_fnstack_t *fnstack) {
+    _PALLENE_TRACER_EMIT(PALLENE_TRACER_EVENT_EXIT, fnstack, _pallene_tracer_top(fnstack));
+
+#ifdef PT_USDT
+    _pallene_tracer_probe_exit(fnstack);
+#endif // PT_USDT
+
+#ifdef PT_RLE
+    /* Only one of the repetitions is gone. */
+    pt_frame_t *top = _pallene_tracer_top(fnstack);
+    if(top != NULL && pallene_tracer_repeat(top) > 0) {
+        top->shared.c.repeat--;
+        top->line = top->shared.c.repeat_line;
+        return;
+    }
+#endif // PT_RLE
+
     fnstack->count -= (fnstack->count > 0);
 }
 
+#ifdef PT_SHM
+/* Copies a string to the string table of the segment. Returns its offset, 0 if it does
+   not fit (offset 0 holds an empty string). */
+static inline PT_NOINSTRUMENT uint32_t _pallene_tracer_shm_string(pt_shm_header_t *shm, const char *str) {
+    size_t len = strlen(str) + 1;
+
+    /* Keep the first byte as the empty string. */
+    if(shm->strings_used == 0)
+        shm->strings_used = 1;
+
+    if(shm->strings_used + len > shm->strings_size)
+        return 0;
+
+    uint32_t offset = shm->strings_used;
+    memcpy((char *) shm + shm->strings + offset, str, len);
+    shm->strings_used += (uint32_t) len;
+
+    return offset;
+}
+
+/* Adds a descriptor to the table, `filename` being the offset of its file name. */
+static inline PT_NOINSTRUMENT void _pallene_tracer_shm_describe(pt_shm_header_t *shm,
+    const pt_fn_details_t *details, uint32_t filename) {
+    pt_shm_descriptor_t *table = (pt_shm_descriptor_t *) ((char *) shm + shm->descriptors);
+    uint32_t count = shm->descriptor_count;
+    if(count == shm->max_descriptors)
+        return;
+
+    table[count].details  = (uint64_t) (uintptr_t) details;
+    table[count].fn_name  = _pallene_tracer_shm_string(shm, details->fn_name);
+    table[count].filename = filename;
+
+    /* Readers only look at entries below the count. */
+    __atomic_store_n(&shm->descriptor_count, count + 1, __ATOMIC_RELEASE);
+}
+
+/* The descriptors of this module, gathered in the `pt_details` section by the linker.
+   Hidden: every module has a section of its own. */
+extern const pt_fn_details_t __start_pt_details[] __attribute__((weak, visibility("hidden")));
+extern const pt_fn_details_t __stop_pt_details[] __attribute__((weak, visibility("hidden")));
+
+/* The chains of inlined calls of this module, gathered in the `pt_inlined` section. */
+extern const pt_inlined_t __start_pt_inlined[] __attribute__((weak, visibility("hidden")));
+extern const pt_inlined_t __stop_pt_inlined[] __attribute__((weak, visibility("hidden")));
+
+/* Publishes the chains of inlined calls of this module in the segment. */
+static inline PT_NOINSTRUMENT void _pallene_tracer_shm_chains(pt_shm_header_t *shm) {
+    const pt_inlined_t *first = __start_pt_inlined, *last = __stop_pt_inlined;
+    pt_shm_chain_t *table = (pt_shm_chain_t *) ((char *) shm + shm->chains);
+
+    for(const pt_inlined_t *chain = first; first != NULL && chain < last; chain++) {
+        uint32_t count = shm->chain_count;
+        if(count == shm->max_chains)
+            return;
+
+        int length = chain->length < PALLENE_TRACER_MAX_INLINED ? chain->length : PALLENE_TRACER_MAX_INLINED;
+        table[count].chain  = (uint64_t) (uintptr_t) chain;
+        table[count].length = (uint32_t) length;
+        for(int i = 0; i < length; i++)
+            table[count].details[i] = (uint64_t) (uintptr_t) chain->details[i];
+
+        __atomic_store_n(&shm->chain_count, count + 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Publishes the names of the functions of this module in the segment. */
+static inline PT_NOINSTRUMENT void _pallene_tracer_shm_publish(pt_shm_header_t *shm) {
+    const pt_fn_details_t *first = __start_pt_details, *last = __stop_pt_details;
+    pt_shm_descriptor_t *table = (pt_shm_descriptor_t *) ((char *) shm + shm->descriptors);
+
+    if(first == NULL || first == last)
+        return;
+
+    /* Were we published already? Modules may be loaded again. */
+    for(uint32_t i = 0; i < shm->descriptor_count; i++)
+        if(table[i].details == (uint64_t) (uintptr_t) first)
+            return;
+
+    const char *prev_filename = NULL;
+    uint32_t filename = 0;
+
+    for(const pt_fn_details_t *details = first; details < last; details++) {
+        if(shm->descriptor_count == shm->max_descriptors)
+            break;
+
+        /* Functions of a file are usually next to each other. */
+        if(prev_filename == NULL || strcmp(prev_filename, details->filename) != 0) {
+            filename = _pallene_tracer_shm_string(shm, details->filename);
+            prev_filename = details->filename;
+        }
+
+        _pallene_tracer_shm_describe(shm, details, filename);
+    }
+
+    _pallene_tracer_shm_chains(shm);
+}
+
+#endif // PT_SHM
+
+/* The call-stack in the extra space of `L`. A thread created before it was stored has
+   NULL, and takes the one of the registry, once. */
+static inline PT_NOINSTRUMENT pt_fnstack_t *_pallene_tracer_extraspace_get(lua_State *L) {
+    pt_fnstack_t **slot = _PALLENE_TRACER_EXTRASPACE_SLOT(L);
+    if(luai_likely(*slot != NULL))
+        return *slot;
+
+    if(lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY) == LUA_TUSERDATA)
+        *slot = *(pt_fnstack_t **) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    return *slot;
+}
+
+#ifdef PT_EXTRASPACE
+/* Stores the call-stack in the extra space of `L` and of the main thread, which new
+   threads copy theirs from. */
+static inline PT_NOINSTRUMENT void _pallene_tracer_extraspace_set(lua_State *L, pt_fnstack_t *fnstack) {
+    /* The extra space must hold a pointer. */
+    (void) sizeof(char[LUA_EXTRASPACE >= sizeof(pt_fnstack_t *) ? 1 : -1]);
+
+    *_PALLENE_TRACER_EXTRASPACE_SLOT(L) = fnstack;
+    lua_rawgeti(L, LUA_REGISTRYINDEX, LUA_RIDX_MAINTHREAD);
+    *_PALLENE_TRACER_EXTRASPACE_SLOT(lua_tothread(L, -1)) = fnstack;
+    lua_pop(L, 1);
+}
+#endif // PT_EXTRASPACE
+
+#ifdef PT_COUNTERS
+/* The counters of this module, gathered in the `pt_counters` section by the linker. */
+extern pt_counter_t __start_pt_counters[] __attribute__((weak, visibility("hidden")));
+extern pt_counter_t __stop_pt_counters[] __attribute__((weak, visibility("hidden")));
+
+/* Registers the counters of this module in the Lua state, by the bounds of the section.
+   They stay valid while the state lives: the module is not unloaded before. */
+static inline PT_NOINSTRUMENT void _pallene_tracer_counters_register(lua_State *L) {
+    pt_counter_t *first = __start_pt_counters, *last = __stop_pt_counters;
+    if(first == NULL || first == last)
+        return;
+
+    luaL_getsubtable(L, LUA_REGISTRYINDEX, PALLENE_TRACER_COUNTERS_ENTRY);
+    lua_pushlightuserdata(L, last);
+    lua_rawsetp(L, -2, first);
+    lua_pop(L, 1);
+}
+#endif // PT_COUNTERS
+
+#if defined(PT_SHM) || defined(PT_EXTRASPACE) || defined(PT_COUNTERS)
+/* `pallene_tracer_init` may well be the copy of another module (`pt-lua` exports its
+   own), so the calling module publishes its descriptors, fills in the extra space and
+   registers its counters itself. */
+static inline PT_NOINSTRUMENT pt_fnstack_t *_pallene_tracer_init_inline(lua_State *L, pt_fnstack_t *fnstack) {
+    (void) L;
+#ifdef PT_SHM
+    if(fnstack != NULL && fnstack->shm != NULL)
+        _pallene_tracer_shm_publish(fnstack->shm);
+#endif // PT_SHM
+
+#ifdef PT_EXTRASPACE
+    if(fnstack != NULL)
+        _pallene_tracer_extraspace_set(L, fnstack);
+#endif // PT_EXTRASPACE
+
+#ifdef PT_COUNTERS
+    if(fnstack != NULL)
+        _pallene_tracer_counters_register(L);
+#endif // PT_COUNTERS
+
+    return fnstack;
+}
+
+#define pallene_tracer_init(L)                _pallene_tracer_init_inline(L, (pallene_tracer_init)(L))
+#define pallene_tracer_init_ex(L, options)    _pallene_tracer_init_inline(L, (pallene_tracer_init_ex)(L, options))
+#endif // PT_SHM || PT_EXTRASPACE || PT_COUNTERS
+
+/* Same as `luaL_newlib`, with the functions behind trampolines. */
+#define pallene_tracer_newlib(L, libname, l)                                    \
+    (luaL_checkversion(L), luaL_newlibtable(L, l), pallene_tracer_setfuncs(L, libname, l, 0))
+
+/* Define `PT_WRAP_SETFUNCS` to trace a C module left as it is, compiled with
+   `-include ptracer.h -DPT_DEBUG -DPT_WRAP_SETFUNCS`: its `luaL_setfuncs`, and so its
+   `luaL_newlib`, put its functions behind trampolines. The host implements them.
+   `PT_WRAP_LIBNAME` is the `libname` of its functions, e.g. `-DPT_WRAP_LIBNAME='"mod"'`. */
+#if defined(PT_WRAP_SETFUNCS) && defined(PT_DEBUG)
+#ifndef PT_WRAP_LIBNAME
+#define PT_WRAP_LIBNAME                       NULL
+#endif // PT_WRAP_LIBNAME
+#define luaL_setfuncs(L, l, nup)              pallene_tracer_setfuncs(L, PT_WRAP_LIBNAME, l, nup)
+#endif // PT_WRAP_SETFUNCS
+
 #ifdef __cplusplus
 }
 #endif // __cplusplus
@@ -214,34 +1246,672 @@ static inline void pallene_tracer_frameexit(pt_fnstack_t *fnstack) {
 /* This is implementation guard, making sure we include the implementation just one time. */
 #define PT_IMPLEMENTED
 
+#include <time.h>
+
+#ifdef PT_SHM
+#include <stdio.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#endif // PT_SHM
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <unistd.h>
+#include <sys/mman.h>
+#endif // __unix__ || __APPLE__
+
+#if defined(PT_POOL) || defined(PT_PERF) || defined(PT_CALLGRAPH) || defined(PT_LATENCY) \
+    || defined(PT_ACCOUNTING) || defined(PT_INSTRUMENT)
+#include <pthread.h>
+#endif // PT_POOL || PT_PERF || PT_CALLGRAPH || PT_LATENCY || PT_ACCOUNTING || PT_INSTRUMENT
+
+#if defined(PT_CALLGRAPH) || defined(PT_LATENCY)
+/* Wall-clock nanoseconds, for timing calls. */
+static PT_NOINSTRUMENT uint64_t _pallene_tracer_monotonic_now(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#else
+    return (uint64_t) clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif // CLOCK_MONOTONIC
+}
+#endif // PT_CALLGRAPH || PT_LATENCY
+
+#if defined(PT_CALLGRAPH) || defined(PT_LATENCY) || defined(PT_ACCOUNTING)
+/* What an entry of a table holds, as `match` tells `_pallene_tracer_table_find`. */
+typedef enum pt_table_match {
+    _PALLENE_TRACER_TABLE_FREE,          /* Never claimed. */
+    _PALLENE_TRACER_TABLE_FOUND,         /* Claimed for the key looked for. */
+    _PALLENE_TRACER_TABLE_OTHER          /* Claimed for another key. */
+} pt_table_match_t;
+
+/* The tables of the profilers, shared by all threads: a power of two of entries, by
+   open addressing. Entries are claimed with the mutex held and found without it.
+   `claim` writes the key of an entry and publishes it last (release), `match` reads it
+   back (acquire). Entries are never removed while the profiler runs, so a search ends
+   at the first free entry. What the entries count is added to atomically. */
+typedef struct pt_table {
+    pthread_mutex_t mutex;
+    void *entries;
+    size_t stride;                       /* Bytes per entry. */
+    size_t capacity;
+    uint64_t dropped;                    /* Lookups which found the table full. */
+} pt_table_t;
+
+#define _PALLENE_TRACER_TABLE(entries)                                                  \
+{ PTHREAD_MUTEX_INITIALIZER, entries, sizeof((entries)[0]),                             \
+  sizeof(entries) / sizeof((entries)[0]), 0 }
+
+/* Frees all the entries. The profiler must not be running. */
+static PT_NOINSTRUMENT void _pallene_tracer_table_clear(pt_table_t *table) {
+    memset(table->entries, 0, table->capacity * table->stride);
+    table->dropped = 0;
+}
+
+/* Finds the entry of `key`, from `hash` on, claiming one for it the first time. NULL,
+   counted as dropped, if the table is full. Inlined, so are `match` and `claim`. */
+static inline PT_NOINSTRUMENT void *_pallene_tracer_table_find(pt_table_t *table, size_t hash,
+    const void *key, pt_table_match_t (*match)(const void *entry, const void *key),
+    void (*claim)(void *entry, const void *key)) {
+    size_t mask = table->capacity - 1;
+
+    for(int locked = 0; locked <= 1; locked++) {
+        if(locked)
+            pthread_mutex_lock(&table->mutex);
+
+        for(size_t n = 0, i = hash & mask; n < table->capacity; n++, i = (i + 1) & mask) {
+            void *entry = (char *) table->entries + i * table->stride;
+            pt_table_match_t found = match(entry, key);
+
+            if(found == _PALLENE_TRACER_TABLE_FOUND) {
+                if(locked)
+                    pthread_mutex_unlock(&table->mutex);
+                return entry;
+            }
+
+            if(found == _PALLENE_TRACER_TABLE_FREE) {
+                if(!locked)
+                    break;
+
+                claim(entry, key);
+                pthread_mutex_unlock(&table->mutex);
+                return entry;
+            }
+        }
+
+        if(locked)
+            pthread_mutex_unlock(&table->mutex);
+    }
+
+    __atomic_add_fetch(&table->dropped, 1, __ATOMIC_RELAXED);
+    return NULL;
+}
+#endif // PT_CALLGRAPH || PT_LATENCY || PT_ACCOUNTING
+
+#ifdef PT_PERF
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#endif // PT_PERF
+
+#ifdef PT_SINKS
+/* The registered sinks, the first `pallene_tracer_sinks` of them. */
+static struct {
+    pt_sink_t sink;
+    void *ud;
+} _pallene_tracer_sink_list[PALLENE_TRACER_MAX_SINKS];
+
+int pallene_tracer_sinks = 0;
+
+/* Registers a sink for all the call-stacks of the process. */
+PT_NOINSTRUMENT bool pallene_tracer_sink_add(pt_sink_t sink, void *ud) {
+    if(pallene_tracer_sinks == PALLENE_TRACER_MAX_SINKS)
+        return false;
+
+    _pallene_tracer_sink_list[pallene_tracer_sinks].sink = sink;
+    _pallene_tracer_sink_list[pallene_tracer_sinks].ud = ud;
+    pallene_tracer_sinks++;
+
+    return true;
+}
+
+/* Removes a sink, keeping the others in order. */
+PT_NOINSTRUMENT void pallene_tracer_sink_remove(pt_sink_t sink, void *ud) {
+    for(int i = 0; i < pallene_tracer_sinks; i++) {
+        if(_pallene_tracer_sink_list[i].sink == sink && _pallene_tracer_sink_list[i].ud == ud) {
+            memmove(&_pallene_tracer_sink_list[i], &_pallene_tracer_sink_list[i + 1],
+                (size_t) (pallene_tracer_sinks - i - 1) * sizeof(_pallene_tracer_sink_list[0]));
+            pallene_tracer_sinks--;
+            return;
+        }
+    }
+}
+
+/* Calls the sinks. */
+PT_NOINSTRUMENT void pallene_tracer_emit(pt_event_t event, pt_fnstack_t *fnstack, const pt_frame_t *frame) {
+    for(int i = 0; i < pallene_tracer_sinks; i++)
+        _pallene_tracer_sink_list[i].sink(_pallene_tracer_sink_list[i].ud, event, fnstack, frame);
+}
+#endif // PT_SINKS
+
 /* ---------------- PRIVATE ---------------- */
 
+/* Removes the Lua interface frame at `idx` and all the frames above it, all of them if
+   it is -1. */
+static PT_NOINSTRUMENT void _pallene_tracer_unwind(pt_fnstack_t *fnstack, int idx) {
+#ifdef PT_USDT
+    /* The innermost frame is where an error came from, if it is an error. */
+    pt_frame_t *top = _pallene_tracer_top(fnstack);
+    if(top != NULL)
+        _PALLENE_TRACER_PROBE_FRAME(unwind, top, fnstack->count);
+#endif // PT_USDT
+    _PALLENE_TRACER_EMIT(PALLENE_TRACER_EVENT_UNWIND, fnstack, _pallene_tracer_top(fnstack));
+    if(luai_unlikely(idx < 0)) {
+        fnstack->count = 0;
+        return;
+    }
+
+    /* Remove the Lua frame as well. */
+    fnstack->count = idx;
+    fnstack->top_lua = fnstack->stack[idx].shared.lua.prev;
+}
+
 /* When we encounter a runtime error, `pallene_tracer_frameexit()` may not
    get called. Therefore, the stack will get corrupted if the previous
    call-frames are not removed. The finalizer function makes sure it
    does not happen. Its guardian angel. */
 /* The finalizer function will be called from a to-be-closed value (since
    Lua 5.4). If you are using Lua version prior 5.4, you are outta luck. */
-static int _pallene_tracer_finalizer(lua_State *L) {
-    /* Get the userdata. */
+static PT_NOINSTRUMENT int _pallene_tracer_finalizer(lua_State *L) {
+    /* Get the stack. */
     pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
 
-    /* Remove all the frames until last Lua frame. */
-    int idx = fnstack->count - 1;
-    while(fnstack->stack[idx].type != PALLENE_TRACER_FRAME_TYPE_LUA)
-        idx--;
+    /* Remove all the frames until last Lua frame, which is the one being closed.
+       Lua interface frames entered past the capacity have a finalizer of their own. */
+    _pallene_tracer_unwind(fnstack, fnstack->top_lua);
 
-    /* Remove the Lua frame as well. */
-    fnstack->count = idx;
+    return 0;
+}
+
+/* The finalizer for Lua interface frames entered when the call-stack was full. These
+   frames are not recorded, so the finalizer object itself remembers the depth. */
+static PT_NOINSTRUMENT int _pallene_tracer_overflow_finalizer(lua_State *L) {
+    pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, lua_upvalueindex(1));
+    fnstack->count = *(int *) lua_touserdata(L, 1);
 
     return 0;
 }
 
+#ifdef PT_SHM
+/* The segments left to remove when the process exits, if their Lua states are not
+   closed by then. A slot is claimed (1) before its name is written, and open (2) after. */
+static struct {
+    int state;
+    int pid;            /* A child process after `fork` leaves its parent's alone. */
+    char name[64];
+} _pallene_tracer_shm_segments[PALLENE_TRACER_SHM_SEGMENTS];
+
+static PT_NOINSTRUMENT void _pallene_tracer_shm_atexit(void) {
+    for(int i = 0; i < PALLENE_TRACER_SHM_SEGMENTS; i++)
+        if(__atomic_load_n(&_pallene_tracer_shm_segments[i].state, __ATOMIC_ACQUIRE) == 2
+            && _pallene_tracer_shm_segments[i].pid == (int) getpid())
+            unlink(_pallene_tracer_shm_segments[i].name);
+}
+
+/* Remembers the segment to remove at exit. Without a free slot, only closing its Lua
+   state removes it. */
+static PT_NOINSTRUMENT void _pallene_tracer_shm_remember(const char *name) {
+    static int registered = 0;
+    if(__atomic_exchange_n(&registered, 1, __ATOMIC_ACQ_REL) == 0)
+        atexit(_pallene_tracer_shm_atexit);
+
+    for(int i = 0; i < PALLENE_TRACER_SHM_SEGMENTS; i++) {
+        int expected = 0;
+        if(__atomic_compare_exchange_n(&_pallene_tracer_shm_segments[i].state, &expected, 1,
+            false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            _pallene_tracer_shm_segments[i].pid = (int) getpid();
+            snprintf(_pallene_tracer_shm_segments[i].name,
+                sizeof(_pallene_tracer_shm_segments[i].name), "%s", name);
+            __atomic_store_n(&_pallene_tracer_shm_segments[i].state, 2, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+/* Removes the segment now, and forgets it. */
+static PT_NOINSTRUMENT void _pallene_tracer_shm_remove(const char *name) {
+    unlink(name);
+
+    for(int i = 0; i < PALLENE_TRACER_SHM_SEGMENTS; i++) {
+        int expected = 2;
+        if(__atomic_load_n(&_pallene_tracer_shm_segments[i].state, __ATOMIC_ACQUIRE) == 2
+            && strcmp(_pallene_tracer_shm_segments[i].name, name) == 0
+            && __atomic_compare_exchange_n(&_pallene_tracer_shm_segments[i].state, &expected,
+                1, false, __ATOMIC_ACQ_REL, __ATOMIC_RELAXED)) {
+            _pallene_tracer_shm_segments[i].name[0] = '\0';
+            __atomic_store_n(&_pallene_tracer_shm_segments[i].state, 0, __ATOMIC_RELEASE);
+            return;
+        }
+    }
+}
+
+/* Creates the call-stack in a shared memory segment. Returns NULL if we can't. */
+static PT_NOINSTRUMENT pt_fnstack_t *_pallene_tracer_shm_create(int capacity) {
+    static int serial = 0;
+
+    size_t frames      = (sizeof(pt_shm_header_t) + 63) & ~(size_t) 63;
+    size_t descriptors = frames + (size_t) capacity * sizeof(pt_frame_t);
+    size_t chains      = descriptors + PALLENE_TRACER_SHM_DESCRIPTORS * sizeof(pt_shm_descriptor_t);
+    size_t strings     = chains + PALLENE_TRACER_SHM_CHAINS * sizeof(pt_shm_chain_t);
+    size_t size        = strings + PALLENE_TRACER_SHM_STRINGS;
+
+    /* Other Lua states (or modules) of the process may have segments of their own. */
+    char name[64];
+    int fd = -1;
+    for(int tries = 0; fd < 0 && tries < 64; tries++) {
+        snprintf(name, sizeof(name), "/dev/shm/pallene-tracer.%d.%d", (int) getpid(), serial++);
+        fd = open(name, O_RDWR | O_CREAT | O_EXCL, 0600);
+    }
+
+    if(fd < 0)
+        return NULL;
+
+    void *base = MAP_FAILED;
+    if(ftruncate(fd, (off_t) size) == 0)
+        base = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+
+    if(base == MAP_FAILED) {
+        unlink(name);
+        return NULL;
+    }
+
+    /* The segment is zero-filled. */
+    pt_shm_header_t *shm = (pt_shm_header_t *) base;
+    memcpy(shm->magic, PALLENE_TRACER_SHM_MAGIC, sizeof(PALLENE_TRACER_SHM_MAGIC));
+    shm->version         = PALLENE_TRACER_SHM_VERSION;
+    shm->frame_size      = sizeof(pt_frame_t);
+    shm->size            = (uint32_t) size;
+    shm->pid             = (int32_t) getpid();
+    shm->frames          = (uint32_t) frames;
+    shm->descriptors     = (uint32_t) descriptors;
+    shm->max_descriptors = PALLENE_TRACER_SHM_DESCRIPTORS;
+    shm->chains          = (uint32_t) chains;
+    shm->max_chains      = PALLENE_TRACER_SHM_CHAINS;
+    shm->strings         = (uint32_t) strings;
+    shm->strings_size    = PALLENE_TRACER_SHM_STRINGS;
+    memcpy(shm->name, name, sizeof(name));
+
+    shm->fnstack.stack = (pt_frame_t *) ((char *) base + frames);
+    shm->fnstack.shm = shm;
+    _pallene_tracer_shm_remember(name);
+
+    return &shm->fnstack;
+}
+
+#endif // PT_SHM
+
+/* `PALLENE_TRACER_STORAGE_HEAP` as a `lua_Alloc`. */
+static PT_NOINSTRUMENT void *_pallene_tracer_heap_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void) ud;
+    (void) osize;
+
+    if(nsize == 0) {
+        free(ptr);
+        return NULL;
+    }
+
+    return realloc(ptr, nsize);
+}
+
+#ifdef PT_POOL
+/* A buffer waiting in the pool. Buffers are only reused for the same size, the call-stacks
+   of a host usually have the same capacity. */
+typedef struct pt_pool_node {
+    struct pt_pool_node *next;
+    size_t size;
+} pt_pool_node_t;
+
+/* The buffers cached by a thread, used without locking. */
+typedef struct pt_pool_cache {
+    int count;
+    pt_pool_node_t *nodes[PALLENE_TRACER_POOL_CACHE];
+} pt_pool_cache_t;
+
+static pthread_mutex_t _pallene_tracer_pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_once_t _pallene_tracer_pool_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _pallene_tracer_pool_key;
+
+/* The process-wide list and the totals are guarded by the mutex, except `idle`, which
+   threads update atomically. */
+static pt_pool_node_t *_pallene_tracer_pool_list = NULL;
+static int _pallene_tracer_pool_listed = 0;
+static size_t _pallene_tracer_pool_total = 0;
+static size_t _pallene_tracer_pool_high_water = 0;
+static size_t _pallene_tracer_pool_idle = 0;
+
+/* Past `PALLENE_TRACER_POOL_LIST` buffers, the list is full and the buffer is freed, so
+   the memory of a peak of states goes back once it is over. */
+static PT_NOINSTRUMENT void _pallene_tracer_pool_put(pt_pool_node_t *node) {
+    pthread_mutex_lock(&_pallene_tracer_pool_mutex);
+    if(_pallene_tracer_pool_listed < PALLENE_TRACER_POOL_LIST) {
+        node->next = _pallene_tracer_pool_list;
+        _pallene_tracer_pool_list = node;
+        _pallene_tracer_pool_listed++;
+        node = NULL;
+    } else {
+        _pallene_tracer_pool_total -= node->size;
+        __atomic_sub_fetch(&_pallene_tracer_pool_idle, node->size, __ATOMIC_RELAXED);
+    }
+    pthread_mutex_unlock(&_pallene_tracer_pool_mutex);
+
+    free(node);
+}
+
+/* When a thread exits, its cache goes to the process-wide list. */
+static PT_NOINSTRUMENT void _pallene_tracer_pool_exit(void *data) {
+    pt_pool_cache_t *cache = (pt_pool_cache_t *) data;
+    for(int i = 0; i < cache->count; i++)
+        _pallene_tracer_pool_put(cache->nodes[i]);
+
+    free(cache);
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_pool_key_create(void) {
+    pthread_key_create(&_pallene_tracer_pool_key, _pallene_tracer_pool_exit);
+}
+
+/* The cache of the calling thread, NULL if it cannot have one. */
+static PT_NOINSTRUMENT pt_pool_cache_t *_pallene_tracer_pool_cache(void) {
+    pthread_once(&_pallene_tracer_pool_once, _pallene_tracer_pool_key_create);
+
+    pt_pool_cache_t *cache = (pt_pool_cache_t *) pthread_getspecific(_pallene_tracer_pool_key);
+    if(luai_unlikely(cache == NULL)) {
+        cache = (pt_pool_cache_t *) calloc(1, sizeof(pt_pool_cache_t));
+        if(cache != NULL && pthread_setspecific(_pallene_tracer_pool_key, cache) != 0) {
+            free(cache);
+            cache = NULL;
+        }
+    }
+
+    return cache;
+}
+
+/* Takes a buffer of `size` bytes from the thread cache, then from the list. A new one
+   comes from `malloc`. */
+static PT_NOINSTRUMENT void *_pallene_tracer_pool_get(size_t size) {
+    pt_pool_cache_t *cache = _pallene_tracer_pool_cache();
+    pt_pool_node_t *node = NULL;
+
+    if(cache != NULL) {
+        for(int i = 0; i < cache->count; i++) {
+            if(cache->nodes[i]->size == size) {
+                node = cache->nodes[i];
+                cache->nodes[i] = cache->nodes[--cache->count];
+                break;
+            }
+        }
+    }
+
+    if(node == NULL) {
+        pthread_mutex_lock(&_pallene_tracer_pool_mutex);
+        for(pt_pool_node_t **link = &_pallene_tracer_pool_list; *link != NULL; link = &(*link)->next) {
+            if((*link)->size == size) {
+                node = *link;
+                *link = node->next;
+                _pallene_tracer_pool_listed--;
+                break;
+            }
+        }
+        pthread_mutex_unlock(&_pallene_tracer_pool_mutex);
+    }
+
+    if(node != NULL) {
+        __atomic_sub_fetch(&_pallene_tracer_pool_idle, size, __ATOMIC_RELAXED);
+        return node;
+    }
+
+    void *block = malloc(size < sizeof(pt_pool_node_t) ? sizeof(pt_pool_node_t) : size);
+    if(block != NULL) {
+        pthread_mutex_lock(&_pallene_tracer_pool_mutex);
+        _pallene_tracer_pool_total += size;
+        if(_pallene_tracer_pool_total > _pallene_tracer_pool_high_water)
+            _pallene_tracer_pool_high_water = _pallene_tracer_pool_total;
+        pthread_mutex_unlock(&_pallene_tracer_pool_mutex);
+    }
+
+    return block;
+}
+
+/* Gives a buffer back, to the thread cache while it has room. */
+static PT_NOINSTRUMENT void _pallene_tracer_pool_release(void *block, size_t size) {
+    pt_pool_node_t *node = (pt_pool_node_t *) block;
+    node->size = size;
+    __atomic_add_fetch(&_pallene_tracer_pool_idle, size, __ATOMIC_RELAXED);
+
+    pt_pool_cache_t *cache = _pallene_tracer_pool_cache();
+    if(cache != NULL && cache->count < PALLENE_TRACER_POOL_CACHE)
+        cache->nodes[cache->count++] = node;
+    else _pallene_tracer_pool_put(node);
+}
+
+/* `PALLENE_TRACER_STORAGE_POOL` as a `lua_Alloc`. */
+static PT_NOINSTRUMENT void *_pallene_tracer_pool_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void) ud;
+    void *block = NULL;
+
+    if(nsize > 0) {
+        block = _pallene_tracer_pool_get(nsize);
+        if(block != NULL && ptr != NULL)
+            memcpy(block, ptr, osize < nsize ? osize : nsize);
+    }
+
+    /* A failed reallocation keeps the old buffer. */
+    if(ptr != NULL && (nsize == 0 || block != NULL))
+        _pallene_tracer_pool_release(ptr, osize);
+
+    return block;
+}
+#endif // PT_POOL
+
+#ifdef MAP_ANONYMOUS
+/* `PALLENE_TRACER_STORAGE_MMAP` as a `lua_Alloc`. Pages are only backed once touched, and
+   go back to the system when the state is closed. Blocks under a page come from the heap. */
+static PT_NOINSTRUMENT void *_pallene_tracer_mmap_alloc(void *ud, void *ptr, size_t osize, size_t nsize) {
+    (void) ud;
+    size_t page = (size_t) sysconf(_SC_PAGESIZE);
+    void *block = NULL;
+
+    if(nsize >= page) {
+        block = mmap(NULL, nsize, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if(block == MAP_FAILED)
+            block = NULL;
+    } else if(nsize > 0)
+        block = malloc(nsize);
+
+    if(block != NULL && ptr != NULL)
+        memcpy(block, ptr, osize < nsize ? osize : nsize);
+
+    /* A failed reallocation keeps the old buffer. */
+    if(ptr != NULL && (nsize == 0 || block != NULL)) {
+        if(osize >= page)
+            munmap(ptr, osize);
+        else free(ptr);
+    }
+
+    return block;
+}
+#endif // MAP_ANONYMOUS
+
+/* Allocates the call-stack where the options say. Shared memory, the pool and anonymous
+   pages fall back to the heap if they are not available. */
+static PT_NOINSTRUMENT pt_fnstack_t *_pallene_tracer_alloc(lua_State *L, const pt_options_t *options) {
+#ifdef PT_SHM
+    if(options->storage == PALLENE_TRACER_STORAGE_SHM) {
+        pt_fnstack_t *shared = _pallene_tracer_shm_create(options->capacity);
+        if(shared != NULL) {
+            shared->alloc = NULL;
+            return shared;
+        }
+    }
+#endif // PT_SHM
+
+    lua_Alloc alloc = _pallene_tracer_heap_alloc;
+    void *ud = NULL;
+#ifdef PT_POOL
+    if(options->storage == PALLENE_TRACER_STORAGE_POOL)
+        alloc = _pallene_tracer_pool_alloc;
+#endif // PT_POOL
+#ifdef MAP_ANONYMOUS
+    if(options->storage == PALLENE_TRACER_STORAGE_MMAP)
+        alloc = _pallene_tracer_mmap_alloc;
+#endif // MAP_ANONYMOUS
+    if(options->storage == PALLENE_TRACER_STORAGE_ALLOCATOR) {
+        alloc = options->alloc;
+        ud = options->alloc_ud;
+        if(alloc == NULL)
+            alloc = lua_getallocf(L, &ud);
+    }
+
+    pt_fnstack_t *fnstack = (pt_fnstack_t *) alloc(ud, NULL, 0, sizeof(pt_fnstack_t));
+    pt_frame_t *stack = fnstack == NULL ? NULL
+        : (pt_frame_t *) alloc(ud, NULL, 0, options->capacity * sizeof(pt_frame_t));
+    if(stack == NULL) {
+        if(fnstack != NULL)
+            alloc(ud, fnstack, sizeof(pt_fnstack_t), 0);
+        luaL_error(L, "Pallene Tracer could not allocate the call-stack (%d frames)",
+            options->capacity);
+    }
+
+    fnstack->stack = stack;
+    fnstack->shm = NULL;
+    fnstack->alloc = alloc;
+    fnstack->alloc_ud = ud;
+
+    return fnstack;
+}
+
+/* Applies the options of a module to the call-stack created by another one. */
+static PT_NOINSTRUMENT void _pallene_tracer_reconcile(pt_fnstack_t *fnstack, const pt_options_t *options) {
+    /* The strictest overflow policy wins. */
+    if(options->overflow == PALLENE_TRACER_OVERFLOW_ERROR)
+        fnstack->overflow = PALLENE_TRACER_OVERFLOW_ERROR;
+
+    /* The stack only grows, and only while no frame would move. Otherwise the frames past
+       the capacity are counted only, which is safe. */
+    if(options->capacity > fnstack->capacity && fnstack->count == 0 && fnstack->alloc != NULL) {
+        pt_frame_t *stack = (pt_frame_t *) fnstack->alloc(fnstack->alloc_ud, fnstack->stack,
+            fnstack->capacity * sizeof(pt_frame_t), options->capacity * sizeof(pt_frame_t));
+        if(stack != NULL) {
+            fnstack->stack = stack;
+            fnstack->capacity = options->capacity;
+        }
+    }
+}
+
+#ifdef PT_INSTRUMENT
+/* The call-stack the `-finstrument-functions` hooks of this thread push to, and under
+   which id it was opened. */
+typedef struct pt_instrumented {
+    pt_fnstack_t *fnstack;
+    unsigned long id;
+    unsigned long generation;    /* Of the open call-stacks, when `fnstack` was checked. */
+} pt_instrumented_t;
+
+static __thread pt_instrumented_t _pallene_tracer_instrumented;
+
+/* The call-stacks some thread pushes to. Closing one bumps the generation: the other
+   threads then check theirs is still open, by id, as the address may be reused. */
+static struct {
+    pt_fnstack_t *fnstack;
+    unsigned long id;
+} _pallene_tracer_instrumented_open[PALLENE_TRACER_INSTRUMENTED_STACKS];
+static unsigned long _pallene_tracer_instrumented_ids = 0;
+static unsigned long _pallene_tracer_instrumented_generation = 0;
+static pthread_mutex_t _pallene_tracer_instrumented_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/* The call-stack of this thread, NULL if there is none or it was closed. */
+static inline PT_NOINSTRUMENT pt_fnstack_t *_pallene_tracer_instrumented_stack(void) {
+    pt_instrumented_t *current = &_pallene_tracer_instrumented;
+    unsigned long generation = __atomic_load_n(&_pallene_tracer_instrumented_generation,
+        __ATOMIC_ACQUIRE);
+
+    if(current->fnstack != NULL && luai_unlikely(current->generation != generation)) {
+        pt_fnstack_t *fnstack = current->fnstack;
+        current->fnstack = NULL;
+
+        pthread_mutex_lock(&_pallene_tracer_instrumented_mutex);
+        current->generation = _pallene_tracer_instrumented_generation;
+        for(int i = 0; i < PALLENE_TRACER_INSTRUMENTED_STACKS; i++)
+            if(_pallene_tracer_instrumented_open[i].fnstack == fnstack
+                && _pallene_tracer_instrumented_open[i].id == current->id)
+                current->fnstack = fnstack;
+        pthread_mutex_unlock(&_pallene_tracer_instrumented_mutex);
+    }
+
+    return current->fnstack;
+}
+
+/* Makes the call-stack the one of this thread, if it has none. */
+static PT_NOINSTRUMENT void _pallene_tracer_instrumented_adopt(pt_fnstack_t *fnstack) {
+    if(_pallene_tracer_instrumented_stack() != NULL)
+        return;
+
+    pthread_mutex_lock(&_pallene_tracer_instrumented_mutex);
+    for(int i = 0; i < PALLENE_TRACER_INSTRUMENTED_STACKS; i++) {
+        if(_pallene_tracer_instrumented_open[i].fnstack == NULL) {
+            _pallene_tracer_instrumented_open[i].fnstack = fnstack;
+            _pallene_tracer_instrumented_open[i].id = ++_pallene_tracer_instrumented_ids;
+
+            _pallene_tracer_instrumented.fnstack = fnstack;
+            _pallene_tracer_instrumented.id = _pallene_tracer_instrumented_ids;
+            _pallene_tracer_instrumented.generation = _pallene_tracer_instrumented_generation;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&_pallene_tracer_instrumented_mutex);
+}
+
+/* Forgets the call-stack before it is freed, whichever thread pushes to it. */
+static PT_NOINSTRUMENT void _pallene_tracer_instrumented_close(pt_fnstack_t *fnstack) {
+    pthread_mutex_lock(&_pallene_tracer_instrumented_mutex);
+    for(int i = 0; i < PALLENE_TRACER_INSTRUMENTED_STACKS; i++) {
+        if(_pallene_tracer_instrumented_open[i].fnstack == fnstack) {
+            _pallene_tracer_instrumented_open[i].fnstack = NULL;
+            __atomic_add_fetch(&_pallene_tracer_instrumented_generation, 1, __ATOMIC_RELEASE);
+        }
+    }
+    pthread_mutex_unlock(&_pallene_tracer_instrumented_mutex);
+
+    if(_pallene_tracer_instrumented.fnstack == fnstack)
+        _pallene_tracer_instrumented.fnstack = NULL;
+}
+#endif // PT_INSTRUMENT
+
 /* Frees the heap-allocated resources. */
 /* This function will be used as `__gc` metamethod to free our stack. */
-static int _pallene_tracer_free_resources(lua_State *L) {
-    pt_fnstack_t *fnstack = (pt_fnstack_t *) lua_touserdata(L, 1);
-    free(fnstack->stack);
+static PT_NOINSTRUMENT int _pallene_tracer_free_resources(lua_State *L) {
+    pt_fnstack_t *fnstack = *(pt_fnstack_t **) lua_touserdata(L, 1);
+
+#ifdef PT_INSTRUMENT
+    _pallene_tracer_instrumented_close(fnstack);
+#endif // PT_INSTRUMENT
+
+#ifdef PT_SHM
+    if(fnstack->shm != NULL) {
+        pt_shm_header_t *shm = fnstack->shm;
+        _pallene_tracer_shm_remove(shm->name);
+        munmap(shm, shm->size);
+        return 0;
+    }
+#endif // PT_SHM
+
+    lua_Alloc alloc = fnstack->alloc;
+    void *ud = fnstack->alloc_ud;
+    alloc(ud, fnstack->stack, fnstack->capacity * sizeof(pt_frame_t), 0);
+    alloc(ud, fnstack, sizeof(pt_fnstack_t), 0);
 
     return 0;
 }
@@ -257,18 +1927,41 @@ static int _pallene_tracer_free_resources(lua_State *L) {
    everytime you are in a Lua C function using `lua_toclose(L, idx)`. */
 /* ALSO NOTE: The stack and finalizer object would be returned if and only if `PT_DEBUG`
    is set. Otherwise, a NULL pointer would be returned alongside a NIL value pushed onto the stack. */
-pt_fnstack_t *pallene_tracer_init(lua_State *L) {
+/* The name is parenthesized, it may be a macro (`PT_SHM`). */
+PT_NOINSTRUMENT pt_fnstack_t *(pallene_tracer_init)(lua_State *L) {
+    return (pallene_tracer_init_ex)(L, NULL);
+}
+
+/* Same as `pallene_tracer_init`, with options for the call-stack. NULL options take the
+   defaults if the call-stack is created, and leave an existing one as it is. */
+PT_NOINSTRUMENT pt_fnstack_t *(pallene_tracer_init_ex)(lua_State *L, const pt_options_t *options) {
 #ifdef PT_DEBUG
     pt_fnstack_t *fnstack = NULL;
+    const pt_options_t defaults = PALLENE_TRACER_DEFAULT_OPTIONS;
+
+    if(options != NULL && options->capacity < 1)
+        luaL_error(L, "Pallene Tracer call-stack capacity must be positive, got %d",
+            options->capacity);
 
     /* Try getting the userdata. */
     lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
 
     /* If we don't find any userdata, initialize resources. */
+    /* The userdata holds a pointer to the stack, which may live in shared memory. */
     if(luai_unlikely(lua_isnil(L, -1) == 1)) {
-        fnstack = (pt_fnstack_t *) lua_newuserdata(L, sizeof(pt_fnstack_t));
-        fnstack->stack = malloc(PALLENE_TRACER_MAX_CALLSTACK * sizeof(pt_frame_t));
+        if(options == NULL)
+            options = &defaults;
+
+        pt_fnstack_t **container = (pt_fnstack_t **) lua_newuserdatauv(L, sizeof(pt_fnstack_t *), 0);
+        fnstack = *container = _pallene_tracer_alloc(L, options);
         fnstack->count = 0;
+        fnstack->capacity = options->capacity;
+        fnstack->overflow = options->overflow;
+        fnstack->top_lua = -1;
+        fnstack->lua_calls = 0;
+        fnstack->context = 0;
+        fnstack->budget.ticks = 0;
+        fnstack->hook_lua = false;
 
         /* Prepare the `__gc` finalizer to free the stack. */
         lua_newtable(L);
@@ -279,34 +1972,1985 @@ pt_fnstack_t *pallene_tracer_init(lua_State *L) {
         /* This is our finalizer which will reside in the value stack. */
         lua_newtable(L);
         lua_newtable(L);
-        lua_pushvalue(L, -3);
+        lua_pushlightuserdata(L, fnstack);
 
         /* Our finalizer fn. */
         lua_pushcclosure(L, _pallene_tracer_finalizer, 1);
         lua_setfield(L, -2, "__close");
         lua_setmetatable(L, -2);
 
-        /* Set finalizer object to registry. */
+        /* Set finalizer object to registry, also at an integer key for
+           `PALLENE_TRACER_REGISTRY_FINALIZER`, which is faster to look up. */
+        lua_pushvalue(L, -1);
+        fnstack->finalizer = luaL_ref(L, LUA_REGISTRYINDEX);
         lua_setfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
 
-        /* Set stack function stack container to registry .*/
+        /* Metatable for the finalizer objects of frames which do not fit in the stack. */
+        lua_newtable(L);
+        lua_pushlightuserdata(L, fnstack);
+        lua_pushcclosure(L, _pallene_tracer_overflow_finalizer, 1);
+        lua_setfield(L, -2, "__close");
+        lua_setfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_OVERFLOW_ENTRY);
+
+#ifdef PT_INSTRUMENT
+        /* The hooks have no Lua state. They use the first call-stack the thread creates. */
+        _pallene_tracer_instrumented_adopt(fnstack);
+#endif // PT_INSTRUMENT
+
+        /* Set stack function stack container to registry .*/
         lua_setfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
 
         /* Push the finalizer object in the stack. */
         lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
     } else {
-        fnstack = lua_touserdata(L, -1);
+        fnstack = *(pt_fnstack_t **) lua_touserdata(L, -1);
+        if(options != NULL)
+            _pallene_tracer_reconcile(fnstack, options);
         lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_FINALIZER_ENTRY);
     }
 
     return fnstack;
 #else
     /* No debug mode, no stack and finalizer object. Regardless we need to fill in the blanks. */
+    (void) options;
     lua_pushnil(L);
     return NULL;
 #endif // PT_DEBUG
 }
 
+/* Handles a Lua interface frame which does not fit in the call-stack. Either raises
+   an error or counts the frame, according to the overflow policy. */
+/* Not to be called directly. Used by `PALLENE_TRACER_LUA_FRAMEENTER`. */
+PT_NOINSTRUMENT void pallene_tracer_overflow(lua_State *L, pt_fnstack_t *fnstack) {
+    if(fnstack->overflow == PALLENE_TRACER_OVERFLOW_ERROR)
+        luaL_error(L, "Pallene Tracer call-stack overflow (more than %d frames)",
+            fnstack->capacity);
+
+    /* Remember the depth to restore when this frame goes out of scope. */
+    int *depth = (int *) lua_newuserdatauv(L, sizeof(int), 0);
+    *depth = fnstack->count;
+    luaL_setmetatable(L, PALLENE_TRACER_OVERFLOW_ENTRY);
+    lua_toclose(L, -1);
+
+    fnstack->count++;
+}
+
+/* Seconds of a monotonic clock. Without POSIX, processor time is the best C offers. */
+static PT_NOINSTRUMENT double _pallene_tracer_clock(void) {
+#ifdef CLOCK_MONOTONIC
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double) ts.tv_sec + (double) ts.tv_nsec * 1e-9;
+#else
+    return (double) clock() / CLOCKS_PER_SEC;
+#endif // CLOCK_MONOTONIC
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_hook(lua_State *L, lua_Debug *ar);
+
+/* Sets the hook of `L` for what is asked of it: a count hook for the budget, a call hook
+   for `pallene_tracer_hook_lua`. Removes it if nothing is. */
+static PT_NOINSTRUMENT void _pallene_tracer_sethook(lua_State *L, pt_fnstack_t *fnstack) {
+    int mask = (fnstack->budget.ticks != 0 ? LUA_MASKCOUNT : 0)
+        | (fnstack->hook_lua ? LUA_MASKCALL | LUA_MASKRET : 0);
+
+    if(mask != 0)
+        lua_sethook(L, _pallene_tracer_hook, mask, PALLENE_TRACER_BUDGET_INTERVAL);
+    else if(lua_gethook(L) == _pallene_tracer_hook)
+        lua_sethook(L, NULL, 0, 0);
+}
+
+/* How many calls are on the stack of `L`. `lua_getstack` walks them from the top, so
+   the search starts from a guess, the depth of the last hooked call of `L`. */
+static PT_NOINSTRUMENT int _pallene_tracer_stack_depth(lua_State *L, int guess) {
+    lua_Debug ar;
+    int low = 0, high = 1;    /* Levels below `low` exist, level `high` does not. */
+
+    if(guess > 0 && lua_getstack(L, guess - 1, &ar)) {
+        if(!lua_getstack(L, guess, &ar))
+            return guess;
+        low = guess + 1;
+        high = 2 * guess + 1;
+    } else if(guess > 1)
+        high = guess - 1;
+
+    while(lua_getstack(L, high, &ar)) {
+        low = high + 1;
+        high = 2 * high + 1;
+    }
+    while(low < high) {
+        int mid = low + (high - low) / 2;
+        if(lua_getstack(L, mid, &ar))
+            low = mid + 1;
+        else high = mid;
+    }
+
+    return low;
+}
+
+/* The depth of the topmost hooked call of `L`, 0 if none. Only the hooked frames on top
+   are looked at: the hook never pops any other. */
+static PT_NOINSTRUMENT int _pallene_tracer_hooked_depth(pt_fnstack_t *fnstack, lua_State *L) {
+    if(fnstack->count > fnstack->capacity)
+        return 0;
+
+    for(int index = fnstack->count - 1;
+        index >= 0 && fnstack->stack[index].type == PALLENE_TRACER_FRAME_TYPE_HOOKED; index--)
+        if(fnstack->stack[index].shared.hooked.L == L)
+            return fnstack->stack[index].shared.hooked.depth;
+
+    return 0;
+}
+
+/* Index of the first hooked frame on top which is gone when a call of `L` at `depth` is
+   entered or left, or -1. Those of calls of `L` as deep or deeper are, and the ones above
+   them. Above the frame of a call of `L` less deep, the frames of other threads are gone
+   too: they are those of a coroutine which yielded or failed. */
+static PT_NOINSTRUMENT int _pallene_tracer_hooked_gone(pt_fnstack_t *fnstack, lua_State *L, int depth) {
+    int gone = -1;
+    if(fnstack->count > fnstack->capacity)
+        return -1;
+
+    for(int index = fnstack->count - 1;
+        index >= 0 && fnstack->stack[index].type == PALLENE_TRACER_FRAME_TYPE_HOOKED; index--) {
+        const pt_frame_t *frame = &fnstack->stack[index];
+
+        if(frame->shared.hooked.L != L)
+            continue;
+        if(frame->shared.hooked.depth < depth)
+            return index + 1;
+        gone = index;
+    }
+
+    return gone;
+}
+
+/* The descriptor of the Lua function of `ar`, made the first time it is called. They are
+   kept in the registry, by source and by the line the function is defined at. */
+static PT_NOINSTRUMENT const pt_fn_details_t *_pallene_tracer_hooked_details(lua_State *L,
+    pt_fnstack_t *fnstack, lua_Debug *ar) {
+    lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_HOOKED_ENTRY);
+    if(lua_rawgetp(L, -1, ar->source) == LUA_TNIL) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_rawsetp(L, -3, ar->source);
+    }
+
+    const pt_fn_details_t *details = NULL;
+    if(lua_rawgeti(L, -1, ar->linedefined) != LUA_TNIL) {
+        details = (const pt_fn_details_t *) lua_touserdata(L, -1);
+        lua_pop(L, 3);
+        return details;
+    }
+    lua_pop(L, 1);
+
+    /* Named after the first call, as tracebacks name Lua functions. */
+    lua_getinfo(L, "n", ar);
+    if(ar->name != NULL)
+        lua_pushstring(L, ar->name);
+    else if(*ar->what == 'm')
+        lua_pushliteral(L, "<main>");
+    else lua_pushfstring(L, "<%s:%d>", ar->short_src, ar->linedefined);
+
+    /* The strings follow the descriptor in the same userdata. */
+    size_t name_len = strlen(lua_tostring(L, -1)) + 1, file_len = strlen(ar->short_src) + 1;
+    char *strings = (char *) lua_newuserdatauv(L, sizeof(pt_fn_details_t) + name_len + file_len, 0);
+    const pt_fn_details_t made = { strings + sizeof(pt_fn_details_t),
+        strings + sizeof(pt_fn_details_t) + name_len };
+    memcpy((char *) made.fn_name, lua_tostring(L, -2), name_len);
+    memcpy((char *) made.filename, ar->short_src, file_len);
+    memcpy(strings, &made, sizeof(made));
+    details = (const pt_fn_details_t *) strings;
+    lua_rawseti(L, -3, ar->linedefined);
+
+#ifdef PT_SHM
+    /* The file name is published once per source, kept at index -1. */
+    if(fnstack->shm != NULL) {
+        if(lua_rawgeti(L, -2, -1) == LUA_TNIL) {
+            lua_pushinteger(L, _pallene_tracer_shm_string(fnstack->shm, details->filename));
+            lua_rawseti(L, -4, -1);
+            lua_rawgeti(L, -3, -1);
+        }
+        _pallene_tracer_shm_describe(fnstack->shm, details, (uint32_t) lua_tointeger(L, -1));
+        lua_pop(L, 1);
+    }
+#else
+    (void) fnstack;
+#endif // PT_SHM
+
+    lua_pop(L, 3);
+    return details;
+}
+
+/* The hook of `pallene_tracer_budget` and `pallene_tracer_hook_lua`. The count hook
+   removes itself once the budget is gone. */
+static PT_NOINSTRUMENT void _pallene_tracer_hook(lua_State *L, lua_Debug *ar) {
+    lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY);
+    pt_fnstack_t *fnstack = *(pt_fnstack_t **) lua_touserdata(L, -1);
+    lua_pop(L, 1);
+
+    if(ar->event == LUA_HOOKCOUNT) {
+        if(fnstack->budget.ticks == 0)
+            _pallene_tracer_sethook(L, fnstack);
+        else pallene_tracer_budget_charge(L, fnstack, PALLENE_TRACER_BUDGET_INTERVAL);
+        return;
+    }
+
+    /* Calls return through here, but errors skip the hook: the frames of calls as deep
+       as this one or deeper were left behind by them, or by the caller a tail call
+       replaces. A call is one deeper than the last hooked call, if that is its caller. */
+    int depth = _pallene_tracer_stack_depth(L,
+        _pallene_tracer_hooked_depth(fnstack, L) + (ar->event == LUA_HOOKCALL));
+    int keep = _pallene_tracer_hooked_gone(fnstack, L, depth);
+    while(keep >= 0 && fnstack->count > keep)
+        pallene_tracer_frameexit(fnstack);
+
+    if(ar->event == LUA_HOOKRET || !fnstack->hook_lua)
+        return;
+
+    /* C functions are recorded by their own frames, if at all. */
+    lua_getinfo(L, "S", ar);
+    if(*ar->what == 'C' || fnstack->count >= fnstack->capacity)
+        return;
+
+    pt_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.type = PALLENE_TRACER_FRAME_TYPE_HOOKED;
+    frame.line = ar->linedefined;
+    frame.shared.hooked.details = _pallene_tracer_hooked_details(L, fnstack, ar);
+    frame.shared.hooked.L = L;
+    frame.shared.hooked.depth = depth;
+    pallene_tracer_frameenter(fnstack, &frame);
+}
+
+/* Records the Lua functions called on `L` as hooked frames, or stops doing so. */
+PT_NOINSTRUMENT void pallene_tracer_hook_lua(lua_State *L, pt_fnstack_t *fnstack, bool enable) {
+    if(enable && lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_HOOKED_ENTRY) == LUA_TNIL) {
+        lua_newtable(L);
+        lua_setfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_HOOKED_ENTRY);
+    }
+    if(enable)
+        lua_pop(L, 1);
+
+    fnstack->hook_lua = enable;
+    _pallene_tracer_sethook(L, fnstack);
+}
+
+/* The descriptor of the frames of a trampoline, and what it calls. Its name follows. */
+typedef struct pt_trampoline {
+    const pt_fn_details_t details;
+    lua_CFunction fn;
+    pt_fnstack_t *fnstack;
+} pt_trampoline_t;
+
+/* The trampoline of a closure of `_pallene_tracer_trampoline`, its last upvalue. */
+static PT_NOINSTRUMENT const pt_trampoline_t *_pallene_tracer_trampoline_get(lua_State *L) {
+    int up = 1;
+    while(lua_type(L, lua_upvalueindex(up + 1)) != LUA_TNONE)
+        up++;
+
+    return (const pt_trampoline_t *) lua_touserdata(L, lua_upvalueindex(up));
+}
+
+/* Calls the function in the call of the trampoline, whose upvalues are those of the
+   function followed by the trampoline: the function sees its stack, its upvalues and its
+   caller as before, so it behaves, errors included, as it does unwrapped. The frames are
+   removed when it returns. A Lua error or a yield leaves them behind, and the next
+   trampoline called from as deep or deeper in the C stack removes them. */
+static PT_NOINSTRUMENT int _pallene_tracer_trampoline(lua_State *L) {
+    const pt_trampoline_t *trampoline = _pallene_tracer_trampoline_get(L);
+    pt_fnstack_t *fnstack = trampoline->fnstack;
+    uintptr_t sp = (uintptr_t) __builtin_frame_address(0);
+
+    pt_frame_t *top;
+    while((top = _pallene_tracer_top(fnstack)) != NULL && top->type == PALLENE_TRACER_FRAME_TYPE_C
+        && top->shared.trampoline.sp != 0 && top->shared.trampoline.sp <= sp
+        && fnstack->top_lua == fnstack->count - 2)
+        _pallene_tracer_unwind(fnstack, fnstack->top_lua);
+
+    if(luai_unlikely(fnstack->count + 2 > fnstack->capacity))
+        return trampoline->fn(L);    /* No room, the call is not recorded. */
+
+    pt_frame_t frame;
+    memset(&frame, 0, sizeof(frame));
+    frame.type = PALLENE_TRACER_FRAME_TYPE_LUA;
+    frame.shared.lua.fnptr = trampoline->fn;
+    pallene_tracer_frameenter(fnstack, &frame);
+    int idx = fnstack->top_lua;
+    fnstack->stack[idx].shared.lua.L = L;
+
+    memset(&frame, 0, sizeof(frame));
+    frame.type = PALLENE_TRACER_FRAME_TYPE_C;
+    frame.shared.trampoline.details = &trampoline->details;
+    frame.shared.trampoline.sp = sp;
+    pallene_tracer_frameenter(fnstack, &frame);
+
+    int results = trampoline->fn(L);
+    _pallene_tracer_unwind(fnstack, idx);
+
+    return results;
+}
+
+/* The call-stack of `L`, created if there is none. NULL without `PT_DEBUG`. */
+static PT_NOINSTRUMENT pt_fnstack_t *_pallene_tracer_trampoline_fnstack(lua_State *L) {
+    pt_fnstack_t *fnstack = NULL;
+
+    if(lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_CONTAINER_ENTRY) == LUA_TUSERDATA)
+        fnstack = *(pt_fnstack_t **) lua_touserdata(L, -1);
+    else {
+        fnstack = (pallene_tracer_init)(L);
+        lua_pop(L, 1);    /* The finalizer object. */
+    }
+    lua_pop(L, 1);
+
+    return fnstack;
+}
+
+/* Replaces the C function on top of the stack with its trampoline. A function with as
+   many upvalues as a closure can have is left as it is. */
+static PT_NOINSTRUMENT void _pallene_tracer_trampoline_push(lua_State *L, pt_fnstack_t *fnstack,
+    const char *libname, const char *name) {
+    int nup = 0;
+    luaL_checkstack(L, 256, "too many upvalues");
+    while(lua_getupvalue(L, -(nup + 1), nup + 1) != NULL)
+        nup++;
+    if(nup == 255) {
+        lua_pop(L, nup);
+        return;
+    }
+
+    size_t size = (libname != NULL ? strlen(libname) + 1 : 0) + strlen(name) + 1;
+    pt_trampoline_t *trampoline = (pt_trampoline_t *) lua_newuserdatauv(L, sizeof(pt_trampoline_t) + size, 0);
+    char *fn_name = (char *) (trampoline + 1);
+
+    if(libname != NULL)
+        snprintf(fn_name, size, "%s.%s", libname, name);
+    else
+        memcpy(fn_name, name, size);
+
+    /* Untraced C functions read "C: in function" in tracebacks, so do these. */
+    const pt_fn_details_t details = { fn_name, "C" };
+    memcpy((void *) &trampoline->details, &details, sizeof(details));
+    trampoline->fn = lua_tocfunction(L, -(nup + 2));
+    trampoline->fnstack = fnstack;
+
+#ifdef PT_SHM
+    if(fnstack->shm != NULL)
+        _pallene_tracer_shm_describe(fnstack->shm, &trampoline->details,
+            _pallene_tracer_shm_string(fnstack->shm, details.filename));
+#endif // PT_SHM
+
+    /* Frames and sinks may keep the descriptor after the closure is gone. */
+    if(lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_TRAMPOLINES_ENTRY) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        lua_newtable(L);
+        lua_pushvalue(L, -1);
+        lua_setfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_TRAMPOLINES_ENTRY);
+    }
+    lua_pushvalue(L, -2);
+    lua_rawseti(L, -2, (lua_Integer) lua_rawlen(L, -2) + 1);
+    lua_pop(L, 1);
+
+    lua_pushcclosure(L, _pallene_tracer_trampoline, nup + 1);
+    lua_replace(L, -2);
+}
+
+/* Follows `luaL_setfuncs`: NULL functions are placeholders, set to false. */
+PT_NOINSTRUMENT void pallene_tracer_setfuncs(lua_State *L, const char *libname, const luaL_Reg *l, int nup) {
+    pt_fnstack_t *fnstack = _pallene_tracer_trampoline_fnstack(L);
+
+    luaL_checkstack(L, nup + 2, "too many upvalues");
+    for(; l->name != NULL; l++) {
+        if(l->func == NULL)
+            lua_pushboolean(L, 0);
+        else {
+            for(int i = 0; i < nup; i++)
+                lua_pushvalue(L, -nup);
+            lua_pushcclosure(L, l->func, nup);
+
+            if(fnstack != NULL)
+                _pallene_tracer_trampoline_push(L, fnstack, libname, l->name);
+        }
+        lua_setfield(L, -(nup + 2), l->name);
+    }
+    lua_pop(L, nup);
+}
+
+/* Fields are only replaced, which `lua_next` allows. */
+PT_NOINSTRUMENT int pallene_tracer_wrap(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TTABLE);
+    const char *libname = luaL_optstring(L, 2, NULL);
+    pt_fnstack_t *fnstack = _pallene_tracer_trampoline_fnstack(L);
+    lua_settop(L, 1);
+
+    lua_pushnil(L);
+    while(fnstack != NULL && lua_next(L, 1) != 0) {
+        lua_CFunction fn = lua_tocfunction(L, -1);
+
+        if(lua_type(L, -2) == LUA_TSTRING && fn != NULL && fn != _pallene_tracer_trampoline) {
+            lua_pushvalue(L, -2);
+            lua_pushvalue(L, -2);
+            _pallene_tracer_trampoline_push(L, fnstack, libname, lua_tostring(L, -2));
+            lua_rawset(L, 1);
+        }
+        lua_pop(L, 1);
+    }
+
+    return 1;
+}
+
+/* Sets a budget for the calls that follow on `L`. Both limits zero removes it. */
+PT_NOINSTRUMENT void pallene_tracer_budget(lua_State *L, pt_fnstack_t *fnstack,
+    unsigned long long steps, double seconds) {
+    fnstack->budget.steps = steps;
+    fnstack->budget.deadline = seconds > 0 ? _pallene_tracer_clock() + seconds : 0;
+
+    fnstack->budget.ticks = steps == 0 && seconds <= 0 ? 0 : PALLENE_TRACER_BUDGET_INTERVAL;
+    _pallene_tracer_sethook(L, fnstack);
+}
+
+/* Charges `steps` to the budget, raising the error if it ran out. */
+PT_NOINSTRUMENT void pallene_tracer_budget_charge(lua_State *L, pt_fnstack_t *fnstack,
+    unsigned long long steps) {
+    pt_budget_t *budget = &fnstack->budget;
+    const char *exceeded = NULL;
+
+    if(budget->steps != 0 && budget->steps <= steps)
+        exceeded = "steps";
+    else if(budget->deadline != 0 && _pallene_tracer_clock() >= budget->deadline)
+        exceeded = "time";
+
+    /* Remove the budget first, so the error handlers can run. */
+    if(exceeded != NULL) {
+        pallene_tracer_budget(L, fnstack, 0, 0);
+        luaL_error(L, "Pallene Tracer budget exceeded (%s)", exceeded);
+    }
+
+    if(budget->steps != 0)
+        budget->steps -= steps;
+    if(budget->ticks == 0)
+        budget->ticks = PALLENE_TRACER_BUDGET_INTERVAL;
+}
+
+#ifdef PT_COUNTERS
+/* Returns the calls of the functions of the modules registered in the Lua state, and
+   resets them. Functions of the same name are summed. */
+PT_NOINSTRUMENT int pallene_tracer_stats(lua_State *L) {
+    lua_newtable(L);
+    if(lua_getfield(L, LUA_REGISTRYINDEX, PALLENE_TRACER_COUNTERS_ENTRY) != LUA_TTABLE) {
+        lua_pop(L, 1);
+        return 1;
+    }
+
+    lua_pushnil(L);
+    while(lua_next(L, -2) != 0) {
+        pt_counter_t *counter = (pt_counter_t *) lua_touserdata(L, -2);
+        pt_counter_t *last = (pt_counter_t *) lua_touserdata(L, -1);
+        lua_pop(L, 1);
+
+        for(; counter < last; counter++) {
+            size_t calls = counter->calls;
+            if(calls == 0)
+                continue;
+            counter->calls = 0;
+
+            lua_Integer sum = lua_getfield(L, -3, counter->details->fn_name) == LUA_TNUMBER
+                ? lua_tointeger(L, -1) : 0;
+            lua_pop(L, 1);
+            lua_pushinteger(L, sum + (lua_Integer) calls);
+            lua_setfield(L, -4, counter->details->fn_name);
+        }
+    }
+
+    lua_pop(L, 1);
+    return 1;
+}
+#endif // PT_COUNTERS
+
+#ifdef PT_PERF
+#define _PALLENE_TRACER_PERF_EVENTS    4
+#define _PALLENE_TRACER_PERF_CACHE     256
+
+/* The counters measured with, decided by the first selection, for every thread. */
+typedef enum pt_perf_mode {
+    PALLENE_TRACER_PERF_NONE,
+    PALLENE_TRACER_PERF_HARDWARE,
+    PALLENE_TRACER_PERF_SOFTWARE
+} pt_perf_mode_t;
+
+static const char *const _pallene_tracer_perf_modes[] = { "none", "hardware", "software" };
+
+/* The events of each mode, by the names they are reported with. */
+static const struct {
+    uint32_t type;
+    uint64_t config;
+    const char *name;
+} _pallene_tracer_perf_events[2][_PALLENE_TRACER_PERF_EVENTS] = {
+    { { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES,       "cycles" },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS,     "instructions" },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES,     "cache_misses" },
+      { PERF_TYPE_HARDWARE, PERF_COUNT_HW_BRANCH_MISSES,    "branch_misses" } },
+    { { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK,       "task_clock" },
+      { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS,      "page_faults" },
+      { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES, "context_switches" },
+      { PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS,   "cpu_migrations" } }
+};
+
+/* A measured frame: where it is in which call-stack, and the counters when it was
+   entered. */
+typedef struct pt_perf_entry {
+    const pt_fnstack_t *fnstack;
+    int depth;
+    int slot;
+    uint64_t values[_PALLENE_TRACER_PERF_EVENTS];
+} pt_perf_entry_t;
+
+/* The counters of a thread, and the frames it is measuring. */
+typedef struct pt_perf_thread {
+    int fds[_PALLENE_TRACER_PERF_EVENTS];                        /* -1 if not open. */
+    struct perf_event_mmap_page *pages[_PALLENE_TRACER_PERF_EVENTS];  /* NULL if not mapped. */
+
+    /* Slots of the descriptors seen, for the selection of `generation`. */
+    unsigned int generation;
+    struct {
+        const pt_fn_details_t *details;
+        int slot;
+    } cache[_PALLENE_TRACER_PERF_CACHE];
+
+    int count;
+    pt_perf_entry_t entries[PALLENE_TRACER_PERF_DEPTH];
+} pt_perf_thread_t;
+
+static pthread_once_t _pallene_tracer_perf_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _pallene_tracer_perf_key;
+
+/* The selection. Totals are added to atomically by the threads. */
+static pt_perf_mode_t _pallene_tracer_perf_mode = PALLENE_TRACER_PERF_NONE;
+static bool _pallene_tracer_perf_probed = false;
+static unsigned int _pallene_tracer_perf_generation = 1;
+static int _pallene_tracer_perf_fns = 0;
+static char *_pallene_tracer_perf_names[PALLENE_TRACER_PERF_MAX_FNS];
+static struct {
+    uint64_t calls;
+    uint64_t values[_PALLENE_TRACER_PERF_EVENTS];
+} _pallene_tracer_perf_totals[PALLENE_TRACER_PERF_MAX_FNS];
+
+static PT_NOINSTRUMENT void _pallene_tracer_perf_close(pt_perf_thread_t *thread) {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for(int i = _PALLENE_TRACER_PERF_EVENTS - 1; i >= 0; i--) {
+        if(thread->pages[i] != NULL)
+            munmap(thread->pages[i], (size_t) page_size);
+        if(thread->fds[i] >= 0)
+            close(thread->fds[i]);
+        thread->pages[i] = NULL;
+        thread->fds[i] = -1;
+    }
+}
+
+/* Opens the events of `mode` for the calling thread, as a group read at once. Mapping
+   them is only needed for `rdpmc`. */
+static PT_NOINSTRUMENT bool _pallene_tracer_perf_open(pt_perf_thread_t *thread, pt_perf_mode_t mode) {
+    long page_size = sysconf(_SC_PAGESIZE);
+
+    for(int i = 0; i < _PALLENE_TRACER_PERF_EVENTS; i++) {
+        struct perf_event_attr attr;
+        memset(&attr, 0, sizeof(attr));
+        attr.size           = sizeof(attr);
+        attr.type           = _pallene_tracer_perf_events[mode - 1][i].type;
+        attr.config         = _pallene_tracer_perf_events[mode - 1][i].config;
+        attr.read_format    = PERF_FORMAT_GROUP;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv     = 1;
+
+        thread->fds[i] = (int) syscall(SYS_perf_event_open, &attr, 0, -1,
+            i == 0 ? -1 : thread->fds[0], 0);
+        if(thread->fds[i] < 0) {
+            _pallene_tracer_perf_close(thread);
+            return false;
+        }
+
+        void *page = mmap(NULL, (size_t) page_size, PROT_READ, MAP_SHARED, thread->fds[i], 0);
+        thread->pages[i] = page != MAP_FAILED ? (struct perf_event_mmap_page *) page : NULL;
+    }
+
+    return true;
+}
+
+/* When a thread exits, its counters are closed. */
+static PT_NOINSTRUMENT void _pallene_tracer_perf_exit(void *data) {
+    _pallene_tracer_perf_close((pt_perf_thread_t *) data);
+    free(data);
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_perf_key_create(void) {
+    pthread_key_create(&_pallene_tracer_perf_key, _pallene_tracer_perf_exit);
+}
+
+/* The counters of the calling thread, opened the first time. NULL if it cannot have
+   them. A new selection forgets the frames being measured. */
+static PT_NOINSTRUMENT pt_perf_thread_t *_pallene_tracer_perf_thread(void) {
+    pthread_once(&_pallene_tracer_perf_once, _pallene_tracer_perf_key_create);
+
+    pt_perf_thread_t *thread = (pt_perf_thread_t *) pthread_getspecific(_pallene_tracer_perf_key);
+    if(luai_unlikely(thread == NULL)) {
+        thread = (pt_perf_thread_t *) calloc(1, sizeof(pt_perf_thread_t));
+        if(thread == NULL)
+            return NULL;
+
+        for(int i = 0; i < _PALLENE_TRACER_PERF_EVENTS; i++)
+            thread->fds[i] = -1;
+        if(_pallene_tracer_perf_mode != PALLENE_TRACER_PERF_NONE)
+            _pallene_tracer_perf_open(thread, _pallene_tracer_perf_mode);
+
+        if(pthread_setspecific(_pallene_tracer_perf_key, thread) != 0) {
+            _pallene_tracer_perf_exit(thread);
+            return NULL;
+        }
+    }
+
+    if(luai_unlikely(thread->generation != _pallene_tracer_perf_generation)) {
+        memset(thread->cache, 0, sizeof(thread->cache));
+        thread->count = 0;
+        thread->generation = _pallene_tracer_perf_generation;
+    }
+
+    return thread;
+}
+
+#if defined(__x86_64__) || defined(__i386__)
+/* Reads a counter from user space, the way `perf_event_open(2)` shows. Returns false if
+   the kernel does not allow it or the counter is not on the CPU. */
+static PT_NOINSTRUMENT bool _pallene_tracer_perf_rdpmc(volatile struct perf_event_mmap_page *page,
+    uint64_t *value) {
+    uint32_t seq;
+    uint64_t count;
+
+    do {
+        seq = page->lock;
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+
+        uint32_t index = page->index;
+        if(!page->cap_user_rdpmc || index == 0)
+            return false;
+
+        uint32_t lo, hi;
+        __asm__ volatile("rdpmc" : "=a" (lo), "=d" (hi) : "c" (index - 1));
+
+        int64_t pmc = (int64_t) (((uint64_t) hi << 32) | lo);
+        int width = page->pmc_width;
+        pmc = (int64_t) ((uint64_t) pmc << (64 - width)) >> (64 - width);
+        count = page->offset + (uint64_t) pmc;
+
+        __atomic_signal_fence(__ATOMIC_SEQ_CST);
+    } while(page->lock != seq);
+
+    *value = count;
+    return true;
+}
+#endif
+
+/* Reads the counters of the thread, with `rdpmc` if every one allows it, otherwise with
+   a single `read` of the group. */
+static PT_NOINSTRUMENT void _pallene_tracer_perf_read(pt_perf_thread_t *thread, uint64_t *values) {
+    if(thread->fds[0] < 0) {
+        memset(values, 0, _PALLENE_TRACER_PERF_EVENTS * sizeof(uint64_t));
+        return;
+    }
+
+#if defined(__x86_64__) || defined(__i386__)
+    int done = 0;
+    while(done < _PALLENE_TRACER_PERF_EVENTS && thread->pages[done] != NULL
+        && _pallene_tracer_perf_rdpmc(thread->pages[done], &values[done]))
+        done++;
+
+    if(done == _PALLENE_TRACER_PERF_EVENTS)
+        return;
+#endif
+
+    struct {
+        uint64_t nr;
+        uint64_t values[_PALLENE_TRACER_PERF_EVENTS];
+    } group;
+
+    if(read(thread->fds[0], &group, sizeof(group)) == (ssize_t) sizeof(group))
+        memcpy(values, group.values, sizeof(group.values));
+    else memset(values, 0, sizeof(group.values));
+}
+
+/* The slot of a selected function, -1 for the others. Names are compared once per
+   descriptor and thread. */
+static PT_NOINSTRUMENT int _pallene_tracer_perf_slot(pt_perf_thread_t *thread, const pt_fn_details_t *details) {
+    size_t hash = ((uintptr_t) details >> 4) & (_PALLENE_TRACER_PERF_CACHE - 1);
+    if(luai_likely(thread->cache[hash].details == details))
+        return thread->cache[hash].slot;
+
+    int slot = -1;
+    for(int i = 0; i < _pallene_tracer_perf_fns && slot < 0; i++)
+        if(strcmp(_pallene_tracer_perf_names[i], details->fn_name) == 0)
+            slot = i;
+
+    thread->cache[hash].details = details;
+    thread->cache[hash].slot = slot;
+
+    return slot;
+}
+
+/* Adds what the frame on top of the thread took to the totals, and forgets it. */
+static PT_NOINSTRUMENT void _pallene_tracer_perf_account(pt_perf_thread_t *thread) {
+    pt_perf_entry_t *entry = &thread->entries[--thread->count];
+    uint64_t values[_PALLENE_TRACER_PERF_EVENTS];
+    _pallene_tracer_perf_read(thread, values);
+
+    __atomic_add_fetch(&_pallene_tracer_perf_totals[entry->slot].calls, 1, __ATOMIC_RELAXED);
+    for(int i = 0; i < _PALLENE_TRACER_PERF_EVENTS; i++)
+        __atomic_add_fetch(&_pallene_tracer_perf_totals[entry->slot].values[i],
+            values[i] - entry->values[i], __ATOMIC_RELAXED);
+}
+
+/* Frames are measured from the moment they are entered until they are exited or
+   unwound, inclusive of the functions they call. */
+static PT_NOINSTRUMENT void _pallene_tracer_perf_sink(void *ud, pt_event_t event, pt_fnstack_t *fnstack,
+    const pt_frame_t *frame) {
+    (void) ud;
+    pt_perf_thread_t *thread = _pallene_tracer_perf_thread();
+    if(thread == NULL)
+        return;
+
+    switch(event) {
+        case PALLENE_TRACER_EVENT_ENTER: {
+            if(frame == NULL || thread->count == PALLENE_TRACER_PERF_DEPTH
+                || (frame->type != PALLENE_TRACER_FRAME_TYPE_C
+                    && frame->type != PALLENE_TRACER_FRAME_TYPE_INLINED))
+                return;
+
+            int slot = _pallene_tracer_perf_slot(thread, frame->shared.details);
+            if(slot < 0)
+                return;
+
+            pt_perf_entry_t *entry = &thread->entries[thread->count++];
+            entry->fnstack = fnstack;
+            entry->depth = fnstack->count;
+            entry->slot = slot;
+            _pallene_tracer_perf_read(thread, entry->values);
+            break;
+        }
+
+        /* Repetitions (`PT_RLE`) have the same depth, and leave in order. */
+        case PALLENE_TRACER_EVENT_EXIT:
+            if(thread->count > 0 && thread->entries[thread->count - 1].fnstack == fnstack
+                && thread->entries[thread->count - 1].depth == fnstack->count)
+                _pallene_tracer_perf_account(thread);
+            break;
+
+        /* The frames above the topmost Lua interface frame go. */
+        case PALLENE_TRACER_EVENT_UNWIND: {
+            int depth = fnstack->top_lua < 0 ? 0 : fnstack->top_lua;
+            while(thread->count > 0 && thread->entries[thread->count - 1].fnstack == fnstack
+                && thread->entries[thread->count - 1].depth > depth)
+                _pallene_tracer_perf_account(thread);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+/* Selects the functions named by the arguments. The counters are probed the first
+   time, hardware first. */
+PT_NOINSTRUMENT int pallene_tracer_perf(lua_State *L) {
+    int n = lua_gettop(L);
+    luaL_argcheck(L, n <= PALLENE_TRACER_PERF_MAX_FNS, PALLENE_TRACER_PERF_MAX_FNS + 1,
+        "too many functions");
+    for(int i = 1; i <= n; i++)
+        luaL_checkstring(L, i);
+
+    pallene_tracer_sink_remove(_pallene_tracer_perf_sink, NULL);
+    _pallene_tracer_perf_fns = 0;
+    _pallene_tracer_perf_generation++;
+    memset(_pallene_tracer_perf_totals, 0, sizeof(_pallene_tracer_perf_totals));
+
+    if(n == 0)
+        return 0;
+
+    /* The names are kept until a new selection: a sink still running in another thread
+       after a stop may be comparing them. */
+    for(int i = 0; i < PALLENE_TRACER_PERF_MAX_FNS; i++) {
+        free(_pallene_tracer_perf_names[i]);
+        _pallene_tracer_perf_names[i] = NULL;
+    }
+
+    if(!_pallene_tracer_perf_probed) {
+        pt_perf_thread_t probe;
+        for(int i = 0; i < _PALLENE_TRACER_PERF_EVENTS; i++) {
+            probe.fds[i] = -1;
+            probe.pages[i] = NULL;
+        }
+
+        if(_pallene_tracer_perf_open(&probe, PALLENE_TRACER_PERF_HARDWARE))
+            _pallene_tracer_perf_mode = PALLENE_TRACER_PERF_HARDWARE;
+        else if(_pallene_tracer_perf_open(&probe, PALLENE_TRACER_PERF_SOFTWARE))
+            _pallene_tracer_perf_mode = PALLENE_TRACER_PERF_SOFTWARE;
+        _pallene_tracer_perf_close(&probe);
+        _pallene_tracer_perf_probed = true;
+    }
+
+    for(int i = 1; i <= n; i++) {
+        char *name = strdup(lua_tostring(L, i));
+        if(name != NULL)
+            _pallene_tracer_perf_names[_pallene_tracer_perf_fns++] = name;
+    }
+
+    if(!pallene_tracer_sink_add(_pallene_tracer_perf_sink, NULL))
+        return luaL_error(L, "Pallene Tracer has no room for another sink");
+
+    lua_pushstring(L, _pallene_tracer_perf_modes[_pallene_tracer_perf_mode]);
+    return 1;
+}
+
+/* Returns the totals of the selected functions, with the ratios which tell compute
+   from memory-bound functions in hardware mode, and resets them. */
+PT_NOINSTRUMENT int pallene_tracer_perf_stats(lua_State *L) {
+    lua_newtable(L);
+
+    for(int slot = 0; slot < _pallene_tracer_perf_fns; slot++) {
+        uint64_t calls = __atomic_exchange_n(&_pallene_tracer_perf_totals[slot].calls, 0,
+            __ATOMIC_RELAXED);
+        uint64_t values[_PALLENE_TRACER_PERF_EVENTS];
+        for(int i = 0; i < _PALLENE_TRACER_PERF_EVENTS; i++)
+            values[i] = __atomic_exchange_n(&_pallene_tracer_perf_totals[slot].values[i], 0,
+                __ATOMIC_RELAXED);
+
+        if(calls == 0)
+            continue;
+
+        lua_createtable(L, 0, 8);
+        lua_pushinteger(L, (lua_Integer) calls);
+        lua_setfield(L, -2, "calls");
+
+        if(_pallene_tracer_perf_mode != PALLENE_TRACER_PERF_NONE) {
+            for(int i = 0; i < _PALLENE_TRACER_PERF_EVENTS; i++) {
+                lua_pushinteger(L, (lua_Integer) values[i]);
+                lua_setfield(L, -2, _pallene_tracer_perf_events[_pallene_tracer_perf_mode - 1][i].name);
+            }
+        }
+
+        /* Instructions per cycle, and misses per thousand instructions. */
+        if(_pallene_tracer_perf_mode == PALLENE_TRACER_PERF_HARDWARE && values[0] != 0
+            && values[1] != 0) {
+            lua_pushnumber(L, (lua_Number) values[1] / (lua_Number) values[0]);
+            lua_setfield(L, -2, "ipc");
+            lua_pushnumber(L, 1000 * (lua_Number) values[2] / (lua_Number) values[1]);
+            lua_setfield(L, -2, "cache_mpki");
+            lua_pushnumber(L, 1000 * (lua_Number) values[3] / (lua_Number) values[1]);
+            lua_setfield(L, -2, "branch_mpki");
+        }
+
+        lua_setfield(L, -2, _pallene_tracer_perf_names[slot]);
+    }
+
+    return 1;
+}
+#endif // PT_PERF
+
+#ifdef PT_CALLGRAPH
+/* A call being timed: the edge it goes by, when it started, and where its frame is in
+   which call-stack. */
+typedef struct pt_graph_call {
+    const pt_fnstack_t *fnstack;
+    int depth;
+    pt_edge_t *edge;
+    uint64_t start;
+} pt_graph_call_t;
+
+/* The calls a thread is timing. */
+typedef struct pt_graph_thread {
+    int count;
+    pt_graph_call_t calls[PALLENE_TRACER_CALLGRAPH_DEPTH];
+} pt_graph_thread_t;
+
+static pthread_once_t _pallene_tracer_graph_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _pallene_tracer_graph_key;
+
+/* The edges, keyed by caller and callee. */
+static pt_edge_t _pallene_tracer_graph_edges[PALLENE_TRACER_CALLGRAPH_EDGES];
+static pt_table_t _pallene_tracer_graph_table = _PALLENE_TRACER_TABLE(_pallene_tracer_graph_edges);
+
+static PT_NOINSTRUMENT void _pallene_tracer_graph_key_create(void) {
+    pthread_key_create(&_pallene_tracer_graph_key, free);
+}
+
+/* The calls the calling thread is timing, NULL if it cannot time any. */
+static PT_NOINSTRUMENT pt_graph_thread_t *_pallene_tracer_graph_thread(void) {
+    pthread_once(&_pallene_tracer_graph_once, _pallene_tracer_graph_key_create);
+
+    pt_graph_thread_t *thread = (pt_graph_thread_t *) pthread_getspecific(_pallene_tracer_graph_key);
+    if(luai_unlikely(thread == NULL)) {
+        thread = (pt_graph_thread_t *) calloc(1, sizeof(pt_graph_thread_t));
+        if(thread != NULL && pthread_setspecific(_pallene_tracer_graph_key, thread) != 0) {
+            free(thread);
+            thread = NULL;
+        }
+    }
+
+    return thread;
+}
+
+/* The function of a frame, NULL if it has no descriptor. */
+static PT_NOINSTRUMENT const pt_fn_details_t *_pallene_tracer_graph_node(const pt_frame_t *frame) {
+    switch(frame->type) {
+        case PALLENE_TRACER_FRAME_TYPE_C:
+        case PALLENE_TRACER_FRAME_TYPE_HOOKED:
+        case PALLENE_TRACER_FRAME_TYPE_INLINED:
+            return frame->shared.details;
+        default:
+            return NULL;
+    }
+}
+
+/* The caller of the frame at `index`: the function of the nearest frame below with a
+   descriptor. Native frames are skipped. Below a Lua interface frame, it is Lua (NULL),
+   unless the Lua function is there as a hooked frame. */
+static PT_NOINSTRUMENT const pt_fn_details_t *_pallene_tracer_graph_caller(const pt_fnstack_t *fnstack,
+    int index) {
+    for(int i = index - 1; i >= 0; i--) {
+        const pt_frame_t *frame = &fnstack->stack[i];
+
+        if(frame->type == PALLENE_TRACER_FRAME_TYPE_LUA)
+            return i > 0 && fnstack->stack[i - 1].type == PALLENE_TRACER_FRAME_TYPE_HOOKED
+                ? fnstack->stack[i - 1].shared.details : NULL;
+
+        if(frame->type != PALLENE_TRACER_FRAME_TYPE_NATIVE)
+            return frame->shared.details;
+    }
+
+    return NULL;
+}
+
+/* The key of an edge is the caller and the callee. */
+static PT_NOINSTRUMENT pt_table_match_t _pallene_tracer_graph_match(const void *entry, const void *key) {
+    const pt_edge_t *edge = (const pt_edge_t *) entry;
+    const pt_fn_details_t *const *wanted = (const pt_fn_details_t *const *) key;
+    const pt_fn_details_t *callee = __atomic_load_n(&edge->callee, __ATOMIC_ACQUIRE);
+
+    if(callee == NULL)
+        return _PALLENE_TRACER_TABLE_FREE;
+    return callee == wanted[1] && edge->caller == wanted[0]
+        ? _PALLENE_TRACER_TABLE_FOUND : _PALLENE_TRACER_TABLE_OTHER;
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_graph_claim(void *entry, const void *key) {
+    pt_edge_t *edge = (pt_edge_t *) entry;
+    const pt_fn_details_t *const *wanted = (const pt_fn_details_t *const *) key;
+
+    edge->caller = wanted[0];
+    __atomic_store_n(&edge->callee, wanted[1], __ATOMIC_RELEASE);
+}
+
+/* Finds the edge, claiming an entry for it the first time. NULL if the table is full. */
+static PT_NOINSTRUMENT pt_edge_t *_pallene_tracer_graph_edge(const pt_fn_details_t *caller,
+    const pt_fn_details_t *callee) {
+    const pt_fn_details_t *key[2] = { caller, callee };
+    size_t hash = ((uintptr_t) caller >> 4) * 31 + ((uintptr_t) callee >> 4);
+
+    return (pt_edge_t *) _pallene_tracer_table_find(&_pallene_tracer_graph_table, hash, key,
+        _pallene_tracer_graph_match, _pallene_tracer_graph_claim);
+}
+
+/* Adds the time of the call on top of the thread to its edge, and forgets it. */
+static PT_NOINSTRUMENT void _pallene_tracer_graph_return(pt_graph_thread_t *thread) {
+    pt_graph_call_t *call = &thread->calls[--thread->count];
+    __atomic_add_fetch(&call->edge->time, _pallene_tracer_monotonic_now() - call->start, __ATOMIC_RELAXED);
+}
+
+/* Edges are counted when the callee is entered, and timed until it is exited or
+   unwound. */
+static PT_NOINSTRUMENT void _pallene_tracer_graph_sink(void *ud, pt_event_t event, pt_fnstack_t *fnstack,
+    const pt_frame_t *frame) {
+    (void) ud;
+
+    switch(event) {
+        case PALLENE_TRACER_EVENT_ENTER: {
+            const pt_fn_details_t *callee = frame != NULL ? _pallene_tracer_graph_node(frame) : NULL;
+            if(callee == NULL)
+                return;
+
+            /* A repetition (`PT_RLE`) is called by the frame itself. */
+            const pt_fn_details_t *caller = pallene_tracer_repeat(frame) > 0 ? callee
+                : _pallene_tracer_graph_caller(fnstack, fnstack->count - 1);
+
+            pt_edge_t *edge = _pallene_tracer_graph_edge(caller, callee);
+            if(edge == NULL)
+                return;
+            __atomic_add_fetch(&edge->calls, 1, __ATOMIC_RELAXED);
+
+            pt_graph_thread_t *thread = _pallene_tracer_graph_thread();
+            if(thread != NULL && thread->count < PALLENE_TRACER_CALLGRAPH_DEPTH) {
+                pt_graph_call_t *call = &thread->calls[thread->count++];
+                call->fnstack = fnstack;
+                call->depth = fnstack->count;
+                call->edge = edge;
+                call->start = _pallene_tracer_monotonic_now();
+            }
+            break;
+        }
+
+        case PALLENE_TRACER_EVENT_EXIT: {
+            pt_graph_thread_t *thread = _pallene_tracer_graph_thread();
+            if(thread != NULL && thread->count > 0
+                && thread->calls[thread->count - 1].fnstack == fnstack
+                && thread->calls[thread->count - 1].depth == fnstack->count)
+                _pallene_tracer_graph_return(thread);
+            break;
+        }
+
+        /* The frames above the topmost Lua interface frame go. */
+        case PALLENE_TRACER_EVENT_UNWIND: {
+            pt_graph_thread_t *thread = _pallene_tracer_graph_thread();
+            int depth = fnstack->top_lua < 0 ? 0 : fnstack->top_lua;
+            while(thread != NULL && thread->count > 0
+                && thread->calls[thread->count - 1].fnstack == fnstack
+                && thread->calls[thread->count - 1].depth > depth)
+                _pallene_tracer_graph_return(thread);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+/* Forgets the edges and starts recording. Threads forget the calls they were timing
+   the next time they enter a frame. */
+PT_NOINSTRUMENT bool pallene_tracer_callgraph_start(void) {
+    pallene_tracer_callgraph_stop();
+    _pallene_tracer_table_clear(&_pallene_tracer_graph_table);
+
+    pt_graph_thread_t *thread = _pallene_tracer_graph_thread();
+    if(thread != NULL)
+        thread->count = 0;
+
+    return pallene_tracer_sink_add(_pallene_tracer_graph_sink, NULL);
+}
+
+PT_NOINSTRUMENT void pallene_tracer_callgraph_stop(void) {
+    pallene_tracer_sink_remove(_pallene_tracer_graph_sink, NULL);
+}
+
+/* A function of the graph being written: the time of the calls to it and of those it
+   made, and the edges of the latter. */
+typedef struct pt_graph_fn {
+    const pt_fn_details_t *fn;
+    uint64_t in, out;
+    int first, last;                     /* Edges it is the caller of, -1 if none. */
+    bool written;
+} pt_graph_fn_t;
+
+/* A snapshot of the edges, with their functions in an open addressing table which the
+   edges cannot fill, and Lua apart. */
+typedef struct pt_graph {
+    pt_edge_t edges[PALLENE_TRACER_CALLGRAPH_EDGES];
+    int next[PALLENE_TRACER_CALLGRAPH_EDGES]; /* Next edge of the same caller, -1 if none. */
+    int count;
+    pt_graph_fn_t lua;
+    pt_graph_fn_t fns[2 * PALLENE_TRACER_CALLGRAPH_EDGES];
+} pt_graph_t;
+
+/* Finds the function, adding it the first time. */
+static PT_NOINSTRUMENT pt_graph_fn_t *_pallene_tracer_graph_fn(pt_graph_t *graph,
+    const pt_fn_details_t *fn) {
+    if(fn == NULL)
+        return &graph->lua;
+
+    size_t mask = 2 * PALLENE_TRACER_CALLGRAPH_EDGES - 1;
+    size_t i = ((uintptr_t) fn >> 4) & mask;
+    while(graph->fns[i].fn != NULL && graph->fns[i].fn != fn)
+        i = (i + 1) & mask;
+
+    if(graph->fns[i].fn == NULL) {
+        graph->fns[i].fn = fn;
+        graph->fns[i].first = graph->fns[i].last = -1;
+    }
+    return &graph->fns[i];
+}
+
+/* Copies the edges, in the order of the table, and sums the time of the calls to and
+   from each function in the same pass. Recursive calls count on neither side. NULL if
+   out of memory. */
+static PT_NOINSTRUMENT pt_graph_t *_pallene_tracer_graph_snapshot(void) {
+    pt_graph_t *graph = (pt_graph_t *) calloc(1, sizeof(pt_graph_t));
+    if(graph == NULL)
+        return NULL;
+    graph->lua.first = graph->lua.last = -1;
+
+    for(int i = 0; i < PALLENE_TRACER_CALLGRAPH_EDGES; i++) {
+        const pt_edge_t *edge = &_pallene_tracer_graph_edges[i];
+        const pt_fn_details_t *callee = __atomic_load_n(&edge->callee, __ATOMIC_ACQUIRE);
+        if(callee == NULL)
+            continue;
+
+        int e = graph->count++;
+        pt_edge_t *copy = &graph->edges[e];
+        copy->caller = edge->caller;
+        copy->callee = callee;
+        copy->calls = __atomic_load_n(&edge->calls, __ATOMIC_RELAXED);
+        copy->time = __atomic_load_n(&edge->time, __ATOMIC_RELAXED);
+        graph->next[e] = -1;
+
+        pt_graph_fn_t *caller = _pallene_tracer_graph_fn(graph, copy->caller);
+        if(caller->last >= 0)
+            graph->next[caller->last] = e;
+        else
+            caller->first = e;
+        caller->last = e;
+
+        if(copy->caller != callee) {
+            caller->out += copy->time;
+            _pallene_tracer_graph_fn(graph, callee)->in += copy->time;
+        }
+    }
+
+    return graph;
+}
+
+/* The time of a function itself: the time of its calls, less the time of the calls it
+   made. */
+static PT_NOINSTRUMENT uint64_t _pallene_tracer_graph_self(const pt_graph_fn_t *fn) {
+    return fn->in > fn->out ? fn->in - fn->out : 0;
+}
+
+/* Callgrind: every function, its own time, then the calls it made with their time. */
+static PT_NOINSTRUMENT void _pallene_tracer_graph_callgrind(FILE *file, pt_graph_t *graph) {
+    fprintf(file, "# callgrind format\nversion: 1\ncreator: pallene-tracer\n"
+        "positions: line\nevents: ns\n");
+
+    for(int i = 0; i < graph->count; i++) {
+        const pt_fn_details_t *caller = graph->edges[i].caller;
+        pt_graph_fn_t *fn = _pallene_tracer_graph_fn(graph, caller);
+        if(fn->written)
+            continue;
+        fn->written = true;
+
+        fprintf(file, "\nfl=%s\nfn=%s\n", caller != NULL ? caller->filename : "(Lua)",
+            caller != NULL ? caller->fn_name : "(Lua)");
+        fprintf(file, "0 %llu\n", caller != NULL
+            ? (unsigned long long) _pallene_tracer_graph_self(fn) : 0ULL);
+
+        for(int j = fn->first; j >= 0; j = graph->next[j]) {
+            const pt_edge_t *call = &graph->edges[j];
+            fprintf(file, "cfl=%s\ncfn=%s\ncalls=%llu 0\n0 %llu\n", call->callee->filename,
+                call->callee->fn_name, (unsigned long long) call->calls,
+                (unsigned long long) call->time);
+        }
+    }
+
+    /* Functions calling nothing have their own time too. */
+    for(int i = 0; i < graph->count; i++) {
+        const pt_fn_details_t *callee = graph->edges[i].callee;
+        pt_graph_fn_t *fn = _pallene_tracer_graph_fn(graph, callee);
+        if(fn->written)
+            continue;
+        fn->written = true;
+
+        fprintf(file, "\nfl=%s\nfn=%s\n0 %llu\n", callee->filename, callee->fn_name,
+            (unsigned long long) _pallene_tracer_graph_self(fn));
+    }
+}
+
+/* DOT: functions are nodes named by their descriptors, Lua is "lua". */
+static PT_NOINSTRUMENT void _pallene_tracer_graph_dot(FILE *file, pt_graph_t *graph) {
+    fprintf(file, "digraph \"pallene-tracer\" {\n    node [shape=box];\n"
+        "    \"lua\" [label=\"(Lua)\"];\n");
+
+    for(int i = 0; i < graph->count; i++) {
+        const pt_fn_details_t *callee = graph->edges[i].callee;
+        pt_graph_fn_t *fn = _pallene_tracer_graph_fn(graph, callee);
+        if(fn->written)
+            continue;
+        fn->written = true;
+
+        fprintf(file, "    \"%p\" [label=\"%s\\n%s\"];\n", (const void *) callee,
+            callee->fn_name, callee->filename);
+    }
+
+    for(int i = 0; i < graph->count; i++) {
+        const pt_edge_t *edge = &graph->edges[i];
+
+        if(edge->caller != NULL)
+            fprintf(file, "    \"%p\"", (const void *) edge->caller);
+        else
+            fprintf(file, "    \"lua\"");
+        fprintf(file, " -> \"%p\" [label=\"%llu calls\\n%.3f ms\"];\n", (const void *) edge->callee,
+            (unsigned long long) edge->calls, (double) edge->time / 1e6);
+    }
+
+    fprintf(file, "}\n");
+}
+
+/* Writes the edges recorded. Edges may still be added while we write. */
+PT_NOINSTRUMENT bool pallene_tracer_callgraph_write(FILE *file, pt_graph_format_t format) {
+    pt_graph_t *graph = _pallene_tracer_graph_snapshot();
+    if(graph == NULL)
+        return false;
+
+    if(format == PALLENE_TRACER_GRAPH_CALLGRIND)
+        _pallene_tracer_graph_callgrind(file, graph);
+    else
+        _pallene_tracer_graph_dot(file, graph);
+    free(graph);
+
+    uint64_t dropped = __atomic_load_n(&_pallene_tracer_graph_table.dropped, __ATOMIC_RELAXED);
+    if(dropped > 0)
+        fprintf(file, "%s %llu calls dropped, the table of edges is full\n",
+            format == PALLENE_TRACER_GRAPH_CALLGRIND ? "#" : "//", (unsigned long long) dropped);
+
+    return fflush(file) == 0 && !ferror(file);
+}
+
+/* Returns the edges recorded, in the order of the table. */
+PT_NOINSTRUMENT int pallene_tracer_callgraph_edges(lua_State *L) {
+    lua_newtable(L);
+    lua_Integer n = 0;
+
+    for(int i = 0; i < PALLENE_TRACER_CALLGRAPH_EDGES; i++) {
+        const pt_edge_t *edge = &_pallene_tracer_graph_edges[i];
+        const pt_fn_details_t *callee = __atomic_load_n(&edge->callee, __ATOMIC_ACQUIRE);
+        if(callee == NULL)
+            continue;
+
+        lua_createtable(L, 0, 6);
+        if(edge->caller != NULL) {
+            lua_pushstring(L, edge->caller->fn_name);
+            lua_setfield(L, -2, "caller");
+            lua_pushstring(L, edge->caller->filename);
+            lua_setfield(L, -2, "caller_file");
+        }
+        lua_pushstring(L, callee->fn_name);
+        lua_setfield(L, -2, "callee");
+        lua_pushstring(L, callee->filename);
+        lua_setfield(L, -2, "callee_file");
+        lua_pushinteger(L, (lua_Integer) __atomic_load_n(&edge->calls, __ATOMIC_RELAXED));
+        lua_setfield(L, -2, "calls");
+        lua_pushnumber(L, (lua_Number) __atomic_load_n(&edge->time, __ATOMIC_RELAXED) / 1e9);
+        lua_setfield(L, -2, "time");
+        lua_rawseti(L, -2, ++n);
+    }
+
+    return 1;
+}
+#endif // PT_CALLGRAPH
+
+#ifdef PT_LATENCY
+/* Values below 8 ns have a bucket each, then every power of two has 8, up to 2^40 ns.
+   Longer calls go to the last bucket. */
+#define _PALLENE_TRACER_LATENCY_SUB_BITS     3
+#define _PALLENE_TRACER_LATENCY_SUB          (1 << _PALLENE_TRACER_LATENCY_SUB_BITS)
+#define _PALLENE_TRACER_LATENCY_MAX_BITS     40
+#define _PALLENE_TRACER_LATENCY_BUCKETS                                                  \
+    ((_PALLENE_TRACER_LATENCY_MAX_BITS - _PALLENE_TRACER_LATENCY_SUB_BITS + 1)           \
+        * _PALLENE_TRACER_LATENCY_SUB)
+
+/* The histogram of a Lua interface function. Times are in nanoseconds. */
+typedef struct pt_histogram {
+    lua_CFunction fn;                    /* NULL while the entry is free. */
+    uint64_t count;
+    uint64_t sum;
+    uint64_t max;
+    uint64_t buckets[_PALLENE_TRACER_LATENCY_BUCKETS];
+} pt_histogram_t;
+
+/* A call being timed, and where its frame is in which call-stack. */
+typedef struct pt_latency_call {
+    const pt_fnstack_t *fnstack;
+    int depth;
+    pt_histogram_t *histogram;
+    uint64_t start;
+} pt_latency_call_t;
+
+/* The calls a thread is timing. */
+typedef struct pt_latency_thread {
+    int count;
+    pt_latency_call_t calls[PALLENE_TRACER_LATENCY_DEPTH];
+} pt_latency_thread_t;
+
+static pthread_once_t _pallene_tracer_latency_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _pallene_tracer_latency_key;
+
+/* The histograms, keyed by function. */
+static pt_histogram_t _pallene_tracer_latency_histograms[PALLENE_TRACER_LATENCY_FNS];
+static pt_table_t _pallene_tracer_latency_table = _PALLENE_TRACER_TABLE(_pallene_tracer_latency_histograms);
+
+static PT_NOINSTRUMENT int _pallene_tracer_latency_bucket(uint64_t ns) {
+    if(ns < _PALLENE_TRACER_LATENCY_SUB)
+        return (int) ns;
+
+    int msb = 63 - __builtin_clzll(ns);
+    if(msb >= _PALLENE_TRACER_LATENCY_MAX_BITS)
+        return _PALLENE_TRACER_LATENCY_BUCKETS - 1;
+
+    int shift = msb - _PALLENE_TRACER_LATENCY_SUB_BITS;
+    return (shift + 1) * _PALLENE_TRACER_LATENCY_SUB + (int) (ns >> shift) - _PALLENE_TRACER_LATENCY_SUB;
+}
+
+/* The largest value of a bucket. */
+static PT_NOINSTRUMENT uint64_t _pallene_tracer_latency_upper(int bucket) {
+    if(bucket < _PALLENE_TRACER_LATENCY_SUB)
+        return (uint64_t) bucket;
+
+    int shift = bucket / _PALLENE_TRACER_LATENCY_SUB - 1;
+    uint64_t mantissa = (uint64_t) (bucket % _PALLENE_TRACER_LATENCY_SUB + _PALLENE_TRACER_LATENCY_SUB);
+    return ((mantissa + 1) << shift) - 1;
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_latency_key_create(void) {
+    pthread_key_create(&_pallene_tracer_latency_key, free);
+}
+
+/* The calls the calling thread is timing, NULL if it cannot time any. */
+static PT_NOINSTRUMENT pt_latency_thread_t *_pallene_tracer_latency_thread(void) {
+    pthread_once(&_pallene_tracer_latency_once, _pallene_tracer_latency_key_create);
+
+    pt_latency_thread_t *thread = (pt_latency_thread_t *) pthread_getspecific(_pallene_tracer_latency_key);
+    if(luai_unlikely(thread == NULL)) {
+        thread = (pt_latency_thread_t *) calloc(1, sizeof(pt_latency_thread_t));
+        if(thread != NULL && pthread_setspecific(_pallene_tracer_latency_key, thread) != 0) {
+            free(thread);
+            thread = NULL;
+        }
+    }
+
+    return thread;
+}
+
+/* The key of a histogram is its function. */
+static PT_NOINSTRUMENT pt_table_match_t _pallene_tracer_latency_match(const void *entry, const void *key) {
+    lua_CFunction fn = __atomic_load_n(&((const pt_histogram_t *) entry)->fn, __ATOMIC_ACQUIRE);
+
+    if(fn == NULL)
+        return _PALLENE_TRACER_TABLE_FREE;
+    return fn == *(const lua_CFunction *) key ? _PALLENE_TRACER_TABLE_FOUND : _PALLENE_TRACER_TABLE_OTHER;
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_latency_claim(void *entry, const void *key) {
+    __atomic_store_n(&((pt_histogram_t *) entry)->fn, *(const lua_CFunction *) key, __ATOMIC_RELEASE);
+}
+
+/* Finds the histogram of `fn`, claiming an entry for it the first time. NULL if the
+   table is full. */
+static PT_NOINSTRUMENT pt_histogram_t *_pallene_tracer_latency_histogram(lua_CFunction fn) {
+    return (pt_histogram_t *) _pallene_tracer_table_find(&_pallene_tracer_latency_table,
+        (uintptr_t) fn >> 4, &fn, _pallene_tracer_latency_match, _pallene_tracer_latency_claim);
+}
+
+/* Adds the time of the call on top of the thread to its histogram, and forgets it. */
+static PT_NOINSTRUMENT void _pallene_tracer_latency_return(pt_latency_thread_t *thread) {
+    pt_latency_call_t *call = &thread->calls[--thread->count];
+    pt_histogram_t *histogram = call->histogram;
+    uint64_t ns = _pallene_tracer_monotonic_now() - call->start;
+
+    __atomic_add_fetch(&histogram->count, 1, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->sum, ns, __ATOMIC_RELAXED);
+    __atomic_add_fetch(&histogram->buckets[_pallene_tracer_latency_bucket(ns)], 1, __ATOMIC_RELAXED);
+
+    uint64_t max = __atomic_load_n(&histogram->max, __ATOMIC_RELAXED);
+    while(ns > max && !__atomic_compare_exchange_n(&histogram->max, &max, ns, true,
+        __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/* Lua interface frames are timed from the moment they are entered until their
+   finalizer unwinds them, when their function returns or raises an error. */
+static PT_NOINSTRUMENT void _pallene_tracer_latency_sink(void *ud, pt_event_t event, pt_fnstack_t *fnstack,
+    const pt_frame_t *frame) {
+    (void) ud;
+
+    switch(event) {
+        case PALLENE_TRACER_EVENT_ENTER: {
+            if(frame == NULL || frame->type != PALLENE_TRACER_FRAME_TYPE_LUA)
+                return;
+
+            pt_latency_thread_t *thread = _pallene_tracer_latency_thread();
+            if(thread == NULL || thread->count == PALLENE_TRACER_LATENCY_DEPTH)
+                return;
+
+            pt_histogram_t *histogram = _pallene_tracer_latency_histogram(frame->shared.lua.fnptr);
+            if(histogram == NULL)
+                return;
+
+            pt_latency_call_t *call = &thread->calls[thread->count++];
+            call->fnstack = fnstack;
+            call->depth = fnstack->count;
+            call->histogram = histogram;
+            call->start = _pallene_tracer_monotonic_now();
+            break;
+        }
+
+        /* The topmost Lua interface frame goes, with the frames above it. */
+        case PALLENE_TRACER_EVENT_UNWIND: {
+            pt_latency_thread_t *thread = _pallene_tracer_latency_thread();
+            int depth = fnstack->top_lua < 0 ? 0 : fnstack->top_lua;
+            while(thread != NULL && thread->count > 0
+                && thread->calls[thread->count - 1].fnstack == fnstack
+                && thread->calls[thread->count - 1].depth > depth)
+                _pallene_tracer_latency_return(thread);
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+/* Forgets the histograms and starts recording. Threads forget the calls they were
+   timing the next time they enter a frame. */
+PT_NOINSTRUMENT bool pallene_tracer_latency_start(void) {
+    pallene_tracer_latency_stop();
+    _pallene_tracer_table_clear(&_pallene_tracer_latency_table);
+
+    pt_latency_thread_t *thread = _pallene_tracer_latency_thread();
+    if(thread != NULL)
+        thread->count = 0;
+
+    return pallene_tracer_sink_add(_pallene_tracer_latency_sink, NULL);
+}
+
+PT_NOINSTRUMENT void pallene_tracer_latency_stop(void) {
+    pallene_tracer_sink_remove(_pallene_tracer_latency_sink, NULL);
+}
+
+/* Copies the histogram at `i` of the table, resetting it if asked. Returns false if
+   the entry is free. */
+static PT_NOINSTRUMENT bool _pallene_tracer_latency_copy(int i, pt_histogram_t *copy, bool reset) {
+    pt_histogram_t *histogram = &_pallene_tracer_latency_histograms[i];
+
+    copy->fn = __atomic_load_n(&histogram->fn, __ATOMIC_ACQUIRE);
+    if(copy->fn == NULL)
+        return false;
+
+#define _PALLENE_TRACER_LATENCY_TAKE(field)                                              \
+    (reset ? __atomic_exchange_n(&(field), 0, __ATOMIC_RELAXED)                          \
+        : __atomic_load_n(&(field), __ATOMIC_RELAXED))
+    copy->count = _PALLENE_TRACER_LATENCY_TAKE(histogram->count);
+    copy->sum = _PALLENE_TRACER_LATENCY_TAKE(histogram->sum);
+    copy->max = _PALLENE_TRACER_LATENCY_TAKE(histogram->max);
+    for(int b = 0; b < _PALLENE_TRACER_LATENCY_BUCKETS; b++)
+        copy->buckets[b] = _PALLENE_TRACER_LATENCY_TAKE(histogram->buckets[b]);
+#undef _PALLENE_TRACER_LATENCY_TAKE
+
+    return true;
+}
+
+/* Pushes the name of `fn`: where it is in `package.loaded`, as `luaL_traceback` names
+   functions, or its address. */
+static PT_NOINSTRUMENT void _pallene_tracer_latency_name(lua_State *L, lua_CFunction fn) {
+    int top = lua_gettop(L);
+
+    lua_getfield(L, LUA_REGISTRYINDEX, LUA_LOADED_TABLE);
+    lua_pushnil(L);
+    while(lua_next(L, top + 1) != 0) {
+        if(lua_type(L, -2) == LUA_TSTRING && lua_type(L, -1) == LUA_TTABLE) {
+            lua_pushnil(L);
+            while(lua_next(L, -2) != 0) {
+                if(lua_type(L, -2) == LUA_TSTRING && lua_tocfunction(L, -1) == fn) {
+                    const char *module = lua_tostring(L, -4);
+                    lua_pushfstring(L, "%s.%s", module, lua_tostring(L, -2));
+                    lua_replace(L, top + 1);
+                    lua_settop(L, top + 1);
+
+                    /* Globals go by their own name. */
+                    if(strncmp(lua_tostring(L, -1), LUA_GNAME ".", sizeof(LUA_GNAME)) == 0) {
+                        lua_pushstring(L, lua_tostring(L, -1) + sizeof(LUA_GNAME));
+                        lua_replace(L, top + 1);
+                    }
+                    return;
+                }
+                lua_pop(L, 1);
+            }
+        }
+        lua_pop(L, 1);
+    }
+
+    char address[2 + 2 * sizeof(uintptr_t) + 1];
+    snprintf(address, sizeof(address), "0x%jx", (uintmax_t) (uintptr_t) fn);
+    lua_pushstring(L, address);
+    lua_replace(L, top + 1);
+}
+
+/* Pushes the table of a histogram. Percentiles are the largest values of their
+   buckets, and no larger than the largest value seen. */
+static PT_NOINSTRUMENT void _pallene_tracer_latency_push(lua_State *L, const pt_histogram_t *histogram) {
+    static const struct {
+        const char *name;
+        uint64_t permille;
+    } percentiles[] = { { "p50", 500 }, { "p90", 900 }, { "p99", 990 }, { "p999", 999 } };
+
+    lua_createtable(L, 0, 8);
+    lua_pushinteger(L, (lua_Integer) histogram->count);
+    lua_setfield(L, -2, "count");
+    lua_pushnumber(L, (lua_Number) histogram->sum / 1e9);
+    lua_setfield(L, -2, "sum");
+    lua_pushnumber(L, (lua_Number) histogram->max / 1e9);
+    lua_setfield(L, -2, "max");
+
+    for(size_t p = 0; p < sizeof(percentiles) / sizeof(percentiles[0]); p++) {
+        uint64_t rank = (histogram->count * percentiles[p].permille + 999) / 1000;
+        uint64_t seen = 0, value = 0;
+
+        for(int b = 0; b < _PALLENE_TRACER_LATENCY_BUCKETS && histogram->count > 0; b++) {
+            seen += histogram->buckets[b];
+            if(seen >= (rank > 0 ? rank : 1)) {
+                value = _pallene_tracer_latency_upper(b);
+                break;
+            }
+        }
+
+        lua_pushnumber(L, (lua_Number) (value < histogram->max ? value : histogram->max) / 1e9);
+        lua_setfield(L, -2, percentiles[p].name);
+    }
+
+    lua_newtable(L);
+    for(int b = 0; b < _PALLENE_TRACER_LATENCY_BUCKETS; b++) {
+        if(histogram->buckets[b] > 0) {
+            lua_pushinteger(L, (lua_Integer) histogram->buckets[b]);
+            lua_rawseti(L, -2, (lua_Integer) _pallene_tracer_latency_upper(b));
+        }
+    }
+    lua_setfield(L, -2, "buckets");
+}
+
+PT_NOINSTRUMENT int pallene_tracer_latency_snapshot(lua_State *L) {
+    bool reset = lua_toboolean(L, 1);
+    pt_histogram_t *copy = (pt_histogram_t *) lua_newuserdatauv(L, sizeof(pt_histogram_t), 0);
+    lua_newtable(L);
+
+    for(int i = 0; i < PALLENE_TRACER_LATENCY_FNS; i++) {
+        if(!_pallene_tracer_latency_copy(i, copy, reset))
+            continue;
+
+        _pallene_tracer_latency_name(L, copy->fn);
+        _pallene_tracer_latency_push(L, copy);
+        lua_rawset(L, -3);
+    }
+
+    return 1;
+}
+
+/* Adds the histograms of snapshots by name, in full userdata, then pushes them. */
+PT_NOINSTRUMENT int pallene_tracer_latency_merge(lua_State *L) {
+    int n = lua_gettop(L);
+    for(int i = 1; i <= n; i++)
+        luaL_checktype(L, i, LUA_TTABLE);
+
+    lua_newtable(L);    /* Name => histogram, at n + 1. */
+    for(int i = 1; i <= n; i++) {
+        lua_pushnil(L);
+        while(lua_next(L, i) != 0) {
+            luaL_argcheck(L, lua_type(L, -1) == LUA_TTABLE, i, "not a snapshot");
+
+            lua_pushvalue(L, -2);
+            if(lua_rawget(L, n + 1) == LUA_TNIL) {
+                lua_pop(L, 1);
+                memset(lua_newuserdatauv(L, sizeof(pt_histogram_t), 0), 0, sizeof(pt_histogram_t));
+                lua_pushvalue(L, -3);
+                lua_pushvalue(L, -2);
+                lua_rawset(L, n + 1);
+            }
+            pt_histogram_t *histogram = (pt_histogram_t *) lua_touserdata(L, -1);
+
+            lua_getfield(L, -2, "count");
+            histogram->count += (uint64_t) lua_tointeger(L, -1);
+            lua_getfield(L, -3, "sum");
+            histogram->sum += (uint64_t) (lua_tonumber(L, -1) * 1e9 + 0.5);
+            lua_getfield(L, -4, "max");
+            uint64_t max = (uint64_t) (lua_tonumber(L, -1) * 1e9 + 0.5);
+            histogram->max = max > histogram->max ? max : histogram->max;
+            lua_pop(L, 3);
+
+            /* Buckets are found by their largest value. */
+            if(lua_getfield(L, -2, "buckets") == LUA_TTABLE) {
+                lua_pushnil(L);
+                while(lua_next(L, -2) != 0) {
+                    if(lua_isinteger(L, -2) && lua_tointeger(L, -2) >= 0)
+                        histogram->buckets[_pallene_tracer_latency_bucket((uint64_t) lua_tointeger(L, -2))]
+                            += (uint64_t) lua_tointeger(L, -1);
+                    lua_pop(L, 1);
+                }
+            }
+            lua_pop(L, 3);    /* Buckets, histogram and the snapshot's. */
+        }
+    }
+
+    lua_newtable(L);
+    lua_pushnil(L);
+    while(lua_next(L, n + 1) != 0) {
+        lua_pushvalue(L, -2);
+        _pallene_tracer_latency_push(L, (const pt_histogram_t *) lua_touserdata(L, -2));
+        lua_rawset(L, n + 2);
+        lua_pop(L, 1);
+    }
+
+    return 1;
+}
+
+/* Writes a label value, escaped. */
+static PT_NOINSTRUMENT void _pallene_tracer_latency_label(FILE *file, const char *value) {
+    for(; *value != '\0'; value++) {
+        if(*value == '\\' || *value == '"')
+            fputc('\\', file);
+        if(*value == '\n')
+            fputs("\\n", file);
+        else
+            fputc(*value, file);
+    }
+}
+
+/* Buckets are cumulative in Prometheus. Only those holding values are written, the
+   last one is "+Inf". */
+PT_NOINSTRUMENT bool pallene_tracer_latency_write(lua_State *L, FILE *file) {
+    pt_histogram_t *copy = (pt_histogram_t *) malloc(sizeof(pt_histogram_t));
+    if(copy == NULL)
+        return false;
+
+    fprintf(file, "# HELP pallene_tracer_latency_seconds Latency of Lua interface functions.\n"
+        "# TYPE pallene_tracer_latency_seconds histogram\n");
+
+    for(int i = 0; i < PALLENE_TRACER_LATENCY_FNS; i++) {
+        if(!_pallene_tracer_latency_copy(i, copy, false))
+            continue;
+
+        char address[2 + 2 * sizeof(uintptr_t) + 1];
+        const char *name = address;
+        if(L != NULL) {
+            _pallene_tracer_latency_name(L, copy->fn);
+            name = lua_tostring(L, -1);
+        } else {
+            snprintf(address, sizeof(address), "0x%jx", (uintmax_t) (uintptr_t) copy->fn);
+        }
+
+        uint64_t seen = 0;
+        for(int b = 0; b < _PALLENE_TRACER_LATENCY_BUCKETS - 1; b++) {
+            if(copy->buckets[b] == 0)
+                continue;
+
+            seen += copy->buckets[b];
+            fprintf(file, "pallene_tracer_latency_seconds_bucket{fn=\"");
+            _pallene_tracer_latency_label(file, name);
+            fprintf(file, "\",le=\"%.9g\"} %llu\n", (double) _pallene_tracer_latency_upper(b) / 1e9,
+                (unsigned long long) seen);
+        }
+
+        const char *series[] = { "_bucket", "_sum", "_count" };
+        for(int s = 0; s < 3; s++) {
+            fprintf(file, "pallene_tracer_latency_seconds%s{fn=\"", series[s]);
+            _pallene_tracer_latency_label(file, name);
+            if(s == 0)
+                fprintf(file, "\",le=\"+Inf\"} %llu\n", (unsigned long long) copy->count);
+            else if(s == 1)
+                fprintf(file, "\"} %.9f\n", (double) copy->sum / 1e9);
+            else
+                fprintf(file, "\"} %llu\n", (unsigned long long) copy->count);
+        }
+
+        if(L != NULL)
+            lua_pop(L, 1);
+    }
+
+    uint64_t dropped = __atomic_load_n(&_pallene_tracer_latency_table.dropped, __ATOMIC_RELAXED);
+    if(dropped > 0)
+        fprintf(file, "# %llu calls dropped, the table of histograms is full\n", (unsigned long long) dropped);
+
+    free(copy);
+    return fflush(file) == 0 && !ferror(file);
+}
+#endif // PT_LATENCY
+
+#ifdef PT_ACCOUNTING
+/* What was accounted to a context. Times are in nanoseconds. */
+typedef struct pt_account {
+    bool used;                           /* Set after `context` is written. */
+    int64_t context;
+    uint64_t calls;
+    uint64_t cpu;
+} pt_account_t;
+
+/* A Lua interface call being accounted for. It is paused while the calls nested in it
+   run. */
+typedef struct pt_accounting_call {
+    const pt_fnstack_t *fnstack;
+    int depth;
+    pt_account_t *account;
+    uint64_t start;
+} pt_accounting_call_t;
+
+/* The calls a thread is accounting for. */
+typedef struct pt_accounting_thread {
+    int count;
+    pt_accounting_call_t calls[PALLENE_TRACER_ACCOUNTING_DEPTH];
+} pt_accounting_thread_t;
+
+static pthread_once_t _pallene_tracer_accounting_once = PTHREAD_ONCE_INIT;
+static pthread_key_t _pallene_tracer_accounting_key;
+
+/* The accounts, keyed by context. */
+static pt_account_t _pallene_tracer_accounting_accounts[PALLENE_TRACER_ACCOUNTING_CONTEXTS];
+static pt_table_t _pallene_tracer_accounting_table = _PALLENE_TRACER_TABLE(_pallene_tracer_accounting_accounts);
+
+/* CPU time of the calling thread. */
+static PT_NOINSTRUMENT uint64_t _pallene_tracer_accounting_now(void) {
+#ifdef CLOCK_THREAD_CPUTIME_ID
+    struct timespec ts;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &ts);
+    return (uint64_t) ts.tv_sec * 1000000000u + (uint64_t) ts.tv_nsec;
+#else
+    return (uint64_t) clock() * (1000000000u / CLOCKS_PER_SEC);
+#endif // CLOCK_THREAD_CPUTIME_ID
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_accounting_key_create(void) {
+    pthread_key_create(&_pallene_tracer_accounting_key, free);
+}
+
+/* The calls the calling thread is accounting for, NULL if it cannot account any. */
+static PT_NOINSTRUMENT pt_accounting_thread_t *_pallene_tracer_accounting_thread(void) {
+    pthread_once(&_pallene_tracer_accounting_once, _pallene_tracer_accounting_key_create);
+
+    pt_accounting_thread_t *thread =
+        (pt_accounting_thread_t *) pthread_getspecific(_pallene_tracer_accounting_key);
+    if(luai_unlikely(thread == NULL)) {
+        thread = (pt_accounting_thread_t *) calloc(1, sizeof(pt_accounting_thread_t));
+        if(thread != NULL && pthread_setspecific(_pallene_tracer_accounting_key, thread) != 0) {
+            free(thread);
+            thread = NULL;
+        }
+    }
+
+    return thread;
+}
+
+/* The key of an account is its context. */
+static PT_NOINSTRUMENT pt_table_match_t _pallene_tracer_accounting_match(const void *entry, const void *key) {
+    const pt_account_t *account = (const pt_account_t *) entry;
+
+    if(!__atomic_load_n(&account->used, __ATOMIC_ACQUIRE))
+        return _PALLENE_TRACER_TABLE_FREE;
+    return account->context == *(const int64_t *) key
+        ? _PALLENE_TRACER_TABLE_FOUND : _PALLENE_TRACER_TABLE_OTHER;
+}
+
+static PT_NOINSTRUMENT void _pallene_tracer_accounting_claim(void *entry, const void *key) {
+    pt_account_t *account = (pt_account_t *) entry;
+
+    account->context = *(const int64_t *) key;
+    __atomic_store_n(&account->used, true, __ATOMIC_RELEASE);
+}
+
+/* Finds the account of `context`, claiming an entry for it the first time. NULL if the
+   table is full. */
+static PT_NOINSTRUMENT pt_account_t *_pallene_tracer_accounting_account(int64_t context) {
+    return (pt_account_t *) _pallene_tracer_table_find(&_pallene_tracer_accounting_table,
+        (size_t) ((uint64_t) context * 0x9E3779B97F4A7C15u >> 32), &context,
+        _pallene_tracer_accounting_match, _pallene_tracer_accounting_claim);
+}
+
+/* Adds the time the call on top of the thread ran since `start` to its account. */
+static PT_NOINSTRUMENT void _pallene_tracer_accounting_charge(pt_accounting_thread_t *thread, uint64_t now) {
+    pt_accounting_call_t *call = &thread->calls[thread->count - 1];
+    __atomic_add_fetch(&call->account->cpu, now - call->start, __ATOMIC_RELAXED);
+}
+
+/* A Lua interface call is accounted to the context of its call-stack when it is
+   entered, from then until its finalizer unwinds it, less the Lua interface calls
+   nested in it. */
+static PT_NOINSTRUMENT void _pallene_tracer_accounting_sink(void *ud, pt_event_t event, pt_fnstack_t *fnstack,
+    const pt_frame_t *frame) {
+    (void) ud;
+
+    switch(event) {
+        case PALLENE_TRACER_EVENT_ENTER: {
+            if(frame == NULL || frame->type != PALLENE_TRACER_FRAME_TYPE_LUA)
+                return;
+
+            pt_accounting_thread_t *thread = _pallene_tracer_accounting_thread();
+            if(thread == NULL || thread->count == PALLENE_TRACER_ACCOUNTING_DEPTH)
+                return;
+
+            pt_account_t *account = _pallene_tracer_accounting_account(fnstack->context);
+            if(account == NULL)
+                return;
+            __atomic_add_fetch(&account->calls, 1, __ATOMIC_RELAXED);
+
+            uint64_t now = _pallene_tracer_accounting_now();
+            if(thread->count > 0)
+                _pallene_tracer_accounting_charge(thread, now);
+
+            pt_accounting_call_t *call = &thread->calls[thread->count++];
+            call->fnstack = fnstack;
+            call->depth = fnstack->count;
+            call->account = account;
+            call->start = now;
+            break;
+        }
+
+        /* The topmost Lua interface frame goes, and the call below it resumes. */
+        case PALLENE_TRACER_EVENT_UNWIND: {
+            pt_accounting_thread_t *thread = _pallene_tracer_accounting_thread();
+            int depth = fnstack->top_lua < 0 ? 0 : fnstack->top_lua;
+            if(thread == NULL || thread->count == 0)
+                return;
+
+            uint64_t now = _pallene_tracer_accounting_now();
+            while(thread->count > 0 && thread->calls[thread->count - 1].fnstack == fnstack
+                && thread->calls[thread->count - 1].depth > depth) {
+                _pallene_tracer_accounting_charge(thread, now);
+                thread->count--;
+            }
+
+            if(thread->count > 0)
+                thread->calls[thread->count - 1].start = now;
+            break;
+        }
+
+        default:
+            break;
+    }
+}
+
+/* Forgets the accounts and starts accounting. Threads forget the calls they were
+   accounting for the next time they enter a frame. */
+PT_NOINSTRUMENT bool pallene_tracer_accounting_start(void) {
+    pallene_tracer_accounting_stop();
+    _pallene_tracer_table_clear(&_pallene_tracer_accounting_table);
+
+    pt_accounting_thread_t *thread = _pallene_tracer_accounting_thread();
+    if(thread != NULL)
+        thread->count = 0;
+
+    return pallene_tracer_sink_add(_pallene_tracer_accounting_sink, NULL);
+}
+
+PT_NOINSTRUMENT void pallene_tracer_accounting_stop(void) {
+    pallene_tracer_sink_remove(_pallene_tracer_accounting_sink, NULL);
+}
+
+/* Contexts with no calls since the last reset are left out. */
+PT_NOINSTRUMENT int pallene_tracer_accounting_stats(lua_State *L) {
+    bool reset = lua_toboolean(L, 1);
+    lua_newtable(L);
+
+    for(int i = 0; i < PALLENE_TRACER_ACCOUNTING_CONTEXTS; i++) {
+        pt_account_t *account = &_pallene_tracer_accounting_accounts[i];
+        if(!__atomic_load_n(&account->used, __ATOMIC_ACQUIRE))
+            continue;
+
+        uint64_t calls = reset ? __atomic_exchange_n(&account->calls, 0, __ATOMIC_RELAXED)
+            : __atomic_load_n(&account->calls, __ATOMIC_RELAXED);
+        uint64_t cpu = reset ? __atomic_exchange_n(&account->cpu, 0, __ATOMIC_RELAXED)
+            : __atomic_load_n(&account->cpu, __ATOMIC_RELAXED);
+        if(calls == 0 && cpu == 0)
+            continue;
+
+        lua_createtable(L, 0, 2);
+        lua_pushinteger(L, (lua_Integer) calls);
+        lua_setfield(L, -2, "calls");
+        lua_pushnumber(L, (lua_Number) cpu / 1e9);
+        lua_setfield(L, -2, "cpu");
+        lua_rawseti(L, -2, (lua_Integer) account->context);
+    }
+
+    return 1;
+}
+#endif // PT_ACCOUNTING
+
+#ifdef PT_POOL
+/* Reports the memory held by the pool. */
+PT_NOINSTRUMENT void pallene_tracer_pool_stats(pt_pool_stats_t *stats) {
+    pthread_mutex_lock(&_pallene_tracer_pool_mutex);
+    size_t total = _pallene_tracer_pool_total;
+    stats->high_water = _pallene_tracer_pool_high_water;
+    pthread_mutex_unlock(&_pallene_tracer_pool_mutex);
+
+    stats->idle = __atomic_load_n(&_pallene_tracer_pool_idle, __ATOMIC_RELAXED);
+    stats->in_use = total > stats->idle ? total - stats->idle : 0;
+}
+
+/* Frees the idle buffers of the process-wide list. */
+PT_NOINSTRUMENT void pallene_tracer_pool_trim(void) {
+    pthread_mutex_lock(&_pallene_tracer_pool_mutex);
+    pt_pool_node_t *node = _pallene_tracer_pool_list;
+    _pallene_tracer_pool_list = NULL;
+    _pallene_tracer_pool_listed = 0;
+    while(node != NULL) {
+        pt_pool_node_t *next = node->next;
+        _pallene_tracer_pool_total -= node->size;
+        __atomic_sub_fetch(&_pallene_tracer_pool_idle, node->size, __ATOMIC_RELAXED);
+        free(node);
+        node = next;
+    }
+    pthread_mutex_unlock(&_pallene_tracer_pool_mutex);
+}
+#endif // PT_POOL
+
+#ifdef PT_INSTRUMENT
+/* The `-finstrument-functions` hooks. Only the function address is stored, names are
+   resolved by whoever prints the frame. */
+/* Lua errors `longjmp` over the exit hooks. A native frame found deeper in the C stack
+   than the function being entered (or exited) was skipped that way, so we drop it. */
+#ifdef __cplusplus
+extern "C" {
+#endif // __cplusplus
+
+PT_NOINSTRUMENT void __cyg_profile_func_enter(void *fn, void *call_site) {
+    pt_fnstack_t *fnstack = _pallene_tracer_instrumented_stack();
+    uintptr_t sp = (uintptr_t) __builtin_frame_address(0);
+    (void) call_site;
+
+    if(fnstack == NULL)
+        return;
+
+    while(fnstack->count > 0 && fnstack->count <= fnstack->capacity
+        && fnstack->stack[fnstack->count - 1].type == PALLENE_TRACER_FRAME_TYPE_NATIVE
+        && fnstack->stack[fnstack->count - 1].shared.native.sp <= sp)
+        fnstack->count--;
+
+    pt_frame_t frame;
+    frame.type = PALLENE_TRACER_FRAME_TYPE_NATIVE;
+    frame.line = 0;
+    frame.shared.native.fn_addr = fn;
+    frame.shared.native.sp = sp;
+    pallene_tracer_frameenter(fnstack, &frame);
+}
+
+PT_NOINSTRUMENT void __cyg_profile_func_exit(void *fn, void *call_site) {
+    pt_fnstack_t *fnstack = _pallene_tracer_instrumented_stack();
+    uintptr_t sp = (uintptr_t) __builtin_frame_address(0);
+    (void) call_site;
+
+    if(fnstack == NULL || fnstack->count == 0)
+        return;
+
+    if(fnstack->count > fnstack->capacity) {
+        fnstack->count--;
+        return;
+    }
+
+    pt_frame_t *top = &fnstack->stack[fnstack->count - 1];
+    while(fnstack->count > 1 && top->type == PALLENE_TRACER_FRAME_TYPE_NATIVE
+        && top->shared.native.fn_addr != fn && top->shared.native.sp < sp) {
+        fnstack->count--;
+        top--;
+    }
+
+    /* The frame may already be gone, removed by a finalizer. */
+    if(top->type == PALLENE_TRACER_FRAME_TYPE_NATIVE && top->shared.native.fn_addr == fn)
+        fnstack->count--;
+}
+
+#ifdef __cplusplus
+}
+#endif // __cplusplus
+#endif // PT_INSTRUMENT
+
 /* ---------------- DEFINITIONS END ---------------- */
 
 #endif
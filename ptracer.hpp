@@ -0,0 +1,190 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* C++ front-end for `ptracer.h`. Frames are scope guards: C interface frames are popped
+   by the destructor, so there is no FRAMEEXIT to forget. Everything compiles to nothing
+   if `PT_DEBUG` is not defined. */
+
+/* If Lua is built as C (the default), its headers need C linkage. Define `PT_LUA_CXX`
+   if Lua is built as C++. Then Lua errors are C++ exceptions and the destructors of the
+   scope guards run while unwinding. Otherwise Lua errors `longjmp`, which is undefined
+   behavior over a function with objects of non-trivial destructors, `c_frame` guards
+   included. Functions a Lua error may leave hold only trivially destructible objects:
+   they enter their C interface frame with `PALLENE_TRACER_CXX_C_FRAMEENTER_TRIVIAL`,
+   and the finalizer of the Lua interface frame pops it on errors, as in C. C++
+   exceptions are caught before they reach Lua. */
+
+#ifndef PALLENE_TRACER_HPP
+#define PALLENE_TRACER_HPP
+
+#ifndef PT_LUA_CXX
+extern "C" {
+#include <lua.h>
+#include <lauxlib.h>
+}
+#endif // PT_LUA_CXX
+
+#include "ptracer.h"
+
+#if __cplusplus >= 202002L
+#include <source_location>
+#endif
+
+/* ---------------- MACRO DEFINITIONS ---------------- */
+
+/* Use this macro to declare a `constexpr` descriptor for the current function. */
+/* E.U.: `PALLENE_TRACER_CXX_DETAILS(_details);` */
+#define PALLENE_TRACER_CXX_DETAILS(var_name)                                    \
+static constexpr PT_DETAILS_SECTION pt_fn_details_t var_name = { __func__, __FILE__ }
+
+#if defined(PT_DEBUG) && (defined(PT_UNWIND) || PT_LEVEL < PALLENE_TRACER_LEVEL_C)
+/* Only the Lua interface frames are kept, see `PT_UNWIND` and `PT_LEVEL` in `ptracer.h`. */
+#define PALLENE_TRACER_CXX_LUA_FRAMEENTER(L, fnstack, fnptr, location)          \
+pallene_tracer::lua_frame _pallene_tracer_lua_frame(L, fnstack, fnptr, location)
+#define PALLENE_TRACER_CXX_C_FRAMEENTER(fnstack)     (void) (fnstack)
+#define PALLENE_TRACER_CXX_C_FRAMEENTER_TRIVIAL(fnstack)     (void) (fnstack)
+#define PALLENE_TRACER_CXX_SETLINE(fnstack)
+#define PALLENE_TRACER_CXX_SETINLINED(fnstack, chain)
+
+#elif defined(PT_DEBUG)
+/* Use this macro at the beginning of Lua interface functions. The finalizer object is
+   found at `location`, same as in `PALLENE_TRACER_LUA_FRAMEENTER`. */
+#define PALLENE_TRACER_CXX_LUA_FRAMEENTER(L, fnstack, fnptr, location)          \
+pallene_tracer::lua_frame _pallene_tracer_lua_frame(L, fnstack, fnptr, location)
+
+/* Use this macro at the beginning of C interface functions. The frame is popped when
+   the function returns, however it returns. */
+#define PALLENE_TRACER_CXX_C_FRAMEENTER(fnstack)                                \
+PALLENE_TRACER_CXX_DETAILS(_pallene_tracer_details);                            \
+_PALLENE_TRACER_COUNT(_pallene_tracer_counter, _pallene_tracer_details);        \
+pallene_tracer::c_frame _pallene_tracer_c_frame(fnstack, &_pallene_tracer_details)
+
+/* Same, without a guard, for the functions a Lua error built as C may leave. Pop the
+   frame with `PALLENE_TRACER_C_FRAMEEXIT`. */
+#define PALLENE_TRACER_CXX_C_FRAMEENTER_TRIVIAL(fnstack)                        \
+PALLENE_TRACER_CXX_DETAILS(_pallene_tracer_details);                            \
+_PALLENE_TRACER_COUNT(_pallene_tracer_counter, _pallene_tracer_details);        \
+pallene_tracer::c_frameenter(fnstack, &_pallene_tracer_details)
+
+/* Sets the line number following this one to the topmost frame. */
+#if PT_LEVEL < PALLENE_TRACER_LEVEL_LINE
+#define PALLENE_TRACER_CXX_SETLINE(fnstack)
+#else
+#define PALLENE_TRACER_CXX_SETLINE(fnstack)                                     \
+pallene_tracer::setline(fnstack, __LINE__ + 1)
+#endif // PT_LEVEL
+
+/* Enters the chain of calls inlined into the function, see `pallene_tracer_setinlined`. */
+#define PALLENE_TRACER_CXX_SETINLINED(fnstack, chain)                           \
+pallene_tracer::setinlined(fnstack, chain)
+
+#else
+#define PALLENE_TRACER_CXX_LUA_FRAMEENTER(L, fnstack, fnptr, location)
+#define PALLENE_TRACER_CXX_C_FRAMEENTER(fnstack)
+#define PALLENE_TRACER_CXX_C_FRAMEENTER_TRIVIAL(fnstack)
+#define PALLENE_TRACER_CXX_SETLINE(fnstack)
+#define PALLENE_TRACER_CXX_SETINLINED(fnstack, chain)
+#endif // PT_DEBUG
+
+/* ---------------- MACRO DEFINITIONS END ---------------- */
+
+namespace pallene_tracer {
+
+#ifdef PT_DEBUG
+
+/* Sets line number to the topmost frame in the stack. */
+inline void setline(pt_fnstack_t *fnstack, int line) noexcept {
+    pallene_tracer_setline(fnstack, line);
+}
+
+#if __cplusplus >= 202002L
+/* Sets the line number following the caller's line to the topmost frame. */
+inline void setline(pt_fnstack_t *fnstack,
+    std::source_location loc = std::source_location::current()) noexcept {
+    pallene_tracer_setline(fnstack, static_cast<int>(loc.line()) + 1);
+}
+#endif
+
+/* Enters the chain of calls inlined into the function of the topmost frame, or leaves
+   it if `chain` is NULL. */
+inline void setinlined(pt_fnstack_t *fnstack, const pt_inlined_t *chain) noexcept {
+    pallene_tracer_setinlined(fnstack, chain);
+}
+
+/* Scope guard for Lua interface frames. The frame is popped by the to-be-closed
+   finalizer object, which also runs when Lua errors unwind by exception. */
+class lua_frame {
+public:
+    lua_frame(lua_State *L, pt_fnstack_t *fnstack, lua_CFunction fnptr, int location) {
+        pt_frame_t frame = {};
+        frame.type = PALLENE_TRACER_FRAME_TYPE_LUA;
+        frame.shared.c_fnptr = fnptr;
+
+        _PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, &frame, location);
+    }
+
+    lua_frame(const lua_frame &) = delete;
+    lua_frame &operator=(const lua_frame &) = delete;
+};
+
+/* Enters a C interface frame, left to `PALLENE_TRACER_C_FRAMEEXIT`. */
+inline void c_frameenter(pt_fnstack_t *fnstack, const pt_fn_details_t *details) noexcept {
+    pt_frame_t frame = {};
+    frame.type = PALLENE_TRACER_FRAME_TYPE_C;
+    frame.shared.details = details;
+
+    pallene_tracer_frameenter(fnstack, &frame);
+}
+
+/* Scope guard for C interface frames. */
+class c_frame {
+public:
+    c_frame(pt_fnstack_t *fnstack, const pt_fn_details_t *details) noexcept
+        : fnstack(fnstack) {
+        pt_frame_t frame = {};
+        frame.type = PALLENE_TRACER_FRAME_TYPE_C;
+        frame.shared.details = details;
+
+        pallene_tracer_frameenter(fnstack, &frame);
+    }
+
+    ~c_frame() {
+        pallene_tracer_frameexit(fnstack);
+    }
+
+    c_frame(const c_frame &) = delete;
+    c_frame &operator=(const c_frame &) = delete;
+
+    void setline(int line) noexcept {
+        pallene_tracer_setline(fnstack, line);
+    }
+
+private:
+    pt_fnstack_t *fnstack;
+};
+
+#else
+/* Release mode. The guards are empty and optimized away. */
+
+inline void setline(pt_fnstack_t *, int) noexcept {}
+inline void setinlined(pt_fnstack_t *, const pt_inlined_t *) noexcept {}
+
+class lua_frame {
+public:
+    lua_frame(lua_State *, pt_fnstack_t *, lua_CFunction, int) noexcept {}
+};
+
+class c_frame {
+public:
+    c_frame(pt_fnstack_t *, const pt_fn_details_t *) noexcept {}
+    void setline(int) noexcept {}
+};
+#endif // PT_DEBUG
+
+} // namespace pallene_tracer
+
+#endif // PALLENE_TRACER_HPP
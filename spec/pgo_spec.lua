@@ -0,0 +1,84 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local util = require "spec.util"
+
+-- Runs tools/pt-pgo.lua on a folded profile of pt-spy and calls written by pt-lua,
+-- and returns the order file and the header it writes.
+local function run_pgo(options, stacks, calls)
+    assert(util.execute("make --quiet pt-lua"))
+
+    local stacks_file, calls_file = os.tmpname(), os.tmpname()
+    local order_file, header_file = os.tmpname(), os.tmpname()
+    for path, content in pairs({ [stacks_file] = stacks, [calls_file] = calls }) do
+        local file = assert(io.open(path, "w"))
+        file:write(content)
+        file:close()
+    end
+
+    local ok, _, _, err_content = util.outputs_of_execute("./pt-lua tools/pt-pgo.lua "
+        .. options .. " --order " .. util.shell_quote(order_file)
+        .. " --header " .. util.shell_quote(header_file)
+        .. " " .. util.shell_quote(stacks_file) .. " " .. util.shell_quote(calls_file))
+    assert(ok, err_content)
+
+    local order = assert(util.get_file_contents(order_file))
+    local header = assert(util.get_file_contents(header_file))
+    header = header:gsub(stacks_file:gsub("%p", "%%%0"), "STACKS")
+                   :gsub(calls_file:gsub("%p", "%%%0"), "CALLS")
+    for _, path in ipairs({ stacks_file, calls_file, order_file, header_file }) do
+        os.remove(path)
+    end
+    return order, header
+end
+
+-- `fib` and `leaf` take 95% of the samples, `setup` is called once but sampled, and
+-- `rare` is never sampled and called once among 1301 calls.
+local stacks = [[
+<main> (main.lua);fib (fibonacci.c);fib (fibonacci.c) 80
+<main> (main.lua);fib (fibonacci.c);leaf (fibonacci.c) 15
+<main> (main.lua);setup (fibonacci.c) 4
+fibonacci.so+0x1139 1
+]]
+
+local calls = [[
+# pallene-tracer calls
+fib 1000
+leaf 299
+setup 1
+rare 1
+]]
+
+local header = [[
+/* Generated by tools/pt-pgo.lua from STACKS CALLS. */
+/* See `PALLENE_TRACER_PGO` in ptracer.h. */
+
+#define PT_PGO_fib hot
+#define PT_PGO_leaf hot
+#define PT_PGO_rare cold
+]]
+
+it("Profile-guided order", function()
+    local order, got_header = run_pgo("", stacks, calls)
+    assert.are.same("fib\nleaf\nsetup\n", order)
+    assert.are.same(header, got_header)
+end)
+
+it("Profile-guided order of sections", function()
+    local order = run_pgo("--sections", stacks, calls)
+    assert.are.same(".text.hot.fib\n.text.fib\n.text.hot.leaf\n.text.leaf\n.text.setup\n", order)
+end)
+
+it("Profile-guided hints from calls alone", function()
+    local _, got_header = run_pgo("--hot 0.5", "", calls)
+    assert.are.same([[
+/* Generated by tools/pt-pgo.lua from STACKS CALLS. */
+/* See `PALLENE_TRACER_PGO` in ptracer.h. */
+
+#define PT_PGO_fib hot
+#define PT_PGO_rare cold
+#define PT_PGO_setup cold
+]], got_header)
+end)
@@ -0,0 +1,41 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.accounting.module"
+
+-- Requests of two tenants, on coroutines of the same Lua state.
+local function request(calls)
+    return coroutine.wrap(function()
+        for n = 1, calls do
+            module.sum_fn(n)
+            coroutine.yield()
+        end
+    end)
+end
+
+local requests = { [7] = request(3), [42] = request(1) }
+
+pallene_tracer_accounting(true)
+module.sum_fn(1)
+for _ = 1, 3 do
+    for tenant, resume in pairs(requests) do
+        local previous = pallene_tracer_context(tenant)
+        pcall(resume)
+        pallene_tracer_context(previous)
+    end
+end
+local stats = pallene_tracer_accounting_stats(true)
+pallene_tracer_accounting(false)
+
+-- The times depend on the machine.
+local calls = {}
+for context, account in pairs(stats) do
+    assert(account.cpu >= 0)
+    table.insert(calls, context.."="..account.calls)
+end
+table.sort(calls)
+
+error(table.concat(calls, " ").." after="..tostring(next(pallene_tracer_accounting_stats()))
+    .." context="..pallene_tracer_context())
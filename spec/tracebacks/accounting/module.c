@@ -0,0 +1,28 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include "../module_include.h"
+#include "../module_sum.h"
+
+int luaopen_spec_tracebacks_accounting_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- sum_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, sum_fn, 2);
+    lua_setfield(L, -2, "sum_fn");
+
+    return 1;
+}
@@ -0,0 +1,20 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.budget.module"
+
+-- Lua code is stopped by the count hook.
+local ok, msg = pallene_tracer_budget(nil, 0.05, function() while true do end end)
+assert(not ok and msg:find("budget exceeded (time)", 1, true), msg)
+
+function lua_fn()
+    module.spin_fn()
+end
+
+-- C code is stopped when it sets a line.
+local ok, msg = pallene_tracer_budget(100000, nil, lua_fn)
+assert(not ok)
+io.stderr:write(msg, "\n")
+os.exit(false)
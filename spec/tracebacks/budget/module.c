@@ -0,0 +1,49 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include "../module_include.h"
+
+/* Never returns, unless the budget runs out. */
+void spin(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+
+    unsigned long n = 0;
+    for(;;) {
+        MODULE_C_SETLINE();
+        n++;
+    }
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int spin_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(spin_fn);
+
+    MODULE_C_SETLINE();
+    spin(L);
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_budget_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- spin_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, spin_fn, 2);
+    lua_setfield(L, -2, "spin_fn");
+
+    return 1;
+}
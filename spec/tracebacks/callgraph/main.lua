@@ -0,0 +1,22 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.callgraph.module"
+
+pallene_tracer_callgraph(true)
+module.sum_fn(3)
+module.sum_fn(4)
+pallene_tracer_callgraph(false)
+module.sum_fn(1)
+
+-- The edges come in the order of the table, and the times depend on the machine.
+local edges = {}
+for _, edge in ipairs(pallene_tracer_callgraph_edges()) do
+    assert(edge.time >= 0)
+    table.insert(edges, (edge.caller or "lua").."->"..edge.callee.."="..edge.calls)
+end
+table.sort(edges)
+
+error(table.concat(edges, " "))
@@ -0,0 +1,60 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include "../module_include.h"
+
+int leaf(lua_State *L, int n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_FRAMEEXIT();
+    return n;
+}
+
+int down(lua_State *L, int n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    int sum = n > 0 ? down(L, n - 1) : leaf(L, 0);
+
+    MODULE_C_FRAMEEXIT();
+    return sum;
+}
+
+int sum_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(sum_fn);
+
+    int n = (int) luaL_checkinteger(L, 1), sum = 0;
+    for(int i = 1; i <= n; i++) {
+        MODULE_C_SETLINE();
+        sum += leaf(L, i);
+    }
+
+    MODULE_C_SETLINE();
+    sum += down(L, 2);
+
+    lua_pushinteger(L, sum);
+    return 1;
+}
+
+int luaopen_spec_tracebacks_callgraph_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- sum_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, sum_fn, 2);
+    lua_setfield(L, -2, "sum_fn");
+
+    return 1;
+}
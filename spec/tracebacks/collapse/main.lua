@@ -0,0 +1,12 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.collapse.module"
+
+function lua_fn(depth)
+    module.module_fn(depth)
+end
+
+lua_fn(10000)
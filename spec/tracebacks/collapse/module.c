@@ -0,0 +1,92 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* Runaway recursion. Every frame looks the same in the traceback, except the last one. */
+void recurse(lua_State *L, int depth) {
+    MODULE_C_FRAMEENTER();
+
+    if(depth > 0) {
+        MODULE_C_SETLINE();
+        recurse(L, depth - 1);
+    } else {
+        MODULE_C_SETLINE();
+        luaL_error(L, "Recursion bottomed out!");
+    }
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int module_fn_lua(lua_State *L) {
+    int top = lua_gettop(L);
+    MODULE_LUA_FRAMEENTER(module_fn_lua);
+
+    /* Look at the macro definitions. */
+    if(luai_unlikely(top < 1))
+        luaL_error(L, "Expected atleast 1 parameter");
+
+    if(luai_unlikely(lua_isinteger(L, 1) == 0))
+        luaL_error(L, "Expected the first parameter to be an integer");
+
+    /* Dispatch. */
+    recurse(L, lua_tointeger(L, 1));
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_collapse_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* One very good way to integrate our stack userdatum and finalizer
+      object is by using Lua upvalues. */
+    /* ---- module_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    /* `pallene_tracer_init` function pushes the frameexit finalizer to the stack. */
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, module_fn_lua, 2);
+    lua_setfield(L, -2, "module_fn");
+
+    return 1;
+}
@@ -0,0 +1,29 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.counters.module"
+
+local function format(stats)
+    local names = {}
+    for name in pairs(stats) do
+        names[#names + 1] = name
+    end
+    table.sort(names)
+
+    local parts = {}
+    for _, name in ipairs(names) do
+        parts[#parts + 1] = name.."="..stats[name]
+    end
+    return "{"..table.concat(parts, " ").."}"
+end
+
+module.sum_fn(3)
+module.sum_fn(4)
+local first = format(pallene_tracer_stats())
+
+module.sum_fn(1)
+local second = format(pallene_tracer_stats())
+
+error(first.." "..second)
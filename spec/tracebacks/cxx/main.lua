@@ -0,0 +1,16 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.cxx.module"
+
+-- Returning normally must leave the call-stack balanced, and so must C++ exceptions:
+-- the frames of `countdown` they go through must not show up below.
+assert(module.countdown_fn(3) == 3)
+
+local function lua_fn(n)
+    return module.countdown_fn(n)
+end
+
+lua_fn(0)
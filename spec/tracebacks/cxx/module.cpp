@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+#include <cstdio>
+#include <stdexcept>
+#include <string>
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.hpp"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = static_cast<pt_fnstack_t *>(         \
+        lua_touserdata(L, lua_upvalueindex(1)))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_CXX_C_FRAMEENTER(fnstack)
+
+/* Lua is built as C: its errors `longjmp`, so the Lua interface function, which raises
+   them, holds no guard. */
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_CXX_LUA_FRAMEENTER(L, fnstack, fnptr,         \
+        lua_upvalueindex(2));                                    \
+    PALLENE_TRACER_CXX_C_FRAMEENTER_TRIVIAL(fnstack)
+
+#define MODULE_LUA_FRAMEEXIT()                                   \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* No FRAMEEXIT in C interface functions: the guards pop the frames, also when C++
+   exceptions go through them. */
+
+static void check_positive(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    if(n <= 0)
+        throw std::invalid_argument("Expected a positive number, got " + std::to_string(n));
+}
+
+static lua_Integer countdown(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    PALLENE_TRACER_CXX_SETLINE(fnstack);
+    check_positive(L, n);
+    if(n == 1)
+        return 1;
+
+    PALLENE_TRACER_CXX_SETLINE(fnstack);
+    return 1 + countdown(L, n - 1);
+}
+
+static int countdown_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(countdown_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+
+    /* The message outlives the exception, which is gone before the Lua error. */
+    char message[128] = "";
+    try {
+        PALLENE_TRACER_CXX_SETLINE(fnstack);
+        lua_pushinteger(L, countdown(L, n));
+    } catch(const std::exception &e) {
+        std::snprintf(message, sizeof(message), "%s", e.what());
+    }
+
+    if(message[0] != '\0') {
+        PALLENE_TRACER_CXX_SETLINE(fnstack);
+        luaL_error(L, "%s", message);
+    }
+
+    MODULE_LUA_FRAMEEXIT();
+    return 1;
+}
+
+extern "C" int luaopen_spec_tracebacks_cxx_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- countdown_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, countdown_fn, 2);
+    lua_setfield(L, -2, "countdown_fn");
+
+    return 1;
+}
@@ -0,0 +1,27 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Dumps its stacks on SIGQUIT, with coroutines the registry does not hold directly.
+local module = require "spec.tracebacks.dump.module"
+
+local function sleeper()
+    coroutine.yield()
+end
+
+-- Only the user value of a userdata holds it.
+local boxed = coroutine.create(sleeper)
+coroutine.resume(boxed)
+box = module.box_fn(boxed)
+boxed = nil
+
+-- Only a local of another coroutine holds it.
+holder = coroutine.create(function()
+    local held = coroutine.create(sleeper)
+    coroutine.resume(held)
+    coroutine.yield()
+end)
+coroutine.resume(holder)
+
+module.quit_fn()
@@ -0,0 +1,27 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- A child dumps its stacks on SIGQUIT and goes on.
+local out = os.tmpname()
+assert(os.execute("./pt-lua spec/tracebacks/dump/child.lua 2> " .. out))
+
+local file = io.open(out)
+local report = file:read("a")
+file:close()
+os.remove(out)
+
+-- Coroutines are found in no particular order, at addresses which change.
+local lines, threads = {}, {}
+for line in report:gsub("^\n", ""):gsub("%s+$", ""):gmatch("[^\n]+") do
+    if line:match("^thread 0x") then
+        table.insert(threads, (line:gsub("0x%x+", "0x...")))
+    elseif #threads > 0 then
+        threads[#threads] = threads[#threads] .. "\n" .. line
+    else
+        table.insert(lines, line)
+    end
+end
+table.sort(threads)
+error(table.concat(lines, "\n") .. "\n" .. table.concat(threads, "\n"))
@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Raises SIGQUIT in a Lua interface call, for the stack dumps of `pt-lua`. */
+
+#include <signal.h>
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+void signal_self(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    raise(SIGQUIT);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int quit_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(quit_fn);
+
+    MODULE_C_SETLINE();
+    signal_self(L);
+
+    return 0;
+}
+
+/* A userdata holding its argument as its user value. */
+int box_fn(lua_State *L) {
+    luaL_checkany(L, 1);
+    lua_newuserdatauv(L, 0, 1);
+    lua_pushvalue(L, 1);
+    lua_setiuservalue(L, -2, 1);
+
+    return 1;
+}
+
+int luaopen_spec_tracebacks_dump_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- quit_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, quit_fn, 2);
+    lua_setfield(L, -2, "quit_fn");
+
+    lua_pushcfunction(L, box_fn);
+    lua_setfield(L, -2, "box_fn");
+
+    return 1;
+}
@@ -0,0 +1,19 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Threads created before the module is loaded find the call-stack as well.
+local co = coroutine.wrap(function(n)
+    return lua_fn(n)
+end)
+
+local module = require "spec.tracebacks.extraspace.module"
+
+function lua_fn(n)
+    return module.half_fn(n)
+end
+
+assert(co(4) == 2)
+
+lua_fn(3)
@@ -0,0 +1,80 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* The call-stack is in the extra space of the thread, and the finalizer object in the
+   registry. The functions need no upvalues. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = PALLENE_TRACER_EXTRASPACE_FNSTACK(L)
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        PALLENE_TRACER_REGISTRY_FINALIZER, _frame_lua);          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+void check_even(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(n % 2 != 0)
+        luaL_error(L, "Expected an even number, got %d", (int) n);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int half_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(half_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+
+    MODULE_C_SETLINE();
+    check_even(L, n);
+
+    lua_pushinteger(L, n / 2);
+    return 1;
+}
+
+static const luaL_Reg module_fns[] = {
+    { "half_fn", half_fn },
+    { NULL, NULL }
+};
+
+int luaopen_spec_tracebacks_extraspace_module(lua_State *L) {
+    /* Fills in the extra space. The finalizer object is not needed here. */
+    pallene_tracer_init(L);
+    lua_pop(L, 1);
+
+    luaL_newlib(L, module_fns);
+
+    return 1;
+}
@@ -0,0 +1,28 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.hooklua.module"
+
+local function fails()
+    error("caught")
+end
+
+local function sleeper()
+    coroutine.yield()
+end
+
+local function inner()
+    -- The frame of `fails` is left behind by the error, until the next call.
+    pcall(fails)
+    -- The frame of `sleeper` stays until the thread which resumed it returns.
+    coroutine.wrap(sleeper)()
+    module.stack_fn()
+end
+
+function outer()
+    return inner()
+end
+
+outer()
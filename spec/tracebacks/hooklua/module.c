@@ -0,0 +1,93 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+/* Raises an error naming the frames of the call-stack, hooked Lua frames included. */
+void describe_stack(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+
+    luaL_Buffer b;
+    luaL_buffinit(L, &b);
+    luaL_addstring(&b, "Pallene stack:");
+    for(int i = fnstack->count - 1; i >= 0; i--) {
+        pt_frame_t *frame = &fnstack->stack[i];
+        if(frame->type == PALLENE_TRACER_FRAME_TYPE_LUA)
+            continue;
+
+        luaL_addstring(&b, frame->type == PALLENE_TRACER_FRAME_TYPE_HOOKED ? " lua:" : " c:");
+        luaL_addstring(&b, frame->shared.details->fn_name);
+    }
+    luaL_pushresult(&b);
+
+    MODULE_C_SETLINE();
+    lua_error(L);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int stack_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(stack_fn);
+
+    MODULE_C_SETLINE();
+    describe_stack(L);
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_hooklua_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    /* Record the Lua functions called from now on. */
+    pallene_tracer_hook_lua(L, fnstack, true);
+
+    lua_newtable(L);
+
+    /* ---- stack_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, stack_fn, 2);
+    lua_setfield(L, -2, "stack_fn");
+
+    return 1;
+}
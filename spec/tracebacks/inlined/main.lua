@@ -0,0 +1,9 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.inlined.module"
+
+assert(module.module_fn(3) == 9)
+module.module_fn(-1)
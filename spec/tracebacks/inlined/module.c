@@ -0,0 +1,105 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+static PT_DETAILS_SECTION pt_fn_details_t helper_details =
+    PALLENE_TRACER_FN_DETAILS("helper", __FILE__);
+static PT_DETAILS_SECTION pt_fn_details_t check_details =
+    PALLENE_TRACER_FN_DETAILS("check", __FILE__);
+
+/* `outer` is what the compiler made of it, with `helper` and `check` inlined:
+
+       static void check(lua_State *L, int n) {
+           if(n < 0)
+               luaL_error(L, "negative input: %d", n);
+       }
+
+       static int helper(lua_State *L, int n) {
+           check(L, n);
+           return n * 2;
+       }
+ */
+
+int outer(lua_State *L, int n) {
+    MODULE_C_FRAMEENTER();
+
+    int sum = n;
+
+    /* sum += helper(L, n), with `check` inlined into it at line 58. One frame. */
+    static PT_INLINED_SECTION const pt_inlined_t chain =
+        { { &helper_details, &check_details }, { __LINE__ - 2, 58 }, 2 };
+    PALLENE_TRACER_SETINLINED(fnstack, &chain);
+    PALLENE_TRACER_SETLINE(fnstack, 54);
+    if(n < 0)
+        luaL_error(L, "negative input: %d", n);
+    sum += n * 2;
+    PALLENE_TRACER_SETINLINED(fnstack, NULL);
+
+    MODULE_C_FRAMEEXIT();
+    return sum;
+}
+
+int module_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(module_fn);
+
+    int n = (int) luaL_checkinteger(L, 1);
+    MODULE_C_SETLINE();
+    lua_pushinteger(L, outer(L, n));
+
+    return 1;
+}
+
+int luaopen_spec_tracebacks_inlined_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- module_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, module_fn, 2);
+    lua_setfield(L, -2, "module_fn");
+
+    return 1;
+}
@@ -0,0 +1,20 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.instrument.module"
+
+assert(module.sum_fn(3) == 6)
+
+-- A thread closing its call-stack, then pushing native frames to the next one.
+assert(module.closed_fn() == 1)
+
+-- The error skips the exit hooks. The skipped frames must not show up later.
+assert(not pcall(module.sum_fn, 0))
+
+local function lua_fn(n)
+    return module.sum_fn(n)
+end
+
+lua_fn(-2)
@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* A module without any Pallene Tracer code. It is built with `-finstrument-functions`,
+   so its frames show up in `pt-lua` tracebacks anyway. Only `closed_fn` creates states
+   and call-stacks of its own, with the implementation of `pt-lua`. */
+
+#include <pthread.h>
+#include <lua.h>
+#include <lauxlib.h>
+#include "ptracer.h"
+
+/* The functions are not static, so `dladdr` finds their names. */
+
+void check_positive(lua_State *L, lua_Integer n) {
+    if(n <= 0)
+        luaL_error(L, "Expected a positive number, got %I", n);
+}
+
+lua_Integer sum_to(lua_State *L, lua_Integer n) {
+    check_positive(L, n);
+
+    return n == 1 ? 1 : n + sum_to(L, n - 1);
+}
+
+int sum_fn(lua_State *L) {
+    lua_Integer n = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, sum_to(L, n));
+
+    return 1;
+}
+
+int native_depth(pt_fnstack_t *fnstack) {
+    return fnstack->count;
+}
+
+/* The first call-stack of the thread is closed, so the hooks push to the next one. */
+void *closed_thread(void *depth) {
+    lua_State *L = luaL_newstate();
+    pallene_tracer_init(L);
+    lua_close(L);
+
+    /* Instrumented, must not touch the call-stack closed. */
+    sum_to(NULL, 10);
+
+    L = luaL_newstate();
+    *(int *) depth = native_depth(pallene_tracer_init(L));
+    lua_close(L);
+
+    return NULL;
+}
+
+int closed_fn(lua_State *L) {
+    pthread_t thread;
+    int depth = -1;
+    if(pthread_create(&thread, NULL, closed_thread, &depth) != 0)
+        luaL_error(L, "Cannot create a thread");
+    pthread_join(thread, NULL);
+
+    lua_pushinteger(L, depth);
+    return 1;
+}
+
+int luaopen_spec_tracebacks_instrument_module(lua_State *L) {
+    lua_newtable(L);
+
+    lua_pushcfunction(L, closed_fn);
+    lua_setfield(L, -2, "closed_fn");
+
+    lua_pushcfunction(L, sum_fn);
+    lua_setfield(L, -2, "sum_fn");
+
+    return 1;
+}
@@ -0,0 +1,32 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.latency.module"
+
+pallene_tracer_latency(true)
+for n = 1, 10 do
+    module.sum_fn(n)
+end
+pcall(module.sum_fn, "not a number")
+local snapshot = pallene_tracer_latency_snapshot(true)
+module.sum_fn(1)
+local after = pallene_tracer_latency_snapshot()
+pallene_tracer_latency(false)
+
+-- The times depend on the machine, so only their consistency is checked.
+local name = "spec.tracebacks.latency.module.sum_fn"
+local histogram = snapshot[name]
+local counted = 0
+for upper, count in pairs(histogram.buckets) do
+    assert(math.type(upper) == "integer")
+    counted = counted + count
+end
+assert(histogram.p50 <= histogram.p90 and histogram.p90 <= histogram.p99
+    and histogram.p99 <= histogram.p999 and histogram.p999 <= histogram.max)
+assert(histogram.sum >= histogram.max)
+
+local merged = pallene_tracer_latency_merge(snapshot, after)[name]
+error("count="..histogram.count.." buckets="..counted.." after="..after[name].count
+    .." merged="..merged.count)
@@ -0,0 +1,19 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.level.module"
+local module_lua = require "spec.tracebacks.level.module_lua"
+
+assert(module.sum_fn(3) == 6)
+
+local function lua_fn(n)
+    return module.sum_fn(n)
+end
+
+-- More calls than the call-stack has room for, at `PALLENE_TRACER_LEVEL_LUA`.
+local n = 100010
+assert(module_lua.loop_fn(n) == n * (n - 1) // 2)
+
+lua_fn(-2)
@@ -0,0 +1,64 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with `PT_LEVEL` set to `PALLENE_TRACER_LEVEL_C`: C interface frames are
+   recorded, their lines are not. */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include "../module_include.h"
+
+void check_positive(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(n <= 0)
+        luaL_error(L, "Expected a positive number, got %I", n);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+lua_Integer sum_to(lua_State *L, lua_Integer n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    check_positive(L, n);
+
+    MODULE_C_SETLINE();
+    lua_Integer result = n == 1 ? 1 : n + sum_to(L, n - 1);
+
+    MODULE_C_FRAMEEXIT();
+    return result;
+}
+
+int sum_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(sum_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+
+    MODULE_C_SETLINE();
+    lua_pushinteger(L, sum_to(L, n));
+
+    return 1;
+}
+
+int luaopen_spec_tracebacks_level_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- sum_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, sum_fn, 2);
+    lua_setfield(L, -2, "sum_fn");
+
+    return 1;
+}
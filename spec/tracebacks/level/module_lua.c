@@ -0,0 +1,78 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with `PT_LEVEL` set to `PALLENE_TRACER_LEVEL_LUA`: the helper macros of C
+   interface frames are compiled out, frames entered directly are not. */
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua)
+
+static lua_Integer helper(pt_fnstack_t *fnstack, lua_Integer i) {
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame);
+
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack);
+    lua_Integer result = 2 * i;
+
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack);
+    return result;
+}
+
+static lua_Integer direct(pt_fnstack_t *fnstack, lua_Integer i) {
+    static pt_fn_details_t details = PALLENE_TRACER_FN_DETAILS("direct", __FILE__);
+    pt_frame_t frame = PALLENE_TRACER_C_FRAME(details);
+    PALLENE_TRACER_FRAMEENTER(fnstack, &frame);
+
+    lua_Integer result = helper(fnstack, i) - i;
+
+    PALLENE_TRACER_FRAMEEXIT(fnstack);
+    return result;
+}
+
+static int loop_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(loop_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    lua_Integer sum = 0;
+    int depth = fnstack->count;
+    for(lua_Integer i = 0; i < n; i++) {
+        sum += direct(fnstack, i);
+        if(fnstack->count != depth)
+            luaL_error(L, "Frame left behind at call %I", i + 1);
+    }
+
+    lua_pushinteger(L, sum);
+    return 1;
+}
+
+int luaopen_spec_tracebacks_level_module_lua(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- loop_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, loop_fn, 2);
+    lua_setfield(L, -2, "loop_fn");
+
+    return 1;
+}
@@ -0,0 +1,14 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.library.module"
+
+module.descend_fn(3)
+
+local function lua_fn()
+    module.report_fn()
+end
+
+lua_fn()
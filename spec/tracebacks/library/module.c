@@ -0,0 +1,119 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* No `PT_IMPLEMENTATION`: the module links to `libptracer`, built with `PT_SINKS` and
+   `PT_POOL` as this module is. Under `pt-lua`, which exports its own implementation,
+   only what `pt-lua` lacks comes from `libptracer`, the pool here. */
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_SETLINE()                                       \
+    PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+/* A sink counting the C interface frames entered. */
+static int entered = 0;
+
+static void count_sink(void *ud, pt_event_t event, pt_fnstack_t *fnstack, const pt_frame_t *frame) {
+    (void) ud; (void) fnstack;
+
+    if(event == PALLENE_TRACER_EVENT_ENTER && frame != NULL
+        && frame->type == PALLENE_TRACER_FRAME_TYPE_C)
+        entered++;
+}
+
+void descend(lua_State *L, int depth) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(depth > 1)
+        descend(L, depth - 1);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+void report(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+
+    pt_pool_stats_t stats;
+    pallene_tracer_pool_stats(&stats);
+
+    MODULE_C_SETLINE();
+    luaL_error(L, "entered %d, pooled %d", entered, (int) (stats.in_use + stats.idle));
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int descend_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(descend_fn);
+
+    MODULE_C_SETLINE();
+    descend(L, (int) luaL_checkinteger(L, 1));
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int report_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(report_fn);
+
+    MODULE_C_SETLINE();
+    report(L);
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_library_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    pallene_tracer_sink_add(count_sink, NULL);
+
+    lua_newtable(L);
+
+    /* ---- descend_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, descend_fn, 2);
+    lua_setfield(L, -2, "descend_fn");
+
+    /* ---- report_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, report_fn, 2);
+    lua_setfield(L, -2, "report_fn");
+
+    return 1;
+}
@@ -0,0 +1,27 @@
+#ifndef MODULE_SUM_HEADER
+#define MODULE_SUM_HEADER
+
+/* The functions of the modules of the specs which count and time calls, after
+   `module_include.h`: `sum_fn(n)` calls `leaf` `n` times, from the same line. */
+
+int leaf(lua_State *L, int n) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_FRAMEEXIT();
+    return n;
+}
+
+int sum_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(sum_fn);
+
+    int n = (int) luaL_checkinteger(L, 1), sum = 0;
+    for(int i = 1; i <= n; i++) {
+        MODULE_C_SETLINE();
+        sum += leaf(L, i);
+    }
+
+    lua_pushinteger(L, sum);
+    return 1;
+}
+
+#endif // MODULE_SUM_HEADER
@@ -29,7 +29,7 @@
     PALLENE_TRACER_GENERIC_C_SETLINE(fnstack)
 
 #define MODULE_C_FRAMEEXIT()                                     \
-    PALLENE_TRACER_FRAMEEXIT(fnstack)
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
 
 /* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
 
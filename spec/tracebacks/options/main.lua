@@ -0,0 +1,14 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- `pt-lua` creates the call-stack with the defaults, the modules reconcile their options
+-- with it. A call-stack created with options of its own is in a state of its own, in
+-- memory of the Lua allocator or in anonymous pages.
+local mod_a = require "spec.tracebacks.options.module_a"
+local first = mod_a.options_fn()
+
+require "spec.tracebacks.options.module_b"
+
+error(first.."\n"..mod_a.options_fn().."\n"..mod_a.fresh_fn(4).."\n"..mod_a.fresh_fn(200, "mmap"))
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+#include "lualib.h"
+
+#include "module_include.h"
+
+/* Calls `f(n - 1)` while `n` is positive, two frames deeper each time. */
+int deep_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(deep_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 2);
+    if(n > 0) {
+        lua_pushvalue(L, 1);
+        lua_pushinteger(L, n - 1);
+        lua_call(L, 1, 0);
+    }
+
+    return 0;
+}
+
+/* The options the call-stack ended up with. */
+static void push_options(lua_State *L, pt_fnstack_t *fnstack) {
+    lua_pushfstring(L, "capacity %d, overflow %s", fnstack->capacity,
+        fnstack->overflow == PALLENE_TRACER_OVERFLOW_ERROR ? "error" : "truncate");
+}
+
+int options_fn(lua_State *L) {
+    MODULE_GET_FNSTACK;
+
+    push_options(L, fnstack);
+    return 1;
+}
+
+/* Creates a Lua state with a call-stack of `capacity` frames raising errors past it,
+   in the given storage, asks for twice the frames and the truncate policy as a second
+   module would, and recurses 100 times in it. */
+int fresh_fn(lua_State *L) {
+    static const char *const storages[] = { "allocator", "mmap", NULL };
+    static const pt_storage_t storage[] = {
+        PALLENE_TRACER_STORAGE_ALLOCATOR, PALLENE_TRACER_STORAGE_MMAP };
+
+    int capacity = (int) luaL_checkinteger(L, 1);
+    int which = luaL_checkoption(L, 2, "allocator", storages);
+
+    lua_State *S = luaL_newstate();
+    luaL_openlibs(S);
+
+    pt_options_t options = PALLENE_TRACER_DEFAULT_OPTIONS;
+    options.capacity = capacity;
+    options.overflow = PALLENE_TRACER_OVERFLOW_ERROR;
+    options.storage  = storage[which];
+    pt_fnstack_t *fnstack = pallene_tracer_init_ex(S, &options);
+
+    lua_pushlightuserdata(S, fnstack);
+    lua_pushvalue(S, -2);
+    lua_pushcclosure(S, deep_fn, 2);
+    lua_setglobal(S, "deep");
+
+    options.capacity = capacity * 2;
+    options.overflow = PALLENE_TRACER_OVERFLOW_TRUNCATE;
+    pallene_tracer_init_ex(S, &options);
+    lua_pop(S, 2);
+
+    int status = luaL_dostring(S, "local function f(n) deep(f, n) end f(100)");
+    push_options(L, fnstack);
+    lua_pushfstring(L, "%s: %s", lua_tostring(L, -1),
+        status != LUA_OK ? lua_tostring(S, -1) : "no error");
+
+    lua_close(S);
+    return 1;
+}
+
+int luaopen_spec_tracebacks_options_module_a(lua_State *L) {
+    /* Our stack, larger than the one of `pt-lua`. */
+    pt_options_t options = PALLENE_TRACER_DEFAULT_OPTIONS;
+    options.capacity = 150000;
+    options.overflow = PALLENE_TRACER_OVERFLOW_TRUNCATE;
+    pt_fnstack_t *fnstack = pallene_tracer_init_ex(L, &options);
+
+    lua_newtable(L);
+
+    /* ---- options_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushcclosure(L, options_fn, 1);
+    lua_setfield(L, -2, "options_fn");
+
+    lua_pushcfunction(L, fresh_fn);
+    lua_setfield(L, -2, "fresh_fn");
+
+    return 1;
+}
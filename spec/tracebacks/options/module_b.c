@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+int luaopen_spec_tracebacks_options_module_b(lua_State *L) {
+    /* A smaller stack, which it does not get, and errors past it, which it does. */
+    pt_options_t options = PALLENE_TRACER_DEFAULT_OPTIONS;
+    options.capacity = 1000;
+    options.overflow = PALLENE_TRACER_OVERFLOW_ERROR;
+    pallene_tracer_init_ex(L, &options);
+
+    lua_newtable(L);
+    return 1;
+}
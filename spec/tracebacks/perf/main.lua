@@ -0,0 +1,27 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.perf.module"
+
+-- The counters depend on the machine, so only their names are checked.
+local fields = {
+    hardware = { "cycles", "instructions", "cache_misses", "branch_misses", "ipc" },
+    software = { "task_clock", "page_faults", "context_switches", "cpu_migrations" },
+    none     = {},
+}
+
+local mode = pallene_tracer_perf("leaf")
+module.sum_fn(3)
+module.sum_fn(4)
+local stats = pallene_tracer_perf_stats()
+pallene_tracer_perf()
+
+for _, field in ipairs(fields[mode]) do
+    assert(stats.leaf[field], field)
+end
+
+module.sum_fn(2)
+error("leaf="..stats.leaf.calls.." sum_fn="..tostring(stats.sum_fn)
+    .." after="..tostring(next(pallene_tracer_perf_stats())))
@@ -0,0 +1,27 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Counts in call-stacks of 1000 frames. The thread cache holds 4 buffers, two
+-- call-stacks, and the process-wide list 16, eight call-stacks.
+local module = require "spec.tracebacks.pool.module"
+
+local function report(what)
+    return string.format("%s: in use %g, idle %g, high water %g", what, module.stats_fn(1000))
+end
+
+local lines = {}
+
+-- One state at a time reuses the buffers of the one before.
+module.churn_fn(100, 1, 1000, "pool")
+table.insert(lines, report("100 states, one at a time"))
+
+-- The buffers of a peak past the cache and the list are freed.
+module.churn_fn(30, 30, 1000, "pool")
+table.insert(lines, report("30 states at once"))
+
+module.trim_fn()
+table.insert(lines, report("trimmed"))
+
+error(table.concat(lines, "\n"))
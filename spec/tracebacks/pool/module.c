@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with `PT_POOL` and linked with `-Bsymbolic`, so that the states it creates get
+   their call-stacks from this implementation rather than from the one `pt-lua`
+   exports, which has no pool. `bench/pool.lua` runs it too. */
+
+#include <stdlib.h>
+
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* The bytes of a call-stack of `capacity` frames, its two buffers. */
+static size_t callstack_size(int capacity) {
+    return sizeof(pt_fnstack_t) + capacity * sizeof(pt_frame_t);
+}
+
+/* Opens and closes `n` states, `live` of them at a time, with call-stacks of `capacity`
+   frames from the "pool", from the "heap", or with "none". */
+int churn_fn(lua_State *L) {
+    static const char *const storages[] = { "pool", "heap", "none", NULL };
+    int n        = (int) luaL_checkinteger(L, 1);
+    int live     = (int) luaL_checkinteger(L, 2);
+    int capacity = (int) luaL_checkinteger(L, 3);
+    int storage  = luaL_checkoption(L, 4, NULL, storages);
+
+    lua_State **states = (lua_State **) malloc(live * sizeof(lua_State *));
+    if(states == NULL)
+        luaL_error(L, "out of memory");
+
+    pt_options_t options = PALLENE_TRACER_DEFAULT_OPTIONS;
+    options.capacity = capacity;
+    options.storage  = storage == 0 ? PALLENE_TRACER_STORAGE_POOL : PALLENE_TRACER_STORAGE_HEAP;
+
+    for(int done = 0; done < n; done += live) {
+        int open = n - done < live ? n - done : live;
+        for(int i = 0; i < open; i++) {
+            states[i] = luaL_newstate();
+            if(storage != 2)
+                pallene_tracer_init_ex(states[i], &options);
+        }
+
+        for(int i = 0; i < open; i++)
+            lua_close(states[i]);
+    }
+
+    free(states);
+    return 0;
+}
+
+/* The memory of the pool, in call-stacks of `capacity` frames: in use, idle and at the
+   high water mark. */
+int stats_fn(lua_State *L) {
+    size_t size = callstack_size((int) luaL_checkinteger(L, 1));
+
+    pt_pool_stats_t stats;
+    pallene_tracer_pool_stats(&stats);
+
+    lua_pushnumber(L, (lua_Number) stats.in_use / size);
+    lua_pushnumber(L, (lua_Number) stats.idle / size);
+    lua_pushnumber(L, (lua_Number) stats.high_water / size);
+    return 3;
+}
+
+int trim_fn(lua_State *L) {
+    (void) L;
+    pallene_tracer_pool_trim();
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_pool_module(lua_State *L) {
+    lua_newtable(L);
+
+    lua_pushcfunction(L, churn_fn);
+    lua_setfield(L, -2, "churn_fn");
+
+    lua_pushcfunction(L, stats_fn);
+    lua_setfield(L, -2, "stats_fn");
+
+    lua_pushcfunction(L, trim_fn);
+    lua_setfield(L, -2, "trim_fn");
+
+    return 1;
+}
@@ -0,0 +1,14 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.rle.module"
+
+function lua_fn(depth, fail)
+    module.module_fn(depth, fail)
+end
+
+-- Returning normally unwinds the repetitions one by one.
+lua_fn(500, false)
+lua_fn(10000, true)
@@ -0,0 +1,89 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include <stdio.h>
+
+#include "../module_include.h"
+
+/* A sink counting the events, and saying where tracebacks start. */
+static int events[PALLENE_TRACER_EVENT_TRACEBACK + 1];
+
+static void count_sink(void *ud, pt_event_t event, pt_fnstack_t *fnstack, const pt_frame_t *frame) {
+    (void) ud; (void) fnstack;
+    events[event]++;
+
+    if(event == PALLENE_TRACER_EVENT_TRACEBACK && frame != NULL
+        && frame->type == PALLENE_TRACER_FRAME_TYPE_C)
+        fprintf(stderr, "sink: traceback from '%s'\n", frame->shared.details->fn_name);
+}
+
+void descend(lua_State *L, int depth) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    if(depth > 1)
+        descend(L, depth - 1);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+void report(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+
+    MODULE_C_SETLINE();
+    luaL_error(L, "enter %d, exit %d, unwind %d", events[PALLENE_TRACER_EVENT_ENTER],
+        events[PALLENE_TRACER_EVENT_EXIT], events[PALLENE_TRACER_EVENT_UNWIND]);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int descend_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(descend_fn);
+
+    MODULE_C_SETLINE();
+    descend(L, (int) luaL_checkinteger(L, 1));
+
+    MODULE_C_FRAMEEXIT();
+    return 0;
+}
+
+int report_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(report_fn);
+
+    MODULE_C_SETLINE();
+    report(L);
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_sinks_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    /* Count the events of all the call-stacks from now on. */
+    pallene_tracer_sink_add(count_sink, NULL);
+
+    lua_newtable(L);
+
+    /* ---- descend_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, descend_fn, 2);
+    lua_setfield(L, -2, "descend_fn");
+
+    /* ---- report_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, report_fn, 2);
+    lua_setfield(L, -2, "report_fn");
+
+    return 1;
+}
@@ -0,0 +1,65 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- Run by `spec/pt-lua-shm`, which publishes its call-stack for `pt-spy`.
+
+local module = require "spec.tracebacks.spy.module"
+
+local function contents(name)
+    local file = io.open(name)
+    if not file then
+        return nil
+    end
+    local s = file:read("a")
+    file:close()
+    return s
+end
+
+local function pid_of(script)
+    local out = os.tmpname()
+    os.execute("(spec/pt-lua-shm -e '" .. script .. "' > " .. out .. "; true) 2> /dev/null")
+    local pid = tonumber(contents(out))
+    os.remove(out)
+    return pid
+end
+
+local function segment_of(pid)
+    return contents("/dev/shm/pallene-tracer." .. pid .. ".0") ~= nil
+end
+
+-- Sample ourselves while we spin, longer than `pt-spy` takes samples.
+local pid = contents("/proc/self/stat"):match("^%d+")
+local out = os.tmpname()
+assert(os.execute("(./pt-spy -f -r 1000 -d 0.5 " .. pid .. " > " .. out .. "; echo >> "
+    .. out .. ".done) &"))
+module.spin_fn(2)
+while not contents(out .. ".done") do
+    os.execute("sleep 0.1")
+end
+local folded = contents(out)
+os.remove(out)
+os.remove(out .. ".done")
+
+-- The counts depend on the machine, the stacks in the middle of a call do not.
+local stacks, seen = {}, {}
+for stack in string.gmatch(folded, "([^\n]*busy[^\n]*) %d+\n") do
+    if not seen[stack] then
+        seen[stack] = true
+        table.insert(stacks, stack)
+    end
+end
+table.sort(stacks)
+
+-- `os.exit` does not close the state, the segment is removed at exit.
+local exited = pid_of([[io.write(io.open("/proc/self/stat"):read("n")) os.exit(0)]])
+
+-- A killed process leaves its segment behind, for `pt-spy -c`.
+local killed = pid_of([[local pid = io.open("/proc/self/stat"):read("n")
+    io.write(pid) io.flush() os.execute("kill -KILL " .. pid)]])
+local left = segment_of(killed)
+assert(os.execute("./pt-spy -c 2> /dev/null"))
+
+error(table.concat(stacks, " ") .. " exited=" .. tostring(segment_of(exited))
+    .. " killed=" .. tostring(left) .. " reaped=" .. tostring(segment_of(killed)))
@@ -0,0 +1,50 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+local module = require "spec.tracebacks.trampoline.module"
+local string = pallene_tracer_wrap({ rep = string.rep }, "string")
+local coroutine = pallene_tracer_wrap({ wrap = coroutine.wrap, yield = coroutine.yield }, "coroutine")
+
+pallene_tracer_callgraph(true)
+
+-- The function runs in the call of the trampoline, so errors read as they do unwrapped.
+local function check(n)
+    local m = module.check(n)
+    return m
+end
+
+local function rep(strings, s)
+    local r = strings.rep(s, 2)
+    return r
+end
+
+assert(select(2, pcall(check, -1)) == "spec/tracebacks/trampoline/main.lua:14: negative input: -1")
+assert(select(2, pcall(check, "x"))
+    == "spec/tracebacks/trampoline/main.lua:14: bad argument #1 to 'check' (number expected, got string)")
+assert(select(2, pcall(rep, string, {})) == select(2, pcall(rep, _G.string, {})))
+assert(module.count() == 1 and module.count() == 2)
+assert(select("#", module.apply(function(...) return ... end, 1, 2, 3)) == 3)
+assert(string.rep("a", 2) == "aa")
+
+local co = coroutine.wrap(function(x) return coroutine.yield(x) + 1 end)
+assert(co(1) == 1 and co(2) == 3)
+
+local edges = {}
+for _, edge in ipairs(pallene_tracer_callgraph_edges()) do
+    table.insert(edges, edge.callee.."="..edge.calls)
+end
+table.sort(edges)
+pallene_tracer_callgraph(false)
+
+assert(table.concat(edges, " ") == "coroutine.wrap=1 coroutine.yield=1 module.apply=1 module.check=2 module.count=2 string.rep=2")
+
+-- The frames of a call which raised an error stay until the next trampoline, and do
+-- not stand for the trampoline of `module.apply` in the traceback.
+local function callback(n)
+    assert(not pcall(module.check, -n))
+    error("checked")
+end
+
+module.apply(callback, 1)
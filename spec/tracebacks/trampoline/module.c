@@ -0,0 +1,58 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* A C module which knows nothing about Pallene Tracer. The Makefile compiles it with
+   `-include ptracer.h -DPT_WRAP_SETFUNCS`. */
+
+#include <lua.h>
+#include <lauxlib.h>
+
+static int check(lua_State *L) {
+    lua_Integer n = luaL_checkinteger(L, 1);
+    if(n < 0)
+        luaL_error(L, "negative input: %d", (int) n);
+
+    lua_pushinteger(L, n);
+    return 1;
+}
+
+/* Calls its first argument with the others. */
+static int apply(lua_State *L) {
+    luaL_checktype(L, 1, LUA_TFUNCTION);
+    lua_call(L, lua_gettop(L) - 1, LUA_MULTRET);
+
+    return lua_gettop(L);
+}
+
+/* Counts the calls, in an upvalue. */
+static int count(lua_State *L) {
+    lua_Integer n = lua_tointeger(L, lua_upvalueindex(1)) + 1;
+    lua_pushinteger(L, n);
+    lua_copy(L, -1, lua_upvalueindex(1));
+
+    return 1;
+}
+
+static const luaL_Reg functions[] = {
+    { "check", check },
+    { "apply", apply },
+    { NULL, NULL }
+};
+
+static const luaL_Reg counters[] = {
+    { "count", count },
+    { NULL, NULL }
+};
+
+int luaopen_spec_tracebacks_trampoline_module(lua_State *L) {
+    luaL_newlib(L, functions);
+
+    lua_pushinteger(L, 0);
+    luaL_setfuncs(L, counters, 1);
+
+    return 1;
+}
@@ -0,0 +1,98 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with `PT_UNWIND`: only the Lua interface frame is recorded. */
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua)
+
+/* C interface functions need no macros at all. They are not static, so `dladdr`
+   finds their names. */
+
+void check_positive(lua_State *L, lua_Integer n) {
+    if(n <= 0)
+        luaL_error(L, "Expected a positive number, got %I", n);
+}
+
+lua_Integer sum_to(lua_State *L, lua_Integer n) {
+    check_positive(L, n);
+
+    return n == 1 ? 1 : n + sum_to(L, n - 1);
+}
+
+/* Only Lua interface frames are entered directly, so the helper stays balanced. */
+lua_Integer loop_step(lua_State *L, pt_fnstack_t *fnstack, lua_Integer i) {
+    static pt_fn_details_t details = PALLENE_TRACER_FN_DETAILS("loop_step", __FILE__);
+    pt_frame_t frame = PALLENE_TRACER_C_FRAME(details);
+    PALLENE_TRACER_FRAMEENTER(fnstack, &frame);
+
+    check_positive(L, i + 1);
+
+    PALLENE_TRACER_FRAMEEXIT(fnstack);
+    return i;
+}
+
+int loop_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(loop_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    lua_Integer sum = 0;
+    int depth = fnstack->count;
+    for(lua_Integer i = 0; i < n; i++) {
+        sum += loop_step(L, fnstack, i);
+        if(fnstack->count != depth)
+            luaL_error(L, "Frame left behind at call %I", i + 1);
+    }
+
+    lua_pushinteger(L, sum);
+    return 1;
+}
+
+int sum_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(sum_fn);
+
+    lua_Integer n = luaL_checkinteger(L, 1);
+    lua_pushinteger(L, sum_to(L, n));
+
+    return 1;
+}
+
+int luaopen_spec_tracebacks_unwind_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- sum_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, sum_fn, 2);
+    lua_setfield(L, -2, "sum_fn");
+
+    /* ---- loop_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, loop_fn, 2);
+    lua_setfield(L, -2, "loop_fn");
+
+    return 1;
+}
@@ -0,0 +1,13 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- The depth of every probe is the position of its frame, from 1 at the bottom, the
+-- `unwind` one included.
+local module = require "spec.tracebacks.usdt.module"
+
+module.probes_fn()
+module.probed_fn()
+
+error(module.probes_fn())
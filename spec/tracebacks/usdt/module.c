@@ -0,0 +1,108 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Built with `PT_USDT` and the `sys/sdt.h` next to it, which calls `spec_usdt_probe`. */
+
+#include <stdio.h>
+#include <string.h>
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+/* Here goes user specific macros when Pallene Tracer debug mode is active. */
+#ifdef PT_DEBUG
+#define MODULE_GET_FNSTACK                                       \
+    pt_fnstack_t *fnstack = lua_touserdata(L,                    \
+        lua_upvalueindex(1))
+#else
+#define MODULE_GET_FNSTACK
+#endif // PT_DEBUG
+
+/* ---------------- FOR C INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_C_FRAMEENTER()                                    \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame)
+
+#define MODULE_C_FRAMEEXIT()                                     \
+    PALLENE_TRACER_C_FRAMEEXIT(fnstack)
+
+/* ---------------- FOR C INTERFACE FUNCTIONS END ---------------- */
+
+/* ---------------- LUA INTERFACE FUNCTIONS ---------------- */
+
+#define MODULE_LUA_FRAMEENTER(fnptr)                             \
+    MODULE_GET_FNSTACK;                                          \
+    PALLENE_TRACER_LUA_FRAMEENTER(L, fnstack, fnptr,             \
+        lua_upvalueindex(2), _frame_lua);                        \
+    PALLENE_TRACER_GENERIC_C_FRAMEENTER(fnstack, _frame_c)
+
+/* ---------------- LUA INTERFACE FUNCTIONS END ---------------- */
+
+/* The probes fired, as "probe name depth" lines. */
+static char probes[1024];
+
+void spec_usdt_probe(const char *probe, const char *fn_name, const char *filename,
+    int line, int depth) {
+    (void) filename;
+    (void) line;
+
+    size_t used = strlen(probes);
+    snprintf(probes + used, sizeof(probes) - used, "%s %s %d\n", probe,
+        fn_name != NULL ? fn_name : "-", depth);
+}
+
+void inner(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+    MODULE_C_FRAMEEXIT();
+}
+
+/* Leaves its frame behind, as an error would. */
+void failing(lua_State *L) {
+    MODULE_C_FRAMEENTER();
+}
+
+int probed_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(probed_fn);
+
+    inner(L);
+    failing(L);
+
+    /* The finalizer of `pt-lua` has no probes, so close our frames with ours. */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushcclosure(L, _pallene_tracer_finalizer, 1);
+    lua_call(L, 0, 0);
+
+    return 0;
+}
+
+/* Returns the probes fired since the last call. */
+int probes_fn(lua_State *L) {
+    lua_pushstring(L, probes);
+    probes[0] = '\0';
+
+    return 1;
+}
+
+int luaopen_spec_tracebacks_usdt_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- probed_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, probed_fn, 2);
+    lua_setfield(L, -2, "probed_fn");
+
+    lua_pushcfunction(L, probes_fn);
+    lua_setfield(L, -2, "probes_fn");
+
+    return 1;
+}
@@ -0,0 +1,20 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Stands for the header of SystemTap, which may be missing, so that `PT_USDT` builds
+   everywhere. The probes call the module instead, which records them. */
+
+#ifndef SPEC_SYS_SDT_H
+#define SPEC_SYS_SDT_H
+
+void spec_usdt_probe(const char *probe, const char *fn_name, const char *filename,
+    int line, int depth);
+
+#define DTRACE_PROBE4(provider, name, fn_name, filename, line, depth)    \
+    spec_usdt_probe(#name, fn_name, filename, line, depth)
+
+#endif // SPEC_SYS_SDT_H
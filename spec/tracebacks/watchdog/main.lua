@@ -0,0 +1,19 @@
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+-- The watchdog reports a call running longer than its threshold, once.
+local out = os.tmpname()
+assert(os.execute("PT_LUA_WATCHDOG=100 ./pt-lua -e '"
+    .. "local module = require \"spec.tracebacks.watchdog.module\" "
+    .. "module.wait_fn(0.5) module.wait_fn(0.01)' 2> " .. out))
+
+local file = io.open(out)
+local report = file:read("a")
+file:close()
+os.remove(out)
+
+-- The ages depend on the machine.
+report = report:gsub("^\n", ""):gsub("%d+ ms", "N ms")
+error(report)
@@ -0,0 +1,54 @@
+/*
+ * Copyright (c) 2024, The Pallene Developers
+ * Pallene Tracer is licensed under the MIT license.
+ * Please refer to the LICENSE and AUTHORS files for details
+ * SPDX-License-Identifier: MIT
+ */
+
+/* Sleeps in a Lua interface call, long enough for the watchdog of `pt-lua`. */
+
+#include <time.h>
+
+/* Static use of the library would suffice. */
+#define PT_IMPLEMENTATION
+#include "ptracer.h"
+
+#include "../module_include.h"
+
+/* Sleeps for `seconds`. */
+void nap_for(lua_State *L, double seconds) {
+    MODULE_C_FRAMEENTER();
+
+    struct timespec ts;
+    ts.tv_sec = (time_t) seconds;
+    ts.tv_nsec = (long) ((seconds - (double) ts.tv_sec) * 1e9);
+    MODULE_C_SETLINE();
+    nanosleep(&ts, NULL);
+
+    MODULE_C_FRAMEEXIT();
+}
+
+int wait_fn(lua_State *L) {
+    MODULE_LUA_FRAMEENTER(wait_fn);
+
+    double seconds = luaL_checknumber(L, 1);
+    MODULE_C_SETLINE();
+    nap_for(L, seconds);
+
+    return 0;
+}
+
+int luaopen_spec_tracebacks_watchdog_module(lua_State *L) {
+    /* Our stack. */
+    pt_fnstack_t *fnstack = pallene_tracer_init(L);
+
+    lua_newtable(L);
+
+    /* ---- wait_fn ---- */
+    lua_pushlightuserdata(L, fnstack);
+    lua_pushvalue(L, -3);
+    lua_pushcclosure(L, wait_fn, 2);
+    lua_setfield(L, -2, "wait_fn");
+
+    return 1;
+}
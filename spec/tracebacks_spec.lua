@@ -5,12 +5,12 @@
 
 local util = require "spec.util"
 
-local function assert_test(example, expected_content)
+local function assert_test(example, expected_content, lua)
     assert(util.execute("make --quiet tests"))
 
     local dir  = util.shell_quote("spec/tracebacks/"..example)
     local ok, _, output_content, err_content =
-        util.outputs_of_execute("./pt-lua "..dir.."/main.lua")
+        util.outputs_of_execute((lua or "./pt-lua").." "..dir.."/main.lua")
     assert(not ok, output_content)
     assert.are.same(expected_content, err_content)
 end
@@ -74,6 +74,316 @@ stack traceback:
 ]])
 end)
 
+it("Recursion collapse", function()
+    assert_test("collapse", [[
+./pt-lua: spec/tracebacks/collapse/main.lua:9: Recursion bottomed out!
+stack traceback:
+    spec/tracebacks/collapse/module.c:53: in function 'recurse'
+    spec/tracebacks/collapse/module.c:50: in function 'recurse' (x 10,000)
+    spec/tracebacks/collapse/main.lua:9: in function 'lua_fn'
+    spec/tracebacks/collapse/main.lua:12: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Run-length encoded recursion", function()
+    assert_test("rle", [[
+./pt-lua: spec/tracebacks/rle/main.lua:9: Recursion bottomed out!
+stack traceback:
+    spec/tracebacks/rle/module.c:55: in function 'recurse'
+    spec/tracebacks/rle/module.c:52: in function 'recurse' (x 10,000)
+    spec/tracebacks/rle/main.lua:9: in function 'lua_fn'
+    spec/tracebacks/rle/main.lua:14: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("C++ scope guards", function()
+    assert_test("cxx", [[
+./pt-lua: spec/tracebacks/cxx/main.lua:13: Expected a positive number, got 0
+stack traceback:
+    spec/tracebacks/cxx/module.cpp:78: in function 'countdown_fn'
+    spec/tracebacks/cxx/main.lua:13: in function 'lua_fn'
+    spec/tracebacks/cxx/main.lua:16: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Instrumented native frames", function()
+    assert_test("instrument", [[
+./pt-lua: spec/tracebacks/instrument/main.lua:17: Expected a positive number, got -2
+stack traceback:
+    ./spec/tracebacks/instrument/module.so: in function 'check_positive'
+    ./spec/tracebacks/instrument/module.so: in function 'sum_to'
+    ./spec/tracebacks/instrument/module.so: in function 'sum_fn'
+    spec/tracebacks/instrument/main.lua:17: in function 'lua_fn'
+    spec/tracebacks/instrument/main.lua:20: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Unwound C frames", function()
+    assert_test("unwind", [[
+./pt-lua: spec/tracebacks/unwind/main.lua:11: Expected a positive number, got -2
+stack traceback:
+    ./spec/tracebacks/unwind/module.so: in function 'check_positive'
+    ./spec/tracebacks/unwind/module.so: in function 'sum_to'
+    ./spec/tracebacks/unwind/module.so: in function 'sum_fn'
+    spec/tracebacks/unwind/main.lua:11: in function 'lua_fn'
+    spec/tracebacks/unwind/main.lua:18: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Budgets", function()
+    assert_test("budget", [[
+spec/tracebacks/budget/main.lua:13: Pallene Tracer budget exceeded (steps)
+stack traceback:
+    spec/tracebacks/budget/module.c:21: in function 'spin'
+    spec/tracebacks/budget/module.c:31: in function 'spin_fn'
+    spec/tracebacks/budget/main.lua:13: in function 'lua_fn'
+    C: in function 'pallene_tracer_budget'
+    spec/tracebacks/budget/main.lua:17: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Extra space", function()
+    assert_test("extraspace", [[
+./pt-lua: spec/tracebacks/extraspace/main.lua:14: Expected an even number, got 3
+stack traceback:
+    spec/tracebacks/extraspace/module.c:49: in function 'check_even'
+    spec/tracebacks/extraspace/module.c:61: in function 'half_fn'
+    spec/tracebacks/extraspace/main.lua:14: in function 'lua_fn'
+    spec/tracebacks/extraspace/main.lua:19: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Tracing levels", function()
+    assert_test("level", [[
+./pt-lua: spec/tracebacks/level/main.lua:12: Expected a positive number, got -2
+stack traceback:
+    spec/tracebacks/level/module.c: in function 'check_positive'
+    spec/tracebacks/level/module.c: in function 'sum_to'
+    spec/tracebacks/level/module.c: in function 'sum_fn'
+    spec/tracebacks/level/main.lua:12: in function 'lua_fn'
+    spec/tracebacks/level/main.lua:19: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Hooked Lua frames", function()
+    assert_test("hooklua", [[
+./pt-lua: Pallene stack: c:describe_stack c:stack_fn lua:<spec/tracebacks/hooklua/main.lua:16>
+stack traceback:
+    spec/tracebacks/hooklua/module.c:63: in function 'describe_stack'
+    spec/tracebacks/hooklua/module.c:72: in function 'stack_fn'
+    spec/tracebacks/hooklua/main.lua:21: in function '<?>'
+    spec/tracebacks/hooklua/main.lua:28: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Sinks", function()
+    assert_test("sinks", [[
+sink: traceback from 'report'
+./pt-lua: spec/tracebacks/sinks/main.lua:11: enter 8, exit 4, unwind 1
+stack traceback:
+    spec/tracebacks/sinks/module.c:42: in function 'report'
+    spec/tracebacks/sinks/module.c:62: in function 'report_fn'
+    spec/tracebacks/sinks/main.lua:11: in function 'lua_fn'
+    spec/tracebacks/sinks/main.lua:14: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Linked to libptracer", function()
+    assert_test("library", [[
+./pt-lua: spec/tracebacks/library/main.lua:11: entered 6, pooled 0
+stack traceback:
+    spec/tracebacks/library/module.c:74: in function 'report'
+    spec/tracebacks/library/module.c:93: in function 'report_fn'
+    spec/tracebacks/library/main.lua:11: in function 'lua_fn'
+    spec/tracebacks/library/main.lua:14: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Call counters", function()
+    assert_test("counters", [[
+./pt-lua: spec/tracebacks/counters/main.lua:29: {leaf=7 sum_fn=2} {leaf=1 sum_fn=1}
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/counters/main.lua:29: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Inlined frames", function()
+    assert_test("inlined", [[
+./pt-lua: spec/tracebacks/inlined/main.lua:9: negative input: -1
+stack traceback:
+    spec/tracebacks/inlined/module.c:54: in function 'check' (inlined)
+    spec/tracebacks/inlined/module.c:58: in function 'helper' (inlined)
+    spec/tracebacks/inlined/module.c:68: in function 'outer'
+    spec/tracebacks/inlined/module.c:87: in function 'module_fn'
+    spec/tracebacks/inlined/main.lua:9: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Performance counters", function()
+    assert_test("perf", [[
+./pt-lua: spec/tracebacks/perf/main.lua:26: leaf=7 sum_fn=nil after=nil
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/perf/main.lua:26: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Call graph", function()
+    assert_test("callgraph", [[
+./pt-lua: spec/tracebacks/callgraph/main.lua:22: down->down=4 down->leaf=2 lua->sum_fn=2 sum_fn->down=2 sum_fn->leaf=7
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/callgraph/main.lua:22: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Latency histograms", function()
+    assert_test("latency", [[
+./pt-lua: spec/tracebacks/latency/main.lua:31: count=11 buckets=11 after=1 merged=12
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/latency/main.lua:31: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Context accounting", function()
+    assert_test("accounting", [[
+./pt-lua: spec/tracebacks/accounting/main.lua:40: 0=1 42=1 7=3 after=nil context=0
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/accounting/main.lua:40: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Trampolines", function()
+    assert_test("trampoline", [[
+./pt-lua: spec/tracebacks/trampoline/main.lua:47: checked
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/trampoline/main.lua:47: in function '<?>'
+    C: in function 'module.apply'
+    spec/tracebacks/trampoline/main.lua:50: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Shared memory and pt-spy", function()
+    assert_test("spy", [[
+spec/pt-lua-shm: spec/tracebacks/spy/main.lua:64: spin_fn (spec/tracebacks/spy/module.c);busy (spec/tracebacks/spy/module.c) exited=false killed=true reaped=false
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/spy/main.lua:64: in <main>
+    C: in function '<?>'
+]], "spec/pt-lua-shm")
+end)
+
+it("Static probes", function()
+    assert_test("usdt", [[
+./pt-lua: spec/tracebacks/usdt/main.lua:13: frameenter - 1
+frameenter probed_fn 2
+frameenter inner 3
+frameexit inner 3
+frameenter failing 3
+unwind failing 3
+
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/usdt/main.lua:13: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Stack dumps", function()
+    assert_test("dump", [[
+./pt-lua: spec/tracebacks/dump/main.lua:27: ./pt-lua: signal 3, dumping stacks
+Pallene stack (3 frames):
+    spec/tracebacks/dump/module.c:53: in function 'signal_self'
+    spec/tracebacks/dump/module.c:62: in function 'quit_fn'
+    (called from Lua)
+Lua stacks:
+thread (running)
+stack traceback:
+    C: in function '<?>'
+    spec/tracebacks/dump/module.c:62: in function 'quit_fn'
+    spec/tracebacks/dump/child.lua:27: in <main>
+    C: in function '<?>'
+thread 0x... (suspended)
+stack traceback:
+	[C]: in function 'coroutine.yield'
+	spec/tracebacks/dump/child.lua:10: in function <spec/tracebacks/dump/child.lua:9>
+thread 0x... (suspended)
+stack traceback:
+	[C]: in function 'coroutine.yield'
+	spec/tracebacks/dump/child.lua:10: in function <spec/tracebacks/dump/child.lua:9>
+thread 0x... (suspended)
+stack traceback:
+	[C]: in function 'coroutine.yield'
+	spec/tracebacks/dump/child.lua:23: in function <spec/tracebacks/dump/child.lua:20>
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/dump/main.lua:27: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Watchdog", function()
+    assert_test("watchdog", [[
+./pt-lua: spec/tracebacks/watchdog/main.lua:19: ./pt-lua: watchdog: Lua interface call running for N ms
+Pallene stack (3 frames):
+    spec/tracebacks/watchdog/module.c:26: in function 'nap_for' [N ms]
+    spec/tracebacks/watchdog/module.c:36: in function 'wait_fn' [N ms]
+    (called from Lua) [N ms]
+
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/watchdog/main.lua:19: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Call-stack options", function()
+    assert_test("options", [[
+./pt-lua: spec/tracebacks/options/main.lua:14: capacity 150000, overflow truncate
+capacity 150000, overflow error
+capacity 8, overflow error: [string "local function f(n) deep(f, n) end f(100)"]:1: Pallene Tracer call-stack overflow (more than 8 frames)
+capacity 400, overflow error: no error
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/options/main.lua:14: in <main>
+    C: in function '<?>'
+]])
+end)
+
+it("Pooled call-stacks", function()
+    assert_test("pool", [[
+./pt-lua: spec/tracebacks/pool/main.lua:27: 100 states, one at a time: in use 0, idle 1, high water 1
+30 states at once: in use 0, idle 10, high water 30
+trimmed: in use 0, idle 2, high water 30
+stack traceback:
+    C: in function 'error'
+    spec/tracebacks/pool/main.lua:27: in <main>
+    C: in function '<?>'
+]])
+end)
+
 it("Anonymous Lua Fn", function()
     assert_test("anon_lua", [[
 ./pt-lua: spec/tracebacks/anon_lua/main.lua:9: Error from a C function, which has no trace in Lua callstack!
@@ -102,7 +412,7 @@ stack traceback:
     spec/tracebacks/ellipsis/module.c:52: in function 'module_fn'
     spec/tracebacks/ellipsis/main.lua:9: in function 'lua_fn'
 
-    ... (Skipped 379 frames) ...
+    ... (Skipped 378 frames) ...
 
     spec/tracebacks/ellipsis/module.c:52: in function 'module_fn'
     spec/tracebacks/ellipsis/main.lua:9: in function 'lua_fn'
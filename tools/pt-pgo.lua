@@ -0,0 +1,208 @@
+#!/usr/bin/lua
+
+-- Copyright (c) 2024, The Pallene Developers
+-- Pallene Tracer is licensed under the MIT license.
+-- Please refer to the LICENSE and AUTHORS files for details
+-- SPDX-License-Identifier: MIT
+
+--
+-- Command line parsing
+--
+
+-- No argparse: the Makefile runs this with pt-lua, as a step of the module builds.
+local usage = [[
+usage: pt-pgo.lua [options] profile...
+Turn profiles into build inputs which pack the hot functions of modules together.
+Profiles are folded stacks of pt-spy (-f) and calls written by pt-lua (PT_LUA_STATS).
+Available options are:
+  --order file     write the hot functions, hottest first, for the linker
+  --sections       write section names (.text.fn) instead of symbol names
+  --header file    write PT_PGO_<fn> hints for PALLENE_TRACER_PGO
+  --hot fraction   hot functions take this much of the profile together (def. 0.9)
+  --cold fraction  cold functions take less than this of the profile each (def. 0.001)]]
+
+local args = { hot = 0.9, cold = 0.001, profiles = {} }
+
+local function die(msg)
+    io.stderr:write("pt-pgo.lua: ", msg, "\n", usage, "\n")
+    os.exit(1)
+end
+
+do
+    local i = 1
+    local function value()
+        i = i + 1
+        return arg[i] or die("missing value for " .. arg[i - 1])
+    end
+
+    while arg[i] do
+        local a = arg[i]
+        if     a == "--order"    then args.order = value()
+        elseif a == "--sections" then args.sections = true
+        elseif a == "--header"   then args.header = value()
+        elseif a == "--hot"      then args.hot = tonumber(value()) or die("bad --hot")
+        elseif a == "--cold"     then args.cold = tonumber(value()) or die("bad --cold")
+        elseif a:sub(1, 2) == "--" then die("unknown option " .. a)
+        else table.insert(args.profiles, a)
+        end
+        i = i + 1
+    end
+
+    if #args.profiles == 0 then
+        die("no profiles")
+    end
+end
+
+--
+-- Reading the profiles
+--
+
+-- Function name => { self = samples on top, total = samples anywhere, calls = calls }
+local functions = {}
+local sums = { self = 0, total = 0, calls = 0 }
+
+local function get(name)
+    local fn = functions[name]
+    if not fn then
+        fn = { name = name, self = 0, total = 0, calls = 0 }
+        functions[name] = fn
+    end
+    return fn
+end
+
+-- Labels of pt-spy are "fn_name (filename)". Native frames ("module.so+0x1139") and
+-- Lua functions ("<main>") are not symbols of modules.
+local function symbol(label)
+    local name = string.match(label, "^(.-) %(.*%)$") or label
+    if string.match(name, "^[%a_][%w_]*$") then
+        return name
+    end
+end
+
+local function read_calls(file)
+    for line in file:lines() do
+        local name, calls = string.match(line, "^(%S+) (%d+)$")
+        if name and symbol(name) then
+            get(name).calls = get(name).calls + tonumber(calls)
+            sums.calls = sums.calls + tonumber(calls)
+        end
+    end
+end
+
+local function read_stacks(file, first)
+    local function stack(line)
+        local frames, count = string.match(line, "^(.*) (%d+)$")
+        if not frames then
+            return
+        end
+        count = tonumber(count)
+        sums.self = sums.self + count
+
+        local seen, name = {}, nil
+        for label in string.gmatch(frames, "[^;]+") do
+            name = symbol(label)
+            if name and not seen[name] then
+                seen[name] = true
+                get(name).total = get(name).total + count
+            end
+        end
+
+        -- Only the innermost frame gets the sample to itself.
+        if name then
+            get(name).self = get(name).self + count
+        end
+    end
+
+    stack(first)
+    for line in file:lines() do
+        stack(line)
+    end
+    sums.total = sums.self
+end
+
+for _, path in ipairs(args.profiles) do
+    local file = io.open(path, "r") or die("cannot open " .. path)
+    local first = file:read("l") or ""
+    if first == "# pallene-tracer calls" then
+        read_calls(file)
+    else
+        read_stacks(file, first)
+    end
+    file:close()
+end
+
+--
+-- Ranking
+--
+
+-- Time spent comes first, when there are samples. Calls break ties, or rank the
+-- functions alone.
+local ranked = {}
+for _, fn in pairs(functions) do
+    table.insert(ranked, fn)
+end
+
+table.sort(ranked, function(a, b)
+    if a.self ~= b.self then return a.self > b.self end
+    if a.total ~= b.total then return a.total > b.total end
+    if a.calls ~= b.calls then return a.calls > b.calls end
+    return a.name < b.name
+end)
+
+local weight = sums.self > 0 and "self" or "calls"
+
+-- The hottest functions until they take `--hot` of the profile.
+local covered = 0
+for _, fn in ipairs(ranked) do
+    if sums[weight] > 0 and covered < args.hot * sums[weight] and fn[weight] > 0 then
+        fn.hint = "hot"
+        covered = covered + fn[weight]
+    end
+end
+
+-- Functions which take less than `--cold` of every profile they are in.
+for _, fn in ipairs(ranked) do
+    local cold = true
+    for _, what in ipairs({ "total", "calls" }) do
+        if sums[what] > 0 and fn[what] >= args.cold * sums[what] then
+            cold = false
+        end
+    end
+    if cold and not fn.hint then
+        fn.hint = "cold"
+    end
+end
+
+--
+-- Writing the results
+--
+
+-- Cold functions are left out, so the linker puts them after the others.
+if args.order then
+    local file = io.open(args.order, "w") or die("cannot write " .. args.order)
+    for _, fn in ipairs(ranked) do
+        if fn.hint ~= "cold" then
+            if not args.sections then
+                file:write(fn.name, "\n")
+            elseif fn.hint == "hot" then
+                -- GCC puts hot functions in sections of their own.
+                file:write(".text.hot.", fn.name, "\n", ".text.", fn.name, "\n")
+            else
+                file:write(".text.", fn.name, "\n")
+            end
+        end
+    end
+    file:close()
+end
+
+if args.header then
+    local file = io.open(args.header, "w") or die("cannot write " .. args.header)
+    file:write("/* Generated by tools/pt-pgo.lua from ", table.concat(args.profiles, " "),
+        ". */\n", "/* See `PALLENE_TRACER_PGO` in ptracer.h. */\n\n")
+    for _, fn in ipairs(ranked) do
+        if fn.hint then
+            file:write("#define PT_PGO_", fn.name, " ", fn.hint, "\n")
+        end
+    end
+    file:close()
+end